@@ -0,0 +1,258 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "account.h"
+#include "config.h"
+
+Account ACCOUNTS[MAX_ACCOUNTS];
+int ACCOUNT_COUNT = 0;
+
+static int extra_accounts = 0; // ACCOUNT lines read so far, kept from ACCOUNTS[1] on
+
+// Zone to account table, open addressing on the zone ID
+struct zone_account {
+    char zone_id[33]; // "" for an empty slot
+    short account;
+    short pinned;     // Set by a ZONE line; listings never move it
+};
+
+static struct zone_account *zones = NULL;
+static size_t zone_capacity = 0; // Power of two
+static size_t zone_count = 0;
+static int zones_loaded = 0;
+static int zones_dirty = 0;
+
+// ZONE values seen before every account was known, resolved by account_finish
+struct pin {
+    char *value;
+    int line; // Line of the configuration file, for errors
+};
+static struct pin *pins = NULL;
+static int pin_count = 0;
+
+static unsigned long hash_zone(const char *zone_id) {
+    unsigned long hash = 14695981039346656037UL;
+    for (const char *p = zone_id; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211UL;
+    }
+    return hash;
+}
+
+static struct zone_account *find_slot(const char *zone_id) {
+    if (zone_capacity == 0) return NULL;
+    size_t mask = zone_capacity - 1;
+    for (size_t i = hash_zone(zone_id) & mask;; i = (i + 1) & mask) {
+        if (zones[i].zone_id[0] == '\0' || strcmp(zones[i].zone_id, zone_id) == 0) return &zones[i];
+    }
+}
+
+static int grow_zones(void) {
+    size_t capacity = zone_capacity ? zone_capacity * 2 : 256;
+    struct zone_account *old = zones;
+    size_t old_capacity = zone_capacity;
+
+    zones = calloc(capacity, sizeof(struct zone_account));
+    if (!zones) {
+        zones = old;
+        return 0;
+    }
+    zone_capacity = capacity;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].zone_id[0]) *find_slot(old[i].zone_id) = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+// Set a zone's account. A learned account never replaces a pinned one.
+static int set_zone(const char *zone_id, int account, int pinned) {
+    if (strlen(zone_id) == 0 || strlen(zone_id) > 32) return 0;
+    if ((zone_count + 1) * 10 > zone_capacity * 7 && !grow_zones()) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+
+    struct zone_account *slot = find_slot(zone_id);
+    if (slot->zone_id[0] == '\0') {
+        strcpy(slot->zone_id, zone_id);
+        zone_count++;
+    } else if (slot->pinned && !pinned) {
+        return 1;
+    }
+    slot->account = (short)account;
+    slot->pinned = (short)pinned;
+    return 1;
+}
+
+// Read the zones learned by earlier listings, the first time they are needed
+static void load_zones(void) {
+    if (zones_loaded) return;
+    zones_loaded = 1;
+
+    FILE *file = fopen(ZONE_ACCOUNTS_FILE, "r");
+    if (!file) return;
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char zone_id[64], name[64];
+        if (sscanf(line, "%63s %63s", zone_id, name) != 2) continue;
+        int account = account_find(name);
+        if (account >= 0) set_zone(zone_id, account, 0);
+    }
+    fclose(file);
+}
+
+// Function to parse a whole, positive number. Returns 0 if text is anything else.
+static int parse_positive(const char *text, int *number) {
+    char *end;
+    errno = 0;
+    long parsed = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || parsed <= 0 || parsed > INT_MAX) return 0;
+    *number = (int)parsed;
+    return 1;
+}
+
+int account_add(const char *value, int line) {
+    if (1 + extra_accounts >= MAX_ACCOUNTS) {
+        fprintf(stderr, "Error: %s line %d: At most %d accounts may be configured.\n", CONFIG_FILE, line, MAX_ACCOUNTS);
+        return 0;
+    }
+
+    Account *account = &ACCOUNTS[1 + extra_accounts];
+    memset(account, 0, sizeof(Account));
+    char rate_limit[32], max_in_flight[32], extra[2];
+    int fields = sscanf(value, "%63s %255s %31s %31s %1s", account->name, account->api_key, rate_limit,
+                        max_in_flight, extra);
+    if (fields < 2 || fields > 4) {
+        fprintf(stderr, "Error: %s line %d: ACCOUNT must be \"<name> <api_key> [rate_limit] [max_in_flight]\": %s\n",
+                CONFIG_FILE, line, value);
+        return 0;
+    }
+    if ((fields >= 3 && !parse_positive(rate_limit, &account->rate_limit)) ||
+        (fields == 4 && !parse_positive(max_in_flight, &account->max_in_flight))) {
+        fprintf(stderr, "Error: %s line %d: ACCOUNT rate_limit and max_in_flight must be positive numbers: %s\n",
+                CONFIG_FILE, line, value);
+        return 0;
+    }
+    if (strcmp(account->name, DEFAULT_ACCOUNT_NAME) == 0) {
+        fprintf(stderr, "Error: %s line %d: Account name %s is reserved for API_KEY.\n", CONFIG_FILE, line,
+                DEFAULT_ACCOUNT_NAME);
+        return 0;
+    }
+    for (int i = 1; i <= extra_accounts; i++) {
+        if (strcmp(ACCOUNTS[i].name, account->name) == 0) {
+            fprintf(stderr, "Error: %s line %d: Account name %s is already used.\n", CONFIG_FILE, line, account->name);
+            return 0;
+        }
+    }
+    extra_accounts++;
+    return 1;
+}
+
+int account_pin_zone(const char *value, int line) {
+    struct pin *grown = realloc(pins, (pin_count + 1) * sizeof(struct pin));
+    if (!grown || !(grown[pin_count].value = strdup(value))) {
+        if (grown) pins = grown;
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    grown[pin_count].line = line;
+    pins = grown;
+    pin_count++;
+    return 1;
+}
+
+int account_finish(const char *api_key) {
+    if (api_key && api_key[0]) {
+        memset(&ACCOUNTS[0], 0, sizeof(Account));
+        strcpy(ACCOUNTS[0].name, DEFAULT_ACCOUNT_NAME);
+        snprintf(ACCOUNTS[0].api_key, sizeof(ACCOUNTS[0].api_key), "%s", api_key);
+        ACCOUNT_COUNT = 1 + extra_accounts;
+    } else if (extra_accounts > 0) {
+        memmove(&ACCOUNTS[0], &ACCOUNTS[1], extra_accounts * sizeof(Account));
+        ACCOUNT_COUNT = extra_accounts;
+    } else {
+        return 0;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < pin_count; i++) {
+        char zone_id[64], name[64];
+        int account = -1;
+        if (sscanf(pins[i].value, "%63s %63s", zone_id, name) == 2) account = account_find(name);
+        if (account < 0 || !set_zone(zone_id, account, 1)) {
+            fprintf(stderr, "Error: %s line %d: ZONE must be \"<zone_id> <account name>\" with a configured account: %s\n",
+                    CONFIG_FILE, pins[i].line, pins[i].value);
+            ok = 0;
+        }
+        free(pins[i].value);
+    }
+    free(pins);
+    pins = NULL;
+    pin_count = 0;
+    return ok;
+}
+
+int account_find(const char *name) {
+    for (int i = 0; i < ACCOUNT_COUNT; i++) {
+        if (strcmp(ACCOUNTS[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+int account_for_zone(const char *zone_id) {
+    // With one token there is nothing to choose, so the file is never read
+    if (ACCOUNT_COUNT <= 1) return -1;
+    load_zones();
+    struct zone_account *slot = find_slot(zone_id);
+    return slot && slot->zone_id[0] ? slot->account : -1;
+}
+
+int account_for_url(const char *url) {
+    if (ACCOUNT_COUNT <= 1) return -1;
+
+    const char *start = strstr(url, "/zones/");
+    if (!start) return -1;
+    start += strlen("/zones/");
+    size_t length = strcspn(start, "/?#");
+    if (length == 0 || length > 32) return -1;
+
+    char zone_id[33];
+    memcpy(zone_id, start, length);
+    zone_id[length] = '\0';
+    return account_for_zone(zone_id);
+}
+
+void account_learn_zone(const char *zone_id, int account) {
+    if (ACCOUNT_COUNT <= 1 || account < 0 || account >= ACCOUNT_COUNT) return;
+    load_zones();
+    struct zone_account *slot = find_slot(zone_id);
+    if (slot && slot->zone_id[0] && (slot->pinned || slot->account == account)) return;
+    if (set_zone(zone_id, account, 0)) zones_dirty = 1;
+}
+
+int account_save_zones(void) {
+    if (!zones_dirty) return 1;
+
+    FILE *file = fopen(ZONE_ACCOUNTS_TEMP_FILE, "w");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open %s for writing.\n", ZONE_ACCOUNTS_TEMP_FILE);
+        return 0;
+    }
+    for (size_t i = 0; i < zone_capacity; i++) {
+        if (zones[i].zone_id[0] && !zones[i].pinned) {
+            fprintf(file, "%s %s\n", zones[i].zone_id, ACCOUNTS[zones[i].account].name);
+        }
+    }
+    if (fclose(file) != 0 || rename(ZONE_ACCOUNTS_TEMP_FILE, ZONE_ACCOUNTS_FILE) != 0) {
+        fprintf(stderr, "Error: Could not write %s\n", ZONE_ACCOUNTS_FILE);
+        remove(ZONE_ACCOUNTS_TEMP_FILE);
+        return 0;
+    }
+    zones_dirty = 0;
+    return 1;
+}
@@ -0,0 +1,57 @@
+#ifndef ACCOUNT_H
+#define ACCOUNT_H
+
+#define MAX_ACCOUNTS 64                            // API tokens one configuration may list
+#define DEFAULT_ACCOUNT_NAME "default"             // Name of the API_KEY account; ACCOUNT lines may not use it
+#define ZONE_ACCOUNTS_FILE "zone_accounts.txt"      // Which account each listed zone belongs to
+#define ZONE_ACCOUNTS_TEMP_FILE "zone_accounts.txt.tmp"
+
+// One API token and its budget. Account 0 is API_KEY from the configuration
+// file (or the first ACCOUNT line if there is none); each ACCOUNT line adds one.
+typedef struct {
+    char name[64];
+    char api_key[256];
+    int rate_limit;    // Requests per RATE_WINDOW for this token, 0 for RATE_LIMIT
+    int max_in_flight; // Concurrent requests for this token in a batch, 0 for the batch's own limit
+} Account;
+
+extern Account ACCOUNTS[MAX_ACCOUNTS];
+extern int ACCOUNT_COUNT;
+
+// Function to parse an ACCOUNT value: "<name> <api_key> [rate_limit] [max_in_flight]",
+// both numbers positive. line is its line in the configuration file, for errors.
+// Returns 1 on success, 0 if it is malformed, its name is taken or reserved, or
+// there are too many accounts.
+int account_add(const char *value, int line);
+
+// Function to keep a ZONE value, "<zone_id> <account name>", pinning the
+// zone's requests to that account once account_finish resolves the name.
+// line is its line in the configuration file, for errors.
+// Returns 1 on success, 0 if out of memory.
+int account_pin_zone(const char *value, int line);
+
+// Function to settle the account list once the configuration is read:
+// api_key becomes account 0, pinned zones are resolved to their accounts.
+// Returns 1 on success, 0 if no account has a key or a pin names an unknown account.
+int account_finish(const char *api_key);
+
+// Function to find an account by name. Returns its index or -1.
+int account_find(const char *name);
+
+// Function to find the account a zone's requests go to: a pinned one, else
+// the account whose zone listing last showed it. Returns -1 if unknown.
+int account_for_zone(const char *zone_id);
+
+// Function to find the account for a request to url, from the zone it names.
+// Returns -1 for account-wide URLs and zones of unknown accounts.
+int account_for_url(const char *url);
+
+// Function to remember that an account's zone listing showed zone_id.
+// Pinned zones keep their account.
+void account_learn_zone(const char *zone_id, int account);
+
+// Function to write learned zones to ZONE_ACCOUNTS_FILE if any changed.
+// Returns 1 on success (or nothing to do), 0 on failure.
+int account_save_zones(void);
+
+#endif
@@ -0,0 +1,582 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#include "api.h"
+#include "metrics.h"
+
+char API_URL[256] = DEFAULT_API_URL;
+
+void api_set_url(const char *url) {
+    snprintf(API_URL, sizeof(API_URL), "%s", url);
+    size_t length = strlen(API_URL);
+    while (length > 0 && API_URL[length - 1] == '/') API_URL[--length] = '\0';
+}
+
+ApiResponse *api_request(const char *url, const char *method, const char *payload) {
+    HttpResponse http;
+    if (!http_perform(url, method, payload, &http)) {
+        return NULL;
+    }
+    if (!http.body) {
+        fprintf(stderr, "Error: Empty response from %s (HTTP %ld).\n", url, http.status);
+        return NULL;
+    }
+
+    // Validate by parsing once; the tree is handed to the caller
+    double parse_start = metrics_now();
+    cJSON *json = cJSON_ParseWithLength(http.body, http.size);
+    metrics_record_parse(method, url, metrics_now() - parse_start);
+    if (!json) {
+        fprintf(stderr, "Error: Invalid JSON response: %s\n", http.body);
+        free(http.body);
+        return NULL;
+    }
+
+    ApiResponse *response = malloc(sizeof(ApiResponse));
+    if (!response) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        cJSON_Delete(json);
+        free(http.body);
+        return NULL;
+    }
+    response->body = http.body;
+    response->size = http.size;
+    response->status = http.status;
+    response->json = json;
+    return response;
+}
+
+void api_print_response(const ApiResponse *response) {
+    if (!response) return;
+
+    // Cloudflare already sends compact JSON, so validated bytes go out as-is
+    size_t size = response->size;
+    while (size > 0 && (response->body[size - 1] == '\n' || response->body[size - 1] == '\r')) size--;
+    fwrite(response->body, 1, size, stdout);
+    fputc('\n', stdout);
+}
+
+void api_response_free(ApiResponse *response) {
+    if (!response) return;
+    cJSON_Delete(response->json);
+    free(response->body);
+    free(response);
+}
+
+// Lifecycle of one page of one source
+enum page_state {
+    PAGE_PENDING,   // Known to exist, not requested yet
+    PAGE_IN_FLIGHT, // Requested
+    PAGE_READY,     // Arrived, waiting for earlier pages to be delivered
+    PAGE_DONE       // Delivered to the callback
+};
+
+struct page_slot {
+    int state;
+    char *body; // Raw response held while PAGE_READY, for pages not yet parsed
+    cJSON *json; // Page 1, parsed on arrival for its page count and kept for delivery
+    char *held; // Packed records of a streamed page that arrived before its turn
+    size_t held_size;
+    size_t held_capacity;
+};
+
+#define HELD_FIELDS 5 // Strings packed after each held_record header
+
+// Header of a packed record; id, name, type, content and modified_on follow, NUL-terminated
+struct held_record {
+    int proxied;
+    int ttl;
+    int has_content;
+    int priority;
+    unsigned short lengths[HELD_FIELDS];
+};
+
+struct crawl_source {
+    char *url;
+    int per_page;
+    int account;     // Account its pages are requested with, from the batch when it was added
+    int streamed;    // Pages are parsed as they arrive and reported per record
+    int failed;      // Some page could not be fetched or parsed
+    int total_pages; // 0 until page 1 has arrived
+    struct page_slot *pages;
+};
+
+// Pages 2..N of a source, discovered once its page 1 arrived
+struct page_range {
+    int source;
+    int next;
+    int last;
+};
+
+// Identifies the page a batch request belongs to
+struct page_ref {
+    ApiCrawl *crawl;
+    int source;
+    int page;
+    RecordStream *stream; // Parser for a streamed page, NULL otherwise
+    double parse_seconds; // Time the parser has spent on the page so far
+};
+
+struct api_crawl {
+    HttpBatch *batch;
+    int window;
+    api_page_callback callback;
+    api_record_callback record_callback;
+    void *userdata;
+
+    struct crawl_source *sources;
+    int source_count;
+    int source_capacity;
+
+    int merge_source; // Next page to deliver
+    int merge_page;
+    int issue_source; // Every source before this has had page 1 requested
+    int outstanding;  // Pages in flight or waiting to be delivered
+    int running;      // api_crawl_run has started; new sources are requested right away
+
+    struct page_range *ranges; // FIFO of discovered pages still to request
+    int range_head;
+    int range_count;
+    int range_capacity;
+};
+
+static void on_page_response(char *response, long status, void *userdata);
+
+// Keep a compact copy of a record until its page is next in order
+static int hold_record(struct page_slot *slot, const DnsRecord *record) {
+    const char *fields[HELD_FIELDS] = {record->id, record->name, record->type, record->content, record->modified_on};
+    struct held_record header;
+    size_t size = sizeof(header);
+
+    header.proxied = record->proxied;
+    header.ttl = record->ttl;
+    header.has_content = record->has_content;
+    header.priority = record->priority;
+    for (int i = 0; i < HELD_FIELDS; i++) {
+        header.lengths[i] = (unsigned short)strlen(fields[i]);
+        size += header.lengths[i] + 1;
+    }
+
+    if (slot->held_size + size > slot->held_capacity) {
+        size_t capacity = slot->held_capacity ? slot->held_capacity * 2 : 4096;
+        while (capacity < slot->held_size + size) capacity *= 2;
+        char *held = realloc(slot->held, capacity);
+        if (!held) return 0;
+        slot->held = held;
+        slot->held_capacity = capacity;
+    }
+
+    char *out = slot->held + slot->held_size;
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    for (int i = 0; i < HELD_FIELDS; i++) {
+        memcpy(out, fields[i], header.lengths[i] + 1);
+        out += header.lengths[i] + 1;
+    }
+    slot->held_size += size;
+    return 1;
+}
+
+// Report the records held for a page, which is now next in order
+static void flush_held(ApiCrawl *crawl, int source, int page) {
+    struct page_slot *slot = &crawl->sources[source].pages[page - 1];
+    char *held = slot->held;
+    size_t held_size = slot->held_size;
+
+    // Detached first: the callback may add sources and move the slots
+    slot->held = NULL;
+    slot->held_size = 0;
+    slot->held_capacity = 0;
+
+    static DnsRecord record;
+    size_t offset = 0;
+    while (offset < held_size) {
+        struct held_record header;
+        memcpy(&header, held + offset, sizeof(header));
+        offset += sizeof(header);
+
+        char *fields[HELD_FIELDS] = {record.id, record.name, record.type, record.content, record.modified_on};
+        size_t sizes[HELD_FIELDS] = {sizeof(record.id), sizeof(record.name), sizeof(record.type),
+                                     sizeof(record.content), sizeof(record.modified_on)};
+        for (int i = 0; i < HELD_FIELDS; i++) {
+            size_t length = header.lengths[i] < sizes[i] ? header.lengths[i] : sizes[i] - 1;
+            memcpy(fields[i], held + offset, length);
+            fields[i][length] = '\0';
+            offset += header.lengths[i] + 1;
+        }
+        record.proxied = header.proxied;
+        record.ttl = header.ttl;
+        record.has_content = header.has_content;
+        record.priority = header.priority;
+
+        crawl->record_callback(source, page, &record, crawl->userdata);
+    }
+
+    free(held);
+}
+
+// Record callback of a page's parser: deliver now if the page is next, else hold
+static void on_stream_record(const DnsRecord *record, void *userdata) {
+    struct page_ref *ref = (struct page_ref *)userdata;
+    ApiCrawl *crawl = ref->crawl;
+    if (!crawl->record_callback) return;
+
+    if (ref->source == crawl->merge_source && ref->page == crawl->merge_page) {
+        crawl->record_callback(ref->source, ref->page, record, crawl->userdata);
+    } else if (!hold_record(&crawl->sources[ref->source].pages[ref->page - 1], record)) {
+        fprintf(stderr, "Error: Out of memory, record %s dropped.\n", record->id);
+    }
+}
+
+// Body callback for streamed pages
+static int on_stream_data(const char *data, size_t size, void *userdata) {
+    struct page_ref *ref = (struct page_ref *)userdata;
+    double parse_start = metrics_now();
+    int ok = record_stream_feed(ref->stream, data, size);
+    ref->parse_seconds += metrics_now() - parse_start;
+    return ok;
+}
+
+// Request one page of a source
+static void issue_page(ApiCrawl *crawl, int source, int page) {
+    struct crawl_source *src = &crawl->sources[source];
+    struct page_slot *slot = &src->pages[page - 1];
+
+    char url[1024];
+    snprintf(url, sizeof(url), "%s%cpage=%d&per_page=%d",
+             src->url, strchr(src->url, '?') ? '&' : '?', page, src->per_page);
+
+    slot->state = PAGE_IN_FLIGHT;
+    crawl->outstanding++;
+
+    struct page_ref *ref = malloc(sizeof(struct page_ref));
+    int queued = 0;
+    int account = http_batch_account(crawl->batch);
+    http_batch_set_account(crawl->batch, src->account);
+    if (ref) {
+        ref->crawl = crawl;
+        ref->source = source;
+        ref->page = page;
+        ref->stream = NULL;
+        ref->parse_seconds = 0;
+        if (!src->streamed) {
+            queued = http_batch_add(crawl->batch, url, "GET", NULL, on_page_response, ref);
+        } else if ((ref->stream = record_stream_create(on_stream_record, ref))) {
+            queued = http_batch_add_stream(crawl->batch, url, "GET", NULL, on_stream_data, on_page_response, ref);
+        }
+    }
+    http_batch_set_account(crawl->batch, account);
+    if (!queued) {
+        fprintf(stderr, "Error: Could not queue request for %s\n", url);
+        if (ref) record_stream_free(ref->stream);
+        free(ref);
+        slot->state = PAGE_READY; // Delivered as a gap so the crawl keeps moving
+        src->failed = 1;
+    }
+}
+
+// Request pages until the window is full. The page the delivery cursor is
+// waiting for is always requested, so held pages can never stall the crawl.
+static void pump(ApiCrawl *crawl) {
+    if (crawl->merge_source < crawl->source_count) {
+        struct crawl_source *src = &crawl->sources[crawl->merge_source];
+        int known = src->total_pages > 0 ? src->total_pages : 1;
+        if (crawl->merge_page <= known && src->pages[crawl->merge_page - 1].state == PAGE_PENDING) {
+            issue_page(crawl, crawl->merge_source, crawl->merge_page);
+        }
+    }
+
+    while (crawl->outstanding < crawl->window) {
+        if (crawl->range_head < crawl->range_count) {
+            struct page_range *range = &crawl->ranges[crawl->range_head];
+            int page = range->next++;
+            if (range->next > range->last) crawl->range_head++;
+            if (crawl->sources[range->source].pages[page - 1].state == PAGE_PENDING) {
+                issue_page(crawl, range->source, page);
+            }
+        } else if (crawl->issue_source < crawl->source_count) {
+            int source = crawl->issue_source++;
+            if (crawl->sources[source].pages[0].state == PAGE_PENDING) {
+                issue_page(crawl, source, 1);
+            }
+        } else {
+            break;
+        }
+    }
+}
+
+// Record the page count reported by page 1 and schedule the remaining pages
+static void discover_pages(ApiCrawl *crawl, int source, int reported) {
+    struct crawl_source *src = &crawl->sources[source];
+    int total_pages = reported > 1 ? reported : 1;
+
+    if (total_pages > 1) {
+        struct page_slot *pages = realloc(src->pages, total_pages * sizeof(struct page_slot));
+        if (!pages) {
+            fprintf(stderr, "Error: Out of memory, only the first page of %s is used.\n", src->url);
+            total_pages = 1;
+        } else {
+            src->pages = pages;
+            memset(&pages[1], 0, (total_pages - 1) * sizeof(struct page_slot));
+        }
+    }
+
+    if (total_pages > 1) {
+        if (crawl->range_count == crawl->range_capacity) {
+            int capacity = crawl->range_capacity ? crawl->range_capacity * 2 : 16;
+            struct page_range *ranges = realloc(crawl->ranges, capacity * sizeof(struct page_range));
+            if (!ranges) {
+                fprintf(stderr, "Error: Out of memory, only the first page of %s is used.\n", src->url);
+                total_pages = 1;
+            } else {
+                crawl->ranges = ranges;
+                crawl->range_capacity = capacity;
+            }
+        }
+    }
+
+    if (total_pages > 1) {
+        struct page_range *range = &crawl->ranges[crawl->range_count++];
+        range->source = source;
+        range->next = 2;
+        range->last = total_pages;
+    }
+
+    src->total_pages = total_pages;
+}
+
+// Deliver every page that is next in (source, page) order
+static void deliver_ready(ApiCrawl *crawl) {
+    while (crawl->merge_source < crawl->source_count) {
+        struct crawl_source *src = &crawl->sources[crawl->merge_source];
+        if (src->total_pages > 0 && crawl->merge_page > src->total_pages) {
+            crawl->merge_source++;
+            crawl->merge_page = 1;
+            continue;
+        }
+
+        struct page_slot *slot = &src->pages[crawl->merge_page - 1];
+        if (slot->state != PAGE_READY) {
+            // The page being downloaded is now next: release what it parsed so far
+            if (slot->held) flush_held(crawl, crawl->merge_source, crawl->merge_page);
+            break;
+        }
+
+        if (src->streamed) {
+            int source = crawl->merge_source;
+            int page = crawl->merge_page;
+            if (slot->held) flush_held(crawl, source, page);
+            slot = &crawl->sources[source].pages[page - 1];
+            slot->state = PAGE_DONE;
+            crawl->outstanding--;
+            crawl->merge_page++;
+            continue;
+        }
+
+        // Each body is parsed once: page 1 on arrival, the others here
+        cJSON *json = slot->json;
+        slot->json = NULL;
+        if (!json && slot->body) {
+            double parse_start = metrics_now();
+            json = cJSON_Parse(slot->body);
+            metrics_record_parse("GET", src->url, metrics_now() - parse_start);
+            if (!json) {
+                fprintf(stderr, "Error: Invalid JSON response for %s page %d.\n", src->url, crawl->merge_page);
+                src->failed = 1;
+            }
+        }
+        free(slot->body);
+        slot->body = NULL;
+        slot->state = PAGE_DONE;
+        crawl->outstanding--;
+
+        int source = crawl->merge_source;
+        int page = crawl->merge_page++;
+        if (json) {
+            if (crawl->callback) crawl->callback(source, page, json, crawl->userdata);
+            cJSON_Delete(json);
+        }
+    }
+}
+
+// Completion callback for every page request
+static void on_page_response(char *response, long status, void *userdata) {
+    struct page_ref *ref = (struct page_ref *)userdata;
+    ApiCrawl *crawl = ref->crawl;
+    int source = ref->source;
+    int page = ref->page;
+
+    struct crawl_source *src = &crawl->sources[source];
+    if (ref->stream) {
+        RecordStream *stream = ref->stream;
+        if (status > 0) metrics_record_parse("GET", src->url, ref->parse_seconds);
+        free(ref);
+
+        int reported = 1;
+        if (status >= 400) {
+            fprintf(stderr, "Error: %s page %d returned HTTP %ld.\n", src->url, page, status);
+            src->failed = 1;
+        } else if (status == 0 || !record_stream_finish(stream)) {
+            if (status > 0) fprintf(stderr, "Error: Invalid JSON response for %s page %d.\n", src->url, page);
+            src->failed = 1;
+        } else {
+            reported = record_stream_total_pages(stream);
+        }
+        record_stream_free(stream);
+
+        if (page == 1) {
+            discover_pages(crawl, source, reported);
+        }
+        crawl->sources[source].pages[page - 1].state = PAGE_READY;
+
+        deliver_ready(crawl);
+        pump(crawl);
+        return;
+    }
+    free(ref);
+
+    if (response && status >= 400) {
+        fprintf(stderr, "Error: %s page %d returned HTTP %ld: %s\n", src->url, page, status, response);
+        free(response);
+        response = NULL;
+    }
+    if (!response) {
+        src->failed = 1;
+    }
+
+    // Page 1 is parsed on arrival to learn how many pages follow; the tree is
+    // kept until its turn rather than parsed again from the body
+    cJSON *json = NULL;
+    if (page == 1 && response) {
+        double parse_start = metrics_now();
+        json = cJSON_Parse(response);
+        metrics_record_parse("GET", src->url, metrics_now() - parse_start);
+        if (!json) {
+            fprintf(stderr, "Error: Invalid JSON response for %s page %d.\n", src->url, page);
+            src->failed = 1;
+        }
+        free(response);
+        response = NULL;
+    }
+    if (page == 1) {
+        cJSON *reported = cJSON_GetObjectItem(cJSON_GetObjectItem(json, "result_info"), "total_pages");
+        discover_pages(crawl, source, cJSON_IsNumber(reported) ? reported->valueint : 1);
+        src = &crawl->sources[source];
+    }
+
+    src->pages[page - 1].state = PAGE_READY;
+    src->pages[page - 1].body = response;
+    src->pages[page - 1].json = json;
+
+    deliver_ready(crawl);
+    pump(crawl);
+}
+
+ApiCrawl *api_crawl_create(HttpBatch *batch, int window, api_page_callback callback, void *userdata) {
+    if (!batch) return NULL;
+
+    ApiCrawl *crawl = calloc(1, sizeof(ApiCrawl));
+    if (!crawl) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+
+    crawl->batch = batch;
+    crawl->window = window > 0 ? window : 1;
+    crawl->callback = callback;
+    crawl->userdata = userdata;
+    crawl->merge_page = 1;
+
+    return crawl;
+}
+
+// Append a source and, once the crawl is running, request it as the window allows
+static int add_source(ApiCrawl *crawl, const char *url, int per_page, int streamed) {
+    if (!crawl || !url) return -1;
+
+    if (crawl->source_count == crawl->source_capacity) {
+        int capacity = crawl->source_capacity ? crawl->source_capacity * 2 : 16;
+        struct crawl_source *sources = realloc(crawl->sources, capacity * sizeof(struct crawl_source));
+        if (!sources) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return -1;
+        }
+        crawl->sources = sources;
+        crawl->source_capacity = capacity;
+    }
+
+    struct crawl_source *src = &crawl->sources[crawl->source_count];
+    src->url = strdup(url);
+    src->pages = calloc(1, sizeof(struct page_slot));
+    if (!src->url || !src->pages) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(src->url);
+        free(src->pages);
+        return -1;
+    }
+    src->per_page = per_page;
+    src->account = http_batch_account(crawl->batch);
+    src->streamed = streamed;
+    src->failed = 0;
+    src->total_pages = 0;
+
+    int source = crawl->source_count++;
+    if (crawl->running) pump(crawl);
+    return source;
+}
+
+int api_crawl_add(ApiCrawl *crawl, const char *url, int per_page) {
+    return add_source(crawl, url, per_page, 0);
+}
+
+int api_crawl_add_records(ApiCrawl *crawl, const char *url, int per_page) {
+    return add_source(crawl, url, per_page, 1);
+}
+
+void api_crawl_set_record_callback(ApiCrawl *crawl, api_record_callback callback) {
+    if (crawl) crawl->record_callback = callback;
+}
+
+int api_crawl_failed(const ApiCrawl *crawl, int source) {
+    if (!crawl || source < 0 || source >= crawl->source_count) return 1;
+    return crawl->sources[source].failed;
+}
+
+int api_crawl_account(const ApiCrawl *crawl, int source) {
+    if (!crawl || source < 0 || source >= crawl->source_count) return 0;
+    return crawl->sources[source].account;
+}
+
+int api_crawl_run(ApiCrawl *crawl) {
+    if (!crawl) return 0;
+
+    crawl->running = 1;
+    pump(crawl);
+    if (!http_batch_run(crawl->batch)) {
+        return 0;
+    }
+
+    return crawl->merge_source >= crawl->source_count;
+}
+
+void api_crawl_free(ApiCrawl *crawl) {
+    if (!crawl) return;
+
+    for (int i = 0; i < crawl->source_count; i++) {
+        struct crawl_source *src = &crawl->sources[i];
+        int known = src->total_pages > 0 ? src->total_pages : 1;
+        for (int p = 0; p < known; p++) {
+            free(src->pages[p].body);
+            cJSON_Delete(src->pages[p].json);
+            free(src->pages[p].held);
+        }
+        free(src->pages);
+        free(src->url);
+    }
+
+    free(crawl->sources);
+    free(crawl->ranges);
+    free(crawl);
+}
@@ -0,0 +1,83 @@
+#ifndef API_H
+#define API_H
+
+#include <cjson/cJSON.h>
+
+#include "http.h"
+#include "record_stream.h"
+
+#define DEFAULT_API_URL "https://api.cloudflare.com/client/v4"
+
+extern char API_URL[256]; // Base URL of the API; set API_URL in config.txt to use another server
+
+// Function to set the base URL, dropping any trailing slash
+void api_set_url(const char *url);
+
+#define ZONES_PER_PAGE 50         // Largest per_page the /zones endpoint accepts
+#define DNS_RECORDS_PER_PAGE 5000 // Largest per_page used for /dns_records
+
+// A validated API response: the raw bytes as received and their parse tree.
+// The body is parsed exactly once; callers share the tree and print the raw bytes.
+typedef struct {
+    char *body;
+    size_t size;
+    long status;
+    cJSON *json;
+} ApiResponse;
+
+// Perform a blocking API request and parse the response once.
+// Returns NULL (after logging) on transport failure or invalid JSON.
+ApiResponse *api_request(const char *url, const char *method, const char *payload);
+
+// Write the response bytes to stdout unchanged, followed by a newline
+void api_print_response(const ApiResponse *response);
+
+// Free a response and its parse tree
+void api_response_free(ApiResponse *response);
+
+// Called once per page, in (source, page) order, with the parsed page document.
+// The document is freed when the callback returns.
+typedef void (*api_page_callback)(int source, int page, cJSON *json, void *userdata);
+
+// Called for every record of a source added with api_crawl_add_records, in
+// (source, page) order. Records of the page the crawl is waiting for are
+// delivered while it downloads; later pages keep a compact copy until their turn.
+typedef void (*api_record_callback)(int source, int page, const DnsRecord *record, void *userdata);
+
+// A paginated crawl over one or more list endpoints (opaque)
+typedef struct api_crawl ApiCrawl;
+
+// Create a crawl that issues requests on batch. At most window pages are
+// in flight or waiting for their turn at any time, which bounds memory.
+// callback may be NULL if every source is added with api_crawl_add_records.
+ApiCrawl *api_crawl_create(HttpBatch *batch, int window, api_page_callback callback, void *userdata);
+
+// Add a list endpoint to the crawl. Page 1 is fetched first; once it reports
+// result_info.total_pages, pages 2..N are fetched concurrently. May be called
+// from any callback of a request on the crawl's batch while it runs. Pages of
+// an account-wide endpoint go out on the batch's account at the time of the call.
+// Returns the source index, or -1 on failure.
+int api_crawl_add(ApiCrawl *crawl, const char *url, int per_page);
+
+// Add a dns_records listing whose pages are parsed as they stream in and
+// reported record by record instead of as whole documents.
+// Returns the source index, or -1 on failure.
+int api_crawl_add_records(ApiCrawl *crawl, const char *url, int per_page);
+
+// Set the callback for sources added with api_crawl_add_records
+void api_crawl_set_record_callback(ApiCrawl *crawl, api_record_callback callback);
+
+// Returns 1 if any page of source failed to download or parse
+int api_crawl_failed(const ApiCrawl *crawl, int source);
+
+// The account a source's pages are requested with
+int api_crawl_account(const ApiCrawl *crawl, int source);
+
+// Run the batch until every page of every source has been delivered.
+// Returns 1 on success, 0 if the crawl could not complete.
+int api_crawl_run(ApiCrawl *crawl);
+
+// Free the crawl. The batch is owned by the caller.
+void api_crawl_free(ApiCrawl *crawl);
+
+#endif
@@ -0,0 +1,878 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#include "api.h"
+#include "apply.h"
+#include "http.h"
+#include "zone_map.h"
+#include "zone_query.h"
+
+#define CSV_MAX_FIELDS 7 // zone_id,type,name,content,ttl,proxied,priority
+
+// One DNS record, desired or live. Strings are owned by the entry.
+struct record_entry {
+    char *zone_id;
+    char *id;      // Record ID, NULL for desired records
+    char *type;    // Upper case; guessed for records from the zone map, empty if it can't be
+    char *name;    // Lower case, without a trailing dot
+    char *content;
+    int ttl;       // -1 when unknown (records from the zone map)
+    int proxied;
+    int priority;  // MX, SRV and URI preference, -1 when absent or unknown
+    int next;      // Next entry with the same (zone, name), or -1
+    int tail;      // Last entry of the chain (kept on the chain head only)
+    int is_head;
+    int matched;   // Paired with an entry of the other set, or planned for deletion
+};
+
+// Records indexed by (zone, name); each key heads a chain of entries of every type
+struct record_set {
+    struct record_entry *entries;
+    int count;
+    int capacity;
+    int *slots; // Open-addressing table of chain heads, -1 when empty
+    int slot_count;
+};
+
+enum change_kind {
+    CHANGE_CREATE,
+    CHANGE_UPDATE,
+    CHANGE_DELETE
+};
+
+struct apply_run;
+
+// One API call the plan needs
+struct change {
+    int kind;
+    int desired; // Entry in the desired set (create, update)
+    int live;    // Entry in the live set (update, delete)
+    struct apply_run *run;
+};
+
+struct apply_run {
+    // The records added since the last flush and the plan for them
+    struct record_set desired;
+    struct record_set live;
+    char **zones;       // Distinct zone IDs of the desired records
+    int zone_count;
+    int *zone_failed;   // The zone's live records could not be fetched
+    int *fetch_zones;   // Zone of each crawl source while live records are fetched
+    struct change *changes;
+    int change_count;
+    int change_capacity;
+
+    int flags;          // APPLY_* options
+    int max_in_flight;
+    int error;          // Invalid input or a failed fetch; nothing more is flushed
+
+    // APPLY_BY_ZONE: every zone seen so far, in order; the last is the current one
+    char **seen_zones;
+    int seen_count;
+    int seen_capacity;
+
+    int done[3];        // Successful (or, in a dry run, planned) changes by kind
+    int unchanged;
+    int failed;
+};
+
+// FNV-1a hash, chainable so composite keys can be hashed field by field
+static uint64_t hash_string(uint64_t hash, const char *str) {
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t hash_record_key(const char *zone_id, const char *name) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_string(hash_string(hash, zone_id), "/");
+    return hash_string(hash, name);
+}
+
+static int entry_has_key(const struct record_entry *entry, const char *zone_id, const char *name) {
+    return strcmp(entry->name, name) == 0 && strcmp(entry->zone_id, zone_id) == 0;
+}
+
+// Find the chain head for a key, or -1
+static int record_set_find(const struct record_set *set, const char *zone_id, const char *name) {
+    if (set->slot_count == 0) return -1;
+
+    int mask = set->slot_count - 1;
+    for (int slot = hash_record_key(zone_id, name) & mask; set->slots[slot] >= 0; slot = (slot + 1) & mask) {
+        if (entry_has_key(&set->entries[set->slots[slot]], zone_id, name)) {
+            return set->slots[slot];
+        }
+    }
+    return -1;
+}
+
+// Double the head table and re-insert every chain head
+static int record_set_grow(struct record_set *set) {
+    int slot_count = set->slot_count ? set->slot_count * 2 : 1024;
+    int *slots = malloc(slot_count * sizeof(int));
+    if (!slots) return 0;
+
+    for (int i = 0; i < slot_count; i++) slots[i] = -1;
+    int mask = slot_count - 1;
+    for (int i = 0; i < set->count; i++) {
+        struct record_entry *entry = &set->entries[i];
+        if (!entry->is_head) continue;
+        int slot = hash_record_key(entry->zone_id, entry->name) & mask;
+        while (slots[slot] >= 0) slot = (slot + 1) & mask;
+        slots[slot] = i;
+    }
+
+    free(set->slots);
+    set->slots = slots;
+    set->slot_count = slot_count;
+    return 1;
+}
+
+// Lower-case a DNS name and drop the trailing dot of a fully qualified form
+static void normalise_name(char *name) {
+    for (char *p = name; *p; p++) *p = (char)tolower((unsigned char)*p);
+    size_t length = strlen(name);
+    if (length > 1 && name[length - 1] == '.') name[length - 1] = '\0';
+}
+
+static void normalise_type(char *type) {
+    for (char *p = type; *p; p++) *p = (char)toupper((unsigned char)*p);
+}
+
+// Add a record to its (zone, name) chain.
+// Returns the entry index, -2 if an identical record is already in a desired chain, or -1 on failure.
+static int record_set_add(struct record_set *set, const char *zone_id, const char *id, const char *type,
+                          const char *name, const char *content, int ttl, int proxied, int priority) {
+    if ((set->count + 1) * 2 > set->slot_count && !record_set_grow(set)) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return -1;
+    }
+
+    if (set->count == set->capacity) {
+        int capacity = set->capacity ? set->capacity * 2 : 1024;
+        struct record_entry *entries = realloc(set->entries, capacity * sizeof(struct record_entry));
+        if (!entries) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return -1;
+        }
+        set->entries = entries;
+        set->capacity = capacity;
+    }
+
+    struct record_entry *entry = &set->entries[set->count];
+    memset(entry, 0, sizeof(*entry));
+    entry->zone_id = strdup(zone_id);
+    entry->id = id ? strdup(id) : NULL;
+    entry->type = strdup(type);
+    entry->name = strdup(name);
+    entry->content = strdup(content);
+    if (!entry->zone_id || (id && !entry->id) || !entry->type || !entry->name || !entry->content) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(entry->zone_id);
+        free(entry->id);
+        free(entry->type);
+        free(entry->name);
+        free(entry->content);
+        return -1;
+    }
+    normalise_type(entry->type);
+    normalise_name(entry->name);
+    entry->ttl = ttl;
+    entry->proxied = proxied;
+    entry->priority = priority;
+    entry->next = -1;
+
+    int head = record_set_find(set, entry->zone_id, entry->name);
+    if (head < 0) {
+        entry->is_head = 1;
+        entry->tail = set->count;
+        int mask = set->slot_count - 1;
+        int slot = hash_record_key(entry->zone_id, entry->name) & mask;
+        while (set->slots[slot] >= 0) slot = (slot + 1) & mask;
+        set->slots[slot] = set->count;
+    } else {
+        // Desired records may list the same value twice; it only exists once
+        for (int i = head; !id && i >= 0; i = set->entries[i].next) {
+            if (strcmp(set->entries[i].type, entry->type) == 0 && strcmp(set->entries[i].content, entry->content) == 0) {
+                free(entry->zone_id);
+                free(entry->type);
+                free(entry->name);
+                free(entry->content);
+                return -2;
+            }
+        }
+        set->entries[set->entries[head].tail].next = set->count;
+        set->entries[head].tail = set->count;
+    }
+
+    return set->count++;
+}
+
+static void record_set_free(struct record_set *set) {
+    for (int i = 0; i < set->count; i++) {
+        struct record_entry *entry = &set->entries[i];
+        free(entry->zone_id);
+        free(entry->id);
+        free(entry->type);
+        free(entry->name);
+        free(entry->content);
+    }
+    free(set->entries);
+    free(set->slots);
+}
+
+// Split a CSV line into fields in place. Quoted fields may contain commas
+// and "" for a quote. Returns the field count.
+static int split_csv_line(char *line, char **fields, int max_fields) {
+    int count = 0;
+    char *read = line;
+
+    while (count < max_fields) {
+        char *write = read;
+        fields[count++] = write;
+
+        if (*read == '"') {
+            read++;
+            while (*read) {
+                if (*read == '"' && read[1] == '"') {
+                    *write++ = '"';
+                    read += 2;
+                } else if (*read == '"') {
+                    read++;
+                    break;
+                } else {
+                    *write++ = *read++;
+                }
+            }
+        }
+        while (*read && *read != ',' && *read != '\n' && *read != '\r') {
+            *write++ = *read++;
+        }
+
+        int more = (*read == ',');
+        *write = '\0';
+        if (!more) break;
+        read++;
+    }
+
+    return count;
+}
+
+static int parse_proxied(const char *value) {
+    return strcmp(value, "1") == 0 || strcmp(value, "true") == 0;
+}
+
+// Parse one line of the desired-state file into the desired set.
+// Returns 1 if the line was used or skipped, 0 if it is invalid.
+static int parse_desired_line(ApplyRun *run, char *line, int line_number) {
+    char *start = line;
+    while (*start == ' ' || *start == '\t') start++;
+    if (*start == '\0' || *start == '\n' || *start == '\r' || *start == '#') return 1;
+
+    const char *zone_id, *type, *name, *content;
+    int ttl = 1, proxied = 0, priority = -1;
+    cJSON *json = NULL;
+
+    if (*start == '{') {
+        json = cJSON_Parse(start);
+        cJSON *zone_item = cJSON_GetObjectItem(json, "zone_id");
+        cJSON *type_item = cJSON_GetObjectItem(json, "type");
+        cJSON *name_item = cJSON_GetObjectItem(json, "name");
+        cJSON *content_item = cJSON_GetObjectItem(json, "content");
+        cJSON *ttl_item = cJSON_GetObjectItem(json, "ttl");
+        cJSON *proxied_item = cJSON_GetObjectItem(json, "proxied");
+        cJSON *priority_item = cJSON_GetObjectItem(json, "priority");
+        if (!cJSON_IsString(zone_item) || !cJSON_IsString(type_item) ||
+            !cJSON_IsString(name_item) || !cJSON_IsString(content_item)) {
+            fprintf(stderr, "Error: Line %d: zone_id, type, name and content are required.\n", line_number);
+            cJSON_Delete(json);
+            return 0;
+        }
+        zone_id = zone_item->valuestring;
+        type = type_item->valuestring;
+        name = name_item->valuestring;
+        content = content_item->valuestring;
+        if (cJSON_IsNumber(ttl_item)) ttl = ttl_item->valueint;
+        if (cJSON_IsBool(proxied_item)) proxied = cJSON_IsTrue(proxied_item);
+        else if (cJSON_IsNumber(proxied_item)) proxied = proxied_item->valueint != 0;
+        if (cJSON_IsNumber(priority_item)) priority = priority_item->valueint;
+    } else {
+        char *fields[CSV_MAX_FIELDS];
+        int count = split_csv_line(start, fields, CSV_MAX_FIELDS);
+        if (strcmp(fields[0], "zone_id") == 0) return 1; // Header row
+        if (count < 4) {
+            fprintf(stderr, "Error: Line %d: expected zone_id,type,name,content[,ttl[,proxied[,priority]]].\n", line_number);
+            return 0;
+        }
+        zone_id = fields[0];
+        type = fields[1];
+        name = fields[2];
+        content = fields[3];
+        if (count > 4 && fields[4][0]) ttl = atoi(fields[4]);
+        if (count > 5) proxied = parse_proxied(fields[5]);
+        if (count > 6 && fields[6][0]) priority = atoi(fields[6]);
+    }
+
+    int ok = 1;
+    if (!zone_id[0] || !type[0] || !name[0]) {
+        fprintf(stderr, "Error: Line %d: zone_id, type and name must not be empty.\n", line_number);
+        ok = 0;
+    } else {
+        ok = apply_add_record(run, zone_id, type, name, content, ttl, proxied, priority);
+    }
+
+    cJSON_Delete(json);
+    return ok;
+}
+
+static int load_desired_file(ApplyRun *run, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    int line_number = 0;
+    int ok = 1;
+    while (ok && getline(&line, &capacity, file) != -1) {
+        ok = apply_add_line(run, line, ++line_number);
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Collect the distinct zones of the desired records
+static int collect_zones(struct apply_run *run) {
+    run->zones = malloc((run->desired.count + 1) * sizeof(char *));
+    run->zone_failed = calloc(run->desired.count + 1, sizeof(int));
+    if (!run->zones || !run->zone_failed) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+
+    for (int i = 0; i < run->desired.count; i++) {
+        run->zones[i] = run->desired.entries[i].zone_id;
+    }
+    qsort(run->zones, run->desired.count, sizeof(char *), compare_strings);
+
+    run->zone_count = 0;
+    for (int i = 0; i < run->desired.count; i++) {
+        if (run->zone_count == 0 || strcmp(run->zones[run->zone_count - 1], run->zones[i]) != 0) {
+            run->zones[run->zone_count++] = run->zones[i];
+        }
+    }
+    return 1;
+}
+
+// Record callback for the live fetch
+static void on_live_record(int source, int page, const DnsRecord *record, void *userdata) {
+    struct apply_run *run = (struct apply_run *)userdata;
+    (void)page;
+
+    if (!record->id[0] || !record->name[0]) return;
+    record_set_add(&run->live, run->zones[run->fetch_zones[source]], record->id, record->type, record->name,
+                   record->content, record->ttl, record->proxied, record->priority);
+}
+
+// Fetch every record of the zones in the file, each zone exactly once: all of
+// them, or those whose flag in only is set
+static int fetch_live_records(struct apply_run *run, int max_in_flight, const char *only) {
+    HttpBatch *batch = http_batch_create(max_in_flight);
+    ApiCrawl *crawl = batch ? api_crawl_create(batch, http_batch_capacity(batch) * 2, NULL, run) : NULL;
+    run->fetch_zones = malloc((run->zone_count + 1) * sizeof(int));
+    if (!crawl || !run->fetch_zones) {
+        if (!run->fetch_zones) fprintf(stderr, "Error: Out of memory.\n");
+        api_crawl_free(crawl);
+        http_batch_free(batch);
+        return 0;
+    }
+    http_batch_set_priority(batch, HTTP_PRIORITY_BULK);
+    api_crawl_set_record_callback(crawl, on_live_record);
+
+    int ok = 1;
+    int sources = 0;
+    for (int i = 0; ok && i < run->zone_count; i++) {
+        if (only && !only[i]) continue;
+        char url[512];
+        snprintf(url, sizeof(url), "%s/zones/%s/dns_records", API_URL, run->zones[i]);
+        run->fetch_zones[sources] = i;
+        ok = api_crawl_add_records(crawl, url, DNS_RECORDS_PER_PAGE) == sources++;
+    }
+
+    ok = ok && api_crawl_run(crawl);
+    for (int source = 0; ok && source < sources; source++) {
+        if (api_crawl_failed(crawl, source)) {
+            int i = run->fetch_zones[source];
+            fprintf(stderr, "Error: Records of zone %s could not be fetched; its changes are skipped.\n", run->zones[i]);
+            run->zone_failed[i] = 1;
+        }
+    }
+
+    http_batch_free(batch);
+    api_crawl_free(crawl);
+    free(run->fetch_zones);
+    run->fetch_zones = NULL;
+    return ok;
+}
+
+// Position of a zone in run->zones, or -1
+static int find_run_zone(const struct apply_run *run, const char *zone_id) {
+    char *const *found = bsearch(&zone_id, run->zones, run->zone_count, sizeof(char *), compare_strings);
+    return found ? (int)(found - run->zones) : -1;
+}
+
+// Whether the zone map can stand for live records of a type: it keeps no
+// types, so only those guess_record_kind recognises from the content
+static int cacheable_type(const char *type) {
+    for (int kind = 0; kind < RECORD_KIND_OTHER; kind++) {
+        if (strcmp(type, record_kind_name(kind)) == 0) return 1;
+    }
+    return 0;
+}
+
+// Take the live records from the zone map instead of the API. The map keeps
+// one record per name without its type or TTL, so each entry's type is guessed
+// from its content (A, AAAA or CNAME). A zone where the file names another
+// type, or names a record whose cached content fits none of them, is fetched.
+static int load_cached_records(struct apply_run *run) {
+    load_zone_map_once();
+
+    char *fetch = calloc(run->zone_count + 1, 1);
+    if (!fetch) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+
+    ZoneMap entry;
+    int fetch_count = 0;
+    for (int i = 0; i < run->desired.count; i++) {
+        const struct record_entry *desired = &run->desired.entries[i];
+        int zone = find_run_zone(run, desired->zone_id);
+        if (zone < 0 || fetch[zone]) continue;
+
+        int unknown = get_zone_entry(find_domain(desired->name), &entry) && strcmp(entry.zone_id, desired->zone_id) == 0 &&
+                      guess_record_kind(entry.ip_address) == RECORD_KIND_OTHER;
+        if (!cacheable_type(desired->type) || unknown) {
+            fetch[zone] = 1;
+            fetch_count++;
+        }
+    }
+
+    int ok = 1;
+    for (int i = 0; ok && get_zone_entry(i, &entry); i++) {
+        int zone = find_run_zone(run, entry.zone_id);
+        if (zone < 0 || fetch[zone]) continue;
+
+        int kind = guess_record_kind(entry.ip_address);
+        ok = record_set_add(&run->live, entry.zone_id, entry.record_id, kind == RECORD_KIND_OTHER ? "" : record_kind_name(kind),
+                            entry.domain, entry.ip_address, -1, entry.proxied, -1) != -1;
+    }
+
+    if (ok && fetch_count > 0) ok = fetch_live_records(run, run->max_in_flight, fetch);
+    free(fetch);
+    return ok;
+}
+
+static int zone_failed(const struct apply_run *run, const char *zone_id) {
+    int zone = find_run_zone(run, zone_id);
+    return zone < 0 || run->zone_failed[zone];
+}
+
+static int add_change(struct apply_run *run, int kind, int desired, int live) {
+    if (run->change_count == run->change_capacity) {
+        int capacity = run->change_capacity ? run->change_capacity * 2 : 256;
+        struct change *changes = realloc(run->changes, capacity * sizeof(struct change));
+        if (!changes) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return 0;
+        }
+        run->changes = changes;
+        run->change_capacity = capacity;
+    }
+
+    struct change *change = &run->changes[run->change_count++];
+    change->kind = kind;
+    change->desired = desired;
+    change->live = live;
+    change->run = run;
+    return 1;
+}
+
+// Proxied records always report TTL 1 (automatic), so only the proxy flag counts
+static int same_settings(const struct record_entry *desired, const struct record_entry *live) {
+    if (desired->proxied != live->proxied) return 0;
+    if (desired->priority >= 0 && live->priority >= 0 && desired->priority != live->priority) return 0;
+    return desired->proxied || live->ttl < 0 || desired->ttl == live->ttl;
+}
+
+// A cached record whose type could not be guessed matches no type
+static int same_type(const struct record_entry *desired, const struct record_entry *live) {
+    return strcmp(desired->type, live->type) == 0;
+}
+
+// Whether a leftover live record under a desired name is in scope for deletion:
+// every record when pruning, otherwise only types the file lists for the name
+static int listed_type(const struct apply_run *run, int head, const struct record_entry *live) {
+    if (run->flags & APPLY_PRUNE) return 1;
+    for (int d = head; d >= 0; d = run->desired.entries[d].next) {
+        if (same_type(&run->desired.entries[d], live)) return 1;
+    }
+    return 0;
+}
+
+// Work out the minimal changes that make the live records match the file.
+// Both sides are hashed by (zone, name), so this is linear in their sizes and
+// names that already match cost nothing.
+static int plan_changes(struct apply_run *run) {
+    struct record_entry *desired = run->desired.entries;
+    struct record_entry *live = run->live.entries;
+
+    for (int head = 0; head < run->desired.count; head++) {
+        if (!desired[head].is_head) continue;
+        if (zone_failed(run, desired[head].zone_id)) {
+            for (int d = head; d >= 0; d = desired[d].next) run->failed++;
+            continue;
+        }
+
+        int live_head = record_set_find(&run->live, desired[head].zone_id, desired[head].name);
+
+        // Records whose content already matches stay, updated in place if settings differ
+        for (int d = head; d >= 0; d = desired[d].next) {
+            for (int l = live_head; l >= 0; l = live[l].next) {
+                if (live[l].matched || !same_type(&desired[d], &live[l]) ||
+                    strcmp(live[l].content, desired[d].content) != 0) continue;
+                desired[d].matched = live[l].matched = 1;
+                if (same_settings(&desired[d], &live[l])) {
+                    run->unchanged++;
+                } else if (!add_change(run, CHANGE_UPDATE, d, l)) {
+                    return 0;
+                }
+                break;
+            }
+        }
+
+        // Remaining values reuse remaining records of their type, then new ones are created
+        for (int d = head; d >= 0; d = desired[d].next) {
+            if (desired[d].matched) continue;
+            int l = live_head;
+            while (l >= 0 && (live[l].matched || !same_type(&desired[d], &live[l]))) l = live[l].next;
+            int ok;
+            if (l >= 0) {
+                live[l].matched = 1;
+                ok = add_change(run, CHANGE_UPDATE, d, l);
+            } else {
+                ok = add_change(run, CHANGE_CREATE, d, -1);
+            }
+            if (!ok) return 0;
+            desired[d].matched = 1;
+        }
+
+        // Whatever is left under this name no longer belongs
+        for (int l = live_head; l >= 0; l = live[l].next) {
+            if (live[l].matched || !listed_type(run, head, &live[l])) continue;
+            live[l].matched = 1;
+            if (!add_change(run, CHANGE_DELETE, -1, l)) return 0;
+        }
+    }
+
+    // A full sync also removes names the file does not mention at all
+    if (run->flags & APPLY_PRUNE) {
+        for (int l = 0; l < run->live.count; l++) {
+            if (live[l].matched || zone_failed(run, live[l].zone_id)) continue;
+            live[l].matched = 1;
+            if (!add_change(run, CHANGE_DELETE, -1, l)) return 0;
+        }
+    }
+
+    return 1;
+}
+
+static const char *change_name(int kind) {
+    return kind == CHANGE_CREATE ? "create" : kind == CHANGE_UPDATE ? "update" : "delete";
+}
+
+// Print the plan as NDJSON instead of running it
+static void print_plan(struct apply_run *run) {
+    for (int i = 0; i < run->change_count; i++) {
+        const struct change *change = &run->changes[i];
+        const struct record_entry *desired = change->desired >= 0 ? &run->desired.entries[change->desired] : NULL;
+        const struct record_entry *live = change->live >= 0 ? &run->live.entries[change->live] : NULL;
+        const struct record_entry *record = desired ? desired : live;
+
+        cJSON *json = cJSON_CreateObject();
+        if (!json) break;
+        cJSON_AddStringToObject(json, "action", change_name(change->kind));
+        cJSON_AddStringToObject(json, "zone_id", record->zone_id);
+        if (live) cJSON_AddStringToObject(json, "id", live->id);
+        cJSON_AddStringToObject(json, "type", record->type);
+        cJSON_AddStringToObject(json, "name", record->name);
+        cJSON_AddStringToObject(json, "content", record->content);
+        if (record->ttl >= 0) cJSON_AddNumberToObject(json, "ttl", record->ttl);
+        cJSON_AddBoolToObject(json, "proxied", record->proxied);
+        if (record->priority >= 0) cJSON_AddNumberToObject(json, "priority", record->priority);
+        if (desired && live) {
+            cJSON *from = cJSON_AddObjectToObject(json, "from");
+            cJSON_AddStringToObject(from, "content", live->content);
+            if (live->ttl >= 0) cJSON_AddNumberToObject(from, "ttl", live->ttl);
+            cJSON_AddBoolToObject(from, "proxied", live->proxied);
+            if (live->priority >= 0) cJSON_AddNumberToObject(from, "priority", live->priority);
+        }
+
+        char *line = cJSON_PrintUnformatted(json);
+        if (line) {
+            printf("%s\n", line);
+            free(line);
+        }
+        cJSON_Delete(json);
+        run->done[change->kind]++;
+    }
+}
+
+// Write a response on one line, as the other commands do
+static void print_response(const char *response) {
+    size_t size = strlen(response);
+    while (size > 0 && (response[size - 1] == '\n' || response[size - 1] == '\r')) size--;
+    fwrite(response, 1, size, stdout);
+    fputc('\n', stdout);
+}
+
+// Keep the zone map in step with a change the API accepted
+static void remember_change(const struct change *change, const char *response) {
+    const struct record_entry *live = change->live >= 0 ? &change->run->live.entries[change->live] : NULL;
+    if (change->kind == CHANGE_DELETE) {
+        remove_zone_map_record(live->zone_id, live->id);
+        return;
+    }
+
+    cJSON *json = cJSON_Parse(response);
+    cJSON *result = cJSON_GetObjectItem(json, "result");
+    cJSON *id = cJSON_GetObjectItem(result, "id");
+    cJSON *name = cJSON_GetObjectItem(result, "name");
+    cJSON *content = cJSON_GetObjectItem(result, "content");
+    if (cJSON_IsString(id) && cJSON_IsString(name)) {
+        const struct record_entry *desired = &change->run->desired.entries[change->desired];
+        refresh_zone_map(name->valuestring, desired->zone_id, id->valuestring,
+                         cJSON_IsTrue(cJSON_GetObjectItem(result, "proxied")),
+                         cJSON_IsString(content) ? content->valuestring : "");
+    }
+    cJSON_Delete(json);
+}
+
+static void on_change_response(char *response, long status, void *userdata) {
+    struct change *change = (struct change *)userdata;
+    struct apply_run *run = change->run;
+
+    if (response) print_response(response);
+    if (response && status >= 200 && status < 300) {
+        run->done[change->kind]++;
+        remember_change(change, response);
+    } else {
+        const struct record_entry *entry = change->desired >= 0 ? &run->desired.entries[change->desired]
+                                                                : &run->live.entries[change->live];
+        fprintf(stderr, "Error: Could not %s %s record %s (HTTP %ld).\n",
+                change_name(change->kind), entry->type, entry->name, status);
+        run->failed++;
+    }
+    free(response);
+}
+
+// The JSON body for a create or update
+static char *change_payload(const struct record_entry *desired) {
+    cJSON *json = cJSON_CreateObject();
+    if (!json) return NULL;
+
+    cJSON_AddStringToObject(json, "type", desired->type);
+    cJSON_AddStringToObject(json, "name", desired->name);
+    cJSON_AddStringToObject(json, "content", desired->content);
+    cJSON_AddNumberToObject(json, "ttl", desired->ttl);
+    cJSON_AddBoolToObject(json, "proxied", desired->proxied);
+    if (desired->priority >= 0) cJSON_AddNumberToObject(json, "priority", desired->priority);
+
+    char *payload = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return payload;
+}
+
+// Run every planned change concurrently
+static int run_changes(struct apply_run *run, int max_in_flight) {
+    if (run->change_count == 0) return 1;
+
+    HttpBatch *batch = http_batch_create(max_in_flight);
+    if (!batch) return 0;
+    http_batch_set_priority(batch, HTTP_PRIORITY_BULK);
+
+    // Changes are recorded in the zone map as they are confirmed
+    load_zone_map_once();
+
+    for (int i = 0; i < run->change_count; i++) {
+        struct change *change = &run->changes[i];
+        const struct record_entry *live = change->live >= 0 ? &run->live.entries[change->live] : NULL;
+        const struct record_entry *desired = change->desired >= 0 ? &run->desired.entries[change->desired] : NULL;
+        const char *zone_id = desired ? desired->zone_id : live->zone_id;
+
+        char url[512];
+        char *payload = NULL;
+        const char *method;
+        if (change->kind == CHANGE_CREATE) {
+            snprintf(url, sizeof(url), "%s/zones/%s/dns_records", API_URL, zone_id);
+            method = "POST";
+        } else {
+            snprintf(url, sizeof(url), "%s/zones/%s/dns_records/%s", API_URL, zone_id, live->id);
+            method = change->kind == CHANGE_UPDATE ? "PATCH" : "DELETE";
+        }
+        if (desired && !(payload = change_payload(desired))) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            run->failed++;
+            continue;
+        }
+
+        if (!http_batch_add(batch, url, method, payload, on_change_response, change)) {
+            run->failed++;
+        }
+        free(payload);
+    }
+
+    int ok = http_batch_run(batch);
+    http_batch_free(batch);
+    return ok;
+}
+
+ApplyRun *apply_create(int max_in_flight, int flags) {
+    ApplyRun *run = calloc(1, sizeof(ApplyRun));
+    if (!run) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+    run->flags = flags;
+    run->max_in_flight = max_in_flight;
+    return run;
+}
+
+// Note the zone of the next record. Starting a new zone flushes the records
+// gathered so far once there are enough of them.
+static int enter_zone(ApplyRun *run, const char *zone_id) {
+    if (run->seen_count > 0 && strcmp(run->seen_zones[run->seen_count - 1], zone_id) == 0) return 1;
+
+    for (int i = 0; i < run->seen_count; i++) {
+        if (strcmp(run->seen_zones[i], zone_id) == 0) {
+            fprintf(stderr, "Error: Records of zone %s are not together; group each zone's records.\n", zone_id);
+            return 0;
+        }
+    }
+
+    if (run->seen_count == run->seen_capacity) {
+        int capacity = run->seen_capacity ? run->seen_capacity * 2 : 64;
+        char **zones = realloc(run->seen_zones, capacity * sizeof(char *));
+        if (!zones) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return 0;
+        }
+        run->seen_zones = zones;
+        run->seen_capacity = capacity;
+    }
+    if (!(run->seen_zones[run->seen_count] = strdup(zone_id))) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    run->seen_count++;
+
+    return run->desired.count < APPLY_CHUNK_RECORDS || apply_flush(run);
+}
+
+int apply_add_record(ApplyRun *run, const char *zone_id, const char *type, const char *name, const char *content,
+                     int ttl, int proxied, int priority) {
+    if (run->error) return 0;
+    if ((run->flags & APPLY_BY_ZONE) && !enter_zone(run, zone_id)) {
+        run->error = 1;
+        return 0;
+    }
+    if (record_set_add(&run->desired, zone_id, NULL, type, name, content, ttl, proxied, priority) == -1) {
+        run->error = 1;
+        return 0;
+    }
+    return 1;
+}
+
+int apply_add_line(ApplyRun *run, char *line, int line_number) {
+    if (run->error) return 0;
+    if (!parse_desired_line(run, line, line_number)) {
+        run->error = 1;
+        return 0;
+    }
+    return 1;
+}
+
+// Forget the records and plan of the last flush
+static void reset_chunk(ApplyRun *run) {
+    record_set_free(&run->desired);
+    record_set_free(&run->live);
+    free(run->zones);
+    free(run->zone_failed);
+    free(run->changes);
+    memset(&run->desired, 0, sizeof(run->desired));
+    memset(&run->live, 0, sizeof(run->live));
+    run->zones = NULL;
+    run->zone_failed = NULL;
+    run->zone_count = 0;
+    run->changes = NULL;
+    run->change_count = 0;
+    run->change_capacity = 0;
+}
+
+int apply_flush(ApplyRun *run) {
+    if (run->error) return 0;
+    if (run->desired.count == 0) return 1;
+
+    int ok = collect_zones(run);
+    if (ok) {
+        ok = (run->flags & APPLY_CACHED) ? load_cached_records(run) : fetch_live_records(run, run->max_in_flight, NULL);
+    }
+    ok = ok && plan_changes(run);
+    if (ok && (run->flags & APPLY_DRY_RUN)) {
+        print_plan(run);
+    } else if (ok) {
+        ok = run_changes(run, run->max_in_flight);
+    }
+
+    reset_chunk(run);
+    if (!ok) run->error = 1;
+    return ok;
+}
+
+int apply_finish(ApplyRun *run) {
+    if (!run) return 0;
+    int ok = apply_flush(run);
+
+    printf("{\"created\":%d,\"updated\":%d,\"deleted\":%d,\"unchanged\":%d,\"failed\":%d%s}\n",
+           run->done[CHANGE_CREATE], run->done[CHANGE_UPDATE], run->done[CHANGE_DELETE], run->unchanged, run->failed,
+           (run->flags & APPLY_DRY_RUN) ? ",\"dry_run\":true" : "");
+    ok = ok && run->failed == 0;
+
+    reset_chunk(run);
+    for (int i = 0; i < run->seen_count; i++) free(run->seen_zones[i]);
+    free(run->seen_zones);
+    free(run);
+    return ok;
+}
+
+int apply_records_file(const char *path, int max_in_flight, int flags) {
+    ApplyRun *run = apply_create(max_in_flight, flags);
+    if (!run) return 0;
+
+    if (!load_desired_file(run, path)) run->error = 1;
+    return apply_finish(run);
+}
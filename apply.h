@@ -0,0 +1,47 @@
+#ifndef APPLY_H
+#define APPLY_H
+
+// Options for apply_records_file
+#define APPLY_DRY_RUN 0x1 // Print the plan as NDJSON instead of running it
+#define APPLY_CACHED  0x2 // Compare against the zone map instead of fetching live records
+#define APPLY_PRUNE   0x4 // Also delete records the file does not list (full sync of its zones)
+#define APPLY_BY_ZONE 0x8 // Records arrive grouped by zone; apply them a few zones at a time
+
+#define APPLY_CHUNK_RECORDS 20000 // Records gathered before an APPLY_BY_ZONE run is flushed at a zone boundary
+
+// Apply a file of desired DNS records, one per line, either as CSV
+//   zone_id,type,name,content,ttl,proxied
+// or as NDJSON objects with the same keys. Each zone's records are fetched
+// once; the creates, in-place updates and deletes needed to make every named
+// (type, name) match the file then run with at most max_in_flight requests
+// at a time. Without APPLY_PRUNE, records whose names are not in the file are
+// left alone. Returns 1 if every change succeeded, 0 otherwise.
+int apply_records_file(const char *path, int max_in_flight, int flags);
+
+// The same, fed one record at a time (opaque)
+typedef struct apply_run ApplyRun;
+
+ApplyRun *apply_create(int max_in_flight, int flags);
+
+// Add a desired record; priority is -1 for types without one. With
+// APPLY_BY_ZONE, each zone's records must come together, and the run is
+// flushed whenever a new zone starts after APPLY_CHUNK_RECORDS records, so
+// memory stays bounded however long the input is.
+// Returns 1 on success, 0 on invalid input or a failed flush.
+int apply_add_record(ApplyRun *run, const char *zone_id, const char *type, const char *name, const char *content,
+                     int ttl, int proxied, int priority);
+
+// Add a record given as a line of the desired-state file (CSV or NDJSON).
+// Blank and comment lines are skipped. Returns 1 on success, 0 if the line is invalid.
+int apply_add_line(ApplyRun *run, char *line, int line_number);
+
+// Fetch the live records of the zones added since the last flush, then plan
+// and run (or, in a dry run, print) the changes for them.
+// Returns 1 on success, 0 if the zones could not be fetched or planned.
+int apply_flush(ApplyRun *run);
+
+// Flush what is left unless the input was invalid, print the summary line
+// and free the run. Returns 1 if every change succeeded, 0 otherwise.
+int apply_finish(ApplyRun *run);
+
+#endif
@@ -1,122 +1,84 @@
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <curl/curl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <cjson/cJSON.h>
 
-#define CONFIG_FILE "config.txt" // Configuration file path
-#define API_URL "https://api.cloudflare.com/client/v4"
-
-// Global variables for API credentials
-char API_KEY[256] = "";
-char EMAIL[256] = "";
-
-// Helper structure for holding HTTP response
-struct memory {
-    char *response;
-    size_t size;
-};
-
-// Write callback for libcurl
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct memory *mem = (struct memory *)userp;
-
-    char *ptr = realloc(mem->response, mem->size + realsize + 1);
-    if (ptr == NULL) return 0; // Out of memory
-
-    mem->response = ptr;
-    memcpy(&(mem->response[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->response[mem->size] = '\0';
+#include "account.h"
+#include "api.h"
+#include "apply.h"
+#include "config.h"
+#include "http.h"
+#include "metrics.h"
+#include "purge.h"
+#include "watch.h"
+#include "zone_file.h"
+#include "zone_map.h"
+#include "zone_query.h"
+
+// Function to read the configuration keys only this binary uses
+static int load_local_config(const char *key, const char *value) {
+    if (strcmp(key, "PURGE_CHUNK_SIZE") == 0) {
+        PURGE_CHUNK_SIZE = atoi(value);
+        return 1;
+    }
+    return 0;
+}
 
-    return realsize;
+// Function to make HTTP requests; the response is parsed exactly once
+ApiResponse *make_request(const char *url, const char *method, const char *payload) {
+    return api_request(url, method, payload);
 }
 
-// Function to load API key and email from configuration file
-int load_config() {
-    FILE *file = fopen(CONFIG_FILE, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error: Could not open configuration file: %s\n", CONFIG_FILE);
-        return 0;
-    }
+// Output state for the paginated zone listing
+typedef struct {
+    ApiCrawl *crawl;
+    int started; // Opening of the combined document has been printed
+    int count;   // Zones printed so far
+} ZoneListing;
 
-    char line[512];
-    while (fgets(line, sizeof(line), file)) {
-        char *key = strtok(line, "=");
-        char *value = strtok(NULL, "\n");
+// Page callback for list_zones: print each zone as its page arrives.
+// Each source is the listing of one account.
+static void on_zones_page(int source, int page, cJSON *json, void *userdata) {
+    ZoneListing *listing = (ZoneListing *)userdata;
 
-        if (key && value) {
-            if (strcmp(key, "API_KEY") == 0) {
-                strncpy(API_KEY, value, sizeof(API_KEY) - 1);
-            } else if (strcmp(key, "EMAIL") == 0) {
-                strncpy(EMAIL, value, sizeof(EMAIL) - 1);
+    cJSON *result = cJSON_GetObjectItem(json, "result");
+    if (!cJSON_IsArray(result)) {
+        // Pass API errors through untouched when nothing else will be printed
+        if (page == 1 && !listing->started && http_account_count() == 1) {
+            char *error_json = cJSON_PrintUnformatted(json);
+            if (error_json) {
+                printf("%s\n", error_json);
+                free(error_json);
             }
+            listing->started = -1;
+        } else {
+            fprintf(stderr, "Error: Invalid response structure on page %d.\n", page);
         }
+        return;
     }
+    if (listing->started < 0) return;
 
-    fclose(file);
-
-    if (strlen(API_KEY) == 0 || strlen(EMAIL) == 0) {
-        fprintf(stderr, "Error: API_KEY and EMAIL must be set in the configuration file.\n");
-        return 0;
+    if (!listing->started) {
+        printf("{\"success\":true,\"errors\":[],\"messages\":[],\"result\":[");
+        listing->started = 1;
     }
 
-    return 1;
-}
+    cJSON *zone;
+    cJSON_ArrayForEach(zone, result) {
+        cJSON *zone_id = cJSON_GetObjectItem(zone, "id");
+        if (cJSON_IsString(zone_id)) account_learn_zone(zone_id->valuestring, api_crawl_account(listing->crawl, source));
 
-// Function to make HTTP requests
-char *make_request(const char *url, const char *method, const char *payload) {
-    CURL *curl;
-    CURLcode res;
-    struct curl_slist *headers = NULL;
-    struct memory chunk = {NULL, 0};
-
-    curl = curl_easy_init();
-    if (curl) {
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Accept: application/json");
-
-        char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", API_KEY);
-        headers = curl_slist_append(headers, auth_header);
-
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-        if (strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0) {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-            if (strcmp(method, "PUT") == 0) {
-                curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-            }
-        } else if (strcmp(method, "DELETE") == 0) {
-            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+        char *zone_json = cJSON_PrintUnformatted(zone);
+        if (zone_json) {
+            printf("%s%s", listing->count++ ? "," : "", zone_json);
+            free(zone_json);
         }
-
-        res = curl_easy_perform(curl);
-
-        if (res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
-        }
-
-        curl_easy_cleanup(curl);
-        curl_slist_free_all(headers);
     }
-
-    // Validate and return JSON
-    if (chunk.response) {
-        cJSON *json = cJSON_Parse(chunk.response);
-        if (!json) {
-            fprintf(stderr, "Error: Invalid JSON response: %s\n", chunk.response);
-            free(chunk.response);
-            return NULL;
-        }
-        cJSON_Delete(json);
-    }
-
-    return chunk.response;
 }
 
 // Function to list zones
@@ -124,40 +86,117 @@ void list_zones() {
     char url[512];
     snprintf(url, sizeof(url), "%s/zones", API_URL);
 
-    char *response = make_request(url, "GET", NULL);
-    if (response) {
-        // Print JSON directly for `jq` to consume
-        printf("%s\n", response);
-        free(response);
+    ZoneListing listing = {NULL, 0, 0};
+    HttpBatch *batch = http_batch_create(MAX_IN_FLIGHT);
+    ApiCrawl *crawl = batch ? api_crawl_create(batch, http_batch_capacity(batch) * 2, on_zones_page, &listing) : NULL;
+    if (!crawl) {
+        http_batch_free(batch);
+        return;
+    }
+    listing.crawl = crawl;
+
+    // All pages of every account are merged into one document for `jq` to consume
+    int complete = 1;
+    for (int account = 0; account < http_account_count(); account++) {
+        http_batch_set_account(batch, account);
+        if (api_crawl_add(crawl, url, ZONES_PER_PAGE) < 0) complete = 0;
+    }
+    if (!complete || !api_crawl_run(crawl)) {
+        fprintf(stderr, "Error: Zone listing is incomplete.\n");
+    }
+    account_save_zones();
+    if (listing.started > 0) {
+        printf("],\"result_info\":{\"page\":1,\"per_page\":%d,\"count\":%d,\"total_count\":%d,\"total_pages\":1}}\n",
+               listing.count, listing.count, listing.count);
     }
+
+    http_batch_free(batch);
+    api_crawl_free(crawl);
 }
 
 
 // Function to print JSON in a compact form for jq compatibility
-void print_json(const char *json_str) {
-    cJSON *json = cJSON_Parse(json_str);
-    if (!json) {
-        fprintf(stderr, "Error: Invalid JSON format.\n");
-        return;
-    }
+void print_json(const ApiResponse *response) {
+    api_print_response(response);
+}
+
+// Function to remember a record returned by the API in the zone map
+static void remember_record(const char *zone_id, cJSON *record) {
+    cJSON *record_id = cJSON_GetObjectItem(record, "id");
+    cJSON *record_name = cJSON_GetObjectItem(record, "name");
+    cJSON *record_content = cJSON_GetObjectItem(record, "content");
+    cJSON *record_proxied = cJSON_GetObjectItem(record, "proxied");
 
-    char *formatted_json = cJSON_PrintUnformatted(json);
-    if (formatted_json) {
-        printf("%s\n", formatted_json);
-        free(formatted_json);
+    if (cJSON_IsString(record_id) && cJSON_IsString(record_name)) {
+        refresh_zone_map(record_name->valuestring, zone_id, record_id->valuestring, cJSON_IsTrue(record_proxied),
+                         cJSON_IsString(record_content) ? record_content->valuestring : "");
     }
+}
 
-    cJSON_Delete(json);
+// Function to check whether a cached zone map entry can stand for a record of
+// this type. The map keeps no types, so only A, AAAA and CNAME are recognised
+// (by the shape of their content); anything else is looked up.
+static int cached_type_matches(const char *type, const char *content) {
+    int kind = guess_record_kind(content);
+    return kind != RECORD_KIND_OTHER && strcmp(type, record_kind_name(kind)) == 0;
+}
+
+// Function to check that a write succeeded
+static int response_succeeded(const ApiResponse *response) {
+    return response && response->status >= 200 && response->status < 300 &&
+           cJSON_IsTrue(cJSON_GetObjectItem(response->json, "success"));
 }
 
 // Modify add_update_record
 void add_update_record(const char *zone_id, const char *type, const char *name, const char *content, int ttl, int proxied) {
+    cJSON *record_json = cJSON_CreateObject();
+    cJSON_AddStringToObject(record_json, "type", type);
+    cJSON_AddStringToObject(record_json, "name", name);
+    cJSON_AddStringToObject(record_json, "content", content);
+    cJSON_AddNumberToObject(record_json, "ttl", ttl);
+    cJSON_AddBoolToObject(record_json, "proxied", proxied);
+    char *payload = cJSON_PrintUnformatted(record_json);
+    cJSON_Delete(record_json);
+    if (!payload) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return;
+    }
+
+    // With the record ID already in the zone map, one PATCH is the whole update.
+    // It is sent even when the map shows these values already: the map may be
+    // stale and keeps no TTL, and the API's answer is the one printed. The map
+    // keeps one record per name, so unlike the lookup below this path leaves any
+    // other records of the name alone.
+    ZoneMap cached;
+    load_zone_map_once();
+    if (get_zone_entry(find_domain(name), &cached) && strcmp(cached.zone_id, zone_id) == 0 &&
+        cached_type_matches(type, cached.ip_address)) {
+        char patch_url[512];
+        snprintf(patch_url, sizeof(patch_url), "%s/zones/%s/dns_records/%s", API_URL, zone_id, cached.record_id);
+
+        ApiResponse *patch_response = make_request(patch_url, "PATCH", payload);
+        if (patch_response && patch_response->status != 404) {
+            print_json(patch_response);
+            if (response_succeeded(patch_response)) {
+                remember_record(zone_id, cJSON_GetObjectItem(patch_response->json, "result"));
+            }
+            api_response_free(patch_response);
+            free(payload);
+            return;
+        }
+
+        // The cached record is gone; forget it and look the name up instead
+        api_response_free(patch_response);
+        remove_zone_map_record(zone_id, cached.record_id);
+    }
+
     char fetch_url[512];
     snprintf(fetch_url, sizeof(fetch_url), "%s/zones/%s/dns_records?type=%s&name=%s", API_URL, zone_id, type, name);
 
-    char *fetch_response = make_request(fetch_url, "GET", NULL);
+    ApiResponse *fetch_response = make_request(fetch_url, "GET", NULL);
     if (!fetch_response) {
         fprintf(stderr, "Error: Failed to fetch DNS records.\n");
+        free(payload);
         return;
     }
 
@@ -166,23 +205,21 @@ void add_update_record(const char *zone_id, const char *type, const char *name,
     //printf("Fetched DNS Records:\n");
     print_json(fetch_response);
 
-    cJSON *json = cJSON_Parse(fetch_response);
-    if (!json) {
-        fprintf(stderr, "Error: Failed to parse JSON response.\n");
-        free(fetch_response);
-        return;
-    }
+    cJSON *json = fetch_response->json;
 
     cJSON *result = cJSON_GetObjectItem(json, "result");
     if (!result || !cJSON_IsArray(result)) {
         fprintf(stderr, "Error: Invalid response structure.\n");
-        cJSON_Delete(json);
-        free(fetch_response);
+        api_response_free(fetch_response);
+        free(payload);
         return;
     }
 
-    int record_exists = 0;
+    // Keep a record that already matches; otherwise the first differing one is
+    // updated in place and any further ones are deleted
     cJSON *record;
+    cJSON *existing = NULL;
+    cJSON *target = NULL;
     cJSON_ArrayForEach(record, result) {
         cJSON *record_name = cJSON_GetObjectItem(record, "name");
         cJSON *record_content = cJSON_GetObjectItem(record, "content");
@@ -193,46 +230,68 @@ void add_update_record(const char *zone_id, const char *type, const char *name,
             if (strcmp(record_content->valuestring, content) == 0 && record_proxied->valueint == proxied) {
                 /* Remove all but JSON */
                // printf("Record already exists. No changes made.\n");
-                record_exists = 1;
+                existing = record;
                 break;
-            } else {
-                const char *record_id_str = record_id->valuestring;
-                /* Remove all but JSON */
-               // printf("Deleting existing record (ID: %s):\n", record_id_str);
-
-                char delete_url[512];
-                snprintf(delete_url, sizeof(delete_url), "%s/zones/%s/dns_records/%s", API_URL, zone_id, record_id_str);
-
-                char *delete_response = make_request(delete_url, "DELETE", NULL);
-                if (delete_response) {
-                    /* Remove all but JSON */
-                    //printf("Delete Record Response:\n");
-                    print_json(delete_response);
-                    free(delete_response);
-                }
+            } else if (!target) {
+                target = record;
             }
         }
     }
 
-    cJSON_Delete(json);
-    free(fetch_response);
+    if (existing) {
+        remember_record(zone_id, existing);
+    } else if (target) {
+        char patch_url[512];
+        snprintf(patch_url, sizeof(patch_url), "%s/zones/%s/dns_records/%s", API_URL, zone_id,
+                 cJSON_GetObjectItem(target, "id")->valuestring);
+
+        ApiResponse *patch_response = make_request(patch_url, "PATCH", payload);
+        if (patch_response) {
+            print_json(patch_response);
+            if (response_succeeded(patch_response)) {
+                remember_record(zone_id, cJSON_GetObjectItem(patch_response->json, "result"));
+            }
+            api_response_free(patch_response);
+        }
+
+        cJSON_ArrayForEach(record, result) {
+            cJSON *record_name = cJSON_GetObjectItem(record, "name");
+            cJSON *record_id = cJSON_GetObjectItem(record, "id");
+            if (record == target || !cJSON_IsString(record_name) || !cJSON_IsString(record_id) ||
+                strcmp(record_name->valuestring, name) != 0) continue;
 
-    if (!record_exists) {
-        char add_url[512], payload[1024];
-        snprintf(add_url, sizeof(add_url), "%s/zones/%s/dns_records", API_URL, zone_id);
+            char delete_url[512];
+            snprintf(delete_url, sizeof(delete_url), "%s/zones/%s/dns_records/%s", API_URL, zone_id, record_id->valuestring);
 
-        snprintf(payload, sizeof(payload),
-                 "{\"type\":\"%s\", \"name\":\"%s\", \"content\":\"%s\", \"ttl\":%d, \"proxied\":%s}",
-                 type, name, content, ttl, proxied ? "true" : "false");
+            ApiResponse *delete_response = make_request(delete_url, "DELETE", NULL);
+            if (delete_response) {
+                /* Remove all but JSON */
+                //printf("Delete Record Response:\n");
+                print_json(delete_response);
+                if (response_succeeded(delete_response)) {
+                    remove_zone_map_record(zone_id, record_id->valuestring);
+                }
+                api_response_free(delete_response);
+            }
+        }
+    } else {
+        char add_url[512];
+        snprintf(add_url, sizeof(add_url), "%s/zones/%s/dns_records", API_URL, zone_id);
 
-        char *add_response = make_request(add_url, "POST", payload);
+        ApiResponse *add_response = make_request(add_url, "POST", payload);
         if (add_response) {
             /* Remove all but JSON */
            // printf("Add Record Response:\n");
             print_json(add_response);
-            free(add_response);
+            if (response_succeeded(add_response)) {
+                remember_record(zone_id, cJSON_GetObjectItem(add_response->json, "result"));
+            }
+            api_response_free(add_response);
         }
     }
+
+    api_response_free(fetch_response);
+    free(payload);
 }
 
 // Modify delete_record
@@ -240,13 +299,17 @@ void delete_record(const char *zone_id, const char *record_id) {
     char url[512];
     snprintf(url, sizeof(url), "%s/zones/%s/dns_records/%s", API_URL, zone_id, record_id);
 
-    char *response = make_request(url, "DELETE", NULL);
+    ApiResponse *response = make_request(url, "DELETE", NULL);
     if (response) {
        
        /* Remove all but JSON */
        // printf("Delete Record Response:\n");
         print_json(response);
-        free(response);
+        if (response_succeeded(response)) {
+            load_zone_map_once();
+            remove_zone_map_record(zone_id, record_id);
+        }
+        api_response_free(response);
     }
 }
 
@@ -259,62 +322,436 @@ void purge_cache(const char *zone_id) {
     snprintf(url, sizeof(url), "%s/zones/%s/purge_cache", API_URL, zone_id);
     snprintf(payload, sizeof(payload), "{\"purge_everything\":true}");
 
-    char *response = make_request(url, "POST", payload);
+    ApiResponse *response = make_request(url, "POST", payload);
     if (response) {
-        printf("Purge Cache Response: %s\n", response);
-        free(response);
+        printf("Purge Cache Response: ");
+        api_print_response(response);
+        api_response_free(response);
     }
 }
 
-int main(int argc, char *argv[]) {
-    if (!load_config()) {
-        return 1;
+// Function to purge selected files, hosts, prefixes or tags. Each of --files,
+// --hosts, --prefixes and --tags sets the kind of the targets that follow it;
+// --from <path> reads more targets from a file. Returns 1 on success.
+int purge_cache_targets(const char *zone_id, int argc, char *argv[]) {
+    static const char *const kind_flags[PURGE_KINDS] = {"--files", "--hosts", "--prefixes", "--tags"};
+
+    PurgeList *list = purge_list_create();
+    if (!list) return 0;
+
+    int kind = PURGE_FILES;
+    int ok = 1;
+    for (int i = 0; i < argc && ok; i++) {
+        int flag = -1;
+        for (int k = 0; k < PURGE_KINDS; k++) {
+            if (strcmp(argv[i], kind_flags[k]) == 0) flag = k;
+        }
+
+        if (flag >= 0) {
+            kind = flag;
+        } else if (strcmp(argv[i], "--from") == 0) {
+            ok = i + 1 < argc && purge_list_add_file(list, kind, argv[++i]);
+        } else {
+            ok = purge_list_add(list, kind, argv[i]);
+        }
     }
 
-    if (argc < 2) {
-        printf("Usage: ./cloudflare <command> [args]\n");
-        printf("Commands:\n");
-        printf("  list_zones\n");
-        printf("  add_update_record <zone_id> <type> <name> <content> <ttl> <proxied>\n");
-        printf("  delete_record <zone_id> <record_id>\n");
-        printf("  purge_cache <zone_id>\n");
-        return 1;
+    if (ok) {
+        ok = purge_list_run(list, zone_id, MAX_IN_FLIGHT);
+    } else {
+        printf("Usage: ./cloudflare purge_cache <zone_id> [[--files|--hosts|--prefixes|--tags] <target>...] [--from <path>]\n");
     }
+    purge_list_free(list);
+    return ok;
+}
 
-    const char *command = argv[1];
+// Function to run one command; argv[0] is the command name.
+// Returns 1 if the command was run, 0 on a usage error, an unknown command
+// or a failed apply.
+int run_command(int argc, char *argv[]) {
+    const char *command = argv[0];
 
     if (strcmp(command, "list_zones") == 0) {
         list_zones();
     } else if (strcmp(command, "add_update_record") == 0) {
-        if (argc != 8) {
+        if (argc != 7) {
             printf("Usage: ./cloudflare add_update_record <zone_id> <type> <name> <content> <ttl> <proxied>\n");
-            return 1;
+            return 0;
         }
-        const char *zone_id = argv[2];
-        const char *type = argv[3];
-        const char *name = argv[4];
-        const char *content = argv[5];
-        int ttl = atoi(argv[6]);
-        int proxied = atoi(argv[7]);
+        const char *zone_id = argv[1];
+        const char *type = argv[2];
+        const char *name = argv[3];
+        const char *content = argv[4];
+        int ttl = atoi(argv[5]);
+        int proxied = atoi(argv[6]);
         add_update_record(zone_id, type, name, content, ttl, proxied);
     } else if (strcmp(command, "delete_record") == 0) {
-        if (argc != 4) {
+        if (argc != 3) {
             printf("Usage: ./cloudflare delete_record <zone_id> <record_id>\n");
-            return 1;
+            return 0;
         }
-        const char *zone_id = argv[2];
-        const char *record_id = argv[3];
+        const char *zone_id = argv[1];
+        const char *record_id = argv[2];
         delete_record(zone_id, record_id);
     } else if (strcmp(command, "purge_cache") == 0) {
-        if (argc != 3) {
-            printf("Usage: ./cloudflare purge_cache <zone_id>\n");
-            return 1;
+        if (argc < 2) {
+            printf("Usage: ./cloudflare purge_cache <zone_id> [[--files|--hosts|--prefixes|--tags] <target>...] [--from <path>]\n");
+            return 0;
+        }
+        const char *zone_id = argv[1];
+        if (argc > 2) {
+            return purge_cache_targets(zone_id, argc - 2, argv + 2);
         }
-        const char *zone_id = argv[2];
         purge_cache(zone_id);
+    } else if (strcmp(command, "watch") == 0) {
+        int interval = DEFAULT_WATCH_INTERVAL, settle = DEFAULT_WATCH_SETTLE, once = 0;
+        const char *path = NULL;
+        int usage = 0;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--once") == 0) {
+                once = 1;
+            } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+                interval = atoi(argv[++i]);
+            } else if (strcmp(argv[i], "--settle") == 0 && i + 1 < argc) {
+                settle = atoi(argv[++i]);
+            } else if (!path) {
+                path = argv[i];
+            } else {
+                usage = 1;
+            }
+        }
+        if (!path || usage) {
+            printf("Usage: ./cloudflare watch [--interval <seconds>] [--settle <seconds>] [--once] <watch.txt>\n");
+            return 0;
+        }
+        return watch_records(path, interval, settle, once, add_update_record);
+    } else if (strcmp(command, "query") == 0) {
+        // Answered from the zone map; in serve mode its indexes stay warm between queries
+        return query_zone_map(argc - 1, argv + 1);
+    } else if (strcmp(command, "metrics") == 0) {
+        // Summary of the requests made so far, mostly useful in serve mode
+        int format = argc > 1 ? metrics_parse_format(argv[1]) : METRICS_FORMAT;
+        metrics_write(stdout, format);
+    } else if (strcmp(command, "apply") == 0 || strcmp(command, "sync") == 0) {
+        // sync also deletes whatever the file does not list in its zones
+        int flags = strcmp(command, "sync") == 0 ? APPLY_PRUNE : 0;
+        const char *path = NULL;
+        int usage = 0;
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--dry-run") == 0) {
+                flags |= APPLY_DRY_RUN;
+            } else if (strcmp(argv[i], "--cached") == 0) {
+                flags |= APPLY_CACHED;
+            } else if (!path) {
+                path = argv[i];
+            } else {
+                usage = 1;
+            }
+        }
+        if (!path || usage) {
+            printf("Usage: ./cloudflare %s [--dry-run] [--cached] <records.csv|records.ndjson>\n", command);
+            return 0;
+        }
+        return apply_records_file(path, MAX_IN_FLIGHT, flags);
+    } else if (strcmp(command, "export") == 0) {
+        return export_zones(argc - 1, argv + 1, MAX_IN_FLIGHT);
+    } else if (strcmp(command, "import") == 0) {
+        return import_zones(argc - 1, argv + 1, MAX_IN_FLIGHT);
     } else {
         printf("Unknown command: %s\n", command);
+        return 0;
+    }
+
+    return 1;
+}
+
+#define SERVE_MAX_ARGS 256 // Most words accepted on one serve line, enough for a purge list
+
+// How a field of an NDJSON request becomes words
+#define FIELD_POSITIONAL 0 // The value itself; a missing one ends the command there
+#define FIELD_SWITCH     1 // The flag alone, when the value is true
+#define FIELD_OPTION     2 // The flag and the value; an array repeats the pair per element
+#define FIELD_LIST       3 // The flag followed by the value, or by every element of an array
+
+// Arguments of each command, in order, for NDJSON requests
+static const struct {
+    const char *command;
+    struct {
+        const char *name;
+        int kind;
+        const char *flag;
+    } fields[8];
+} COMMAND_FIELDS[] = {
+    {"list_zones", {{NULL, 0, NULL}}},
+    {"add_update_record", {{"zone_id", FIELD_POSITIONAL, NULL}, {"type", FIELD_POSITIONAL, NULL}, {"name", FIELD_POSITIONAL, NULL},
+                           {"content", FIELD_POSITIONAL, NULL}, {"ttl", FIELD_POSITIONAL, NULL}, {"proxied", FIELD_POSITIONAL, NULL}}},
+    {"delete_record", {{"zone_id", FIELD_POSITIONAL, NULL}, {"record_id", FIELD_POSITIONAL, NULL}}},
+    {"purge_cache", {{"zone_id", FIELD_POSITIONAL, NULL}, {"files", FIELD_LIST, "--files"}, {"hosts", FIELD_LIST, "--hosts"},
+                     {"prefixes", FIELD_LIST, "--prefixes"}, {"tags", FIELD_LIST, "--tags"}, {"from", FIELD_OPTION, "--from"}}},
+    {"apply", {{"dry_run", FIELD_SWITCH, "--dry-run"}, {"cached", FIELD_SWITCH, "--cached"}, {"file", FIELD_POSITIONAL, NULL}}},
+    {"sync", {{"dry_run", FIELD_SWITCH, "--dry-run"}, {"cached", FIELD_SWITCH, "--cached"}, {"file", FIELD_POSITIONAL, NULL}}},
+    {"query", {{"name", FIELD_OPTION, "--name"}, {"suffix", FIELD_OPTION, "--suffix"}, {"content", FIELD_OPTION, "--content"},
+               {"type", FIELD_OPTION, "--type"}, {"zone", FIELD_OPTION, "--zone"}, {"proxied", FIELD_OPTION, "--proxied"},
+               {"limit", FIELD_OPTION, "--limit"}, {"count", FIELD_SWITCH, "--count"}}},
+    {"metrics", {{"format", FIELD_POSITIONAL, NULL}}},
+    {"export", {{"format", FIELD_OPTION, "--format"}, {"zone", FIELD_OPTION, "--zone"}, {"output", FIELD_OPTION, "--output"}}},
+    {"import", {{"dry_run", FIELD_SWITCH, "--dry-run"}, {"prune", FIELD_SWITCH, "--prune"}, {"zone", FIELD_OPTION, "--zone"},
+                {"file", FIELD_POSITIONAL, NULL}}},
+    {"watch", {{"once", FIELD_SWITCH, "--once"}, {"interval", FIELD_OPTION, "--interval"},
+               {"settle", FIELD_OPTION, "--settle"}, {"file", FIELD_POSITIONAL, NULL}}},
+};
+
+// Function to split a serve line into words in place. Double quotes group
+// words and a backslash escapes the next character. Returns the word count.
+static int split_command_line(char *line, char **args, int max_args) {
+    int count = 0;
+    char *read = line;
+
+    while (*read && count < max_args) {
+        while (*read == ' ' || *read == '\t' || *read == '\r' || *read == '\n') read++;
+        if (!*read) break;
+
+        char *write = read;
+        args[count++] = write;
+        int quoted = 0;
+        while (*read && (quoted || (*read != ' ' && *read != '\t' && *read != '\r' && *read != '\n'))) {
+            if (*read == '"') {
+                quoted = !quoted;
+                read++;
+            } else if (*read == '\\' && read[1]) {
+                *write++ = read[1];
+                read += 2;
+            } else {
+                *write++ = *read++;
+            }
+        }
+        if (*read) read++;
+        *write = '\0';
+    }
+
+    return count;
+}
+
+// Function to turn one JSON value into a word. Strings stay owned by the
+// JSON; numbers and booleans are written to number. Returns NULL for other values.
+static char *json_word(cJSON *value, char *number) {
+    if (cJSON_IsString(value)) return value->valuestring;
+    if (cJSON_IsBool(value)) return cJSON_IsTrue(value) ? "1" : "0";
+    if (!cJSON_IsNumber(value)) return NULL;
+    snprintf(number, 32, "%d", value->valueint);
+    return number;
+}
+
+// Function to turn an NDJSON request such as
+// {"command":"delete_record","zone_id":"...","record_id":"..."} into words,
+// following the command's entry in COMMAND_FIELDS. Returns the word count,
+// or -1 if the request has more words than max_args.
+static int json_command_args(cJSON *json, char **args, char numbers[][32], int max_args) {
+    cJSON *command = cJSON_GetObjectItem(json, "command");
+    if (!cJSON_IsString(command)) return 0;
+
+    int count = 0;
+    args[count++] = command->valuestring;
+
+    for (size_t i = 0; i < sizeof(COMMAND_FIELDS) / sizeof(COMMAND_FIELDS[0]); i++) {
+        if (strcmp(COMMAND_FIELDS[i].command, command->valuestring) != 0) continue;
+
+        for (int f = 0; f < 8 && COMMAND_FIELDS[i].fields[f].name; f++) {
+            cJSON *value = cJSON_GetObjectItem(json, COMMAND_FIELDS[i].fields[f].name);
+            int kind = COMMAND_FIELDS[i].fields[f].kind;
+            const char *flag = COMMAND_FIELDS[i].fields[f].flag;
+
+            if (kind == FIELD_POSITIONAL) {
+                if (count >= max_args) return -1;
+                if (!(args[count] = json_word(value, numbers[count]))) break; // run_command reports the usage
+                count++;
+            } else if (kind == FIELD_SWITCH) {
+                if (!cJSON_IsTrue(value)) continue;
+                if (count >= max_args) return -1;
+                args[count++] = (char *)flag;
+            } else if (value) {
+                // An option or list with a single value is treated as an array of one
+                cJSON *element = cJSON_IsArray(value) ? value->child : value;
+                for (int first = 1; element; element = cJSON_IsArray(value) ? element->next : NULL, first = 0) {
+                    if (count + 2 > max_args) return -1;
+                    if (kind == FIELD_OPTION || first) args[count++] = (char *)flag;
+                    if (!(args[count] = json_word(element, numbers[count]))) {
+                        fprintf(stderr, "Error: Invalid value for \"%s\".\n", COMMAND_FIELDS[i].fields[f].name);
+                        return 0;
+                    }
+                    count++;
+                }
+            }
+        }
+        break;
+    }
+
+    return count;
+}
+
+// Function to check that serve can run a command: watch without --once never
+// returns, and import from stdin would read the session's own commands
+static int serve_allows(int argc, char *argv[]) {
+    if (strcmp(argv[0], "watch") == 0) {
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "--once") == 0) return 1;
+        }
+        fprintf(stderr, "Error: watch runs until it is stopped; serve only runs watch --once.\n");
+        return 0;
+    }
+    if (strcmp(argv[0], "import") == 0) {
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], "-") == 0) {
+                fprintf(stderr, "Error: serve can't import from stdin; give a file.\n");
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+// Function to run commands from a stream, one per line, until EOF or "quit".
+// Lines are either words (as on the command line) or NDJSON objects. Every
+// command's output is followed by a {"done":...} line so clients know where it ends.
+static void serve_stream(FILE *in) {
+    char *line = NULL;
+    size_t capacity = 0;
+
+    while (getline(&line, &capacity, in) != -1) {
+        char *args[SERVE_MAX_ARGS];
+        char numbers[SERVE_MAX_ARGS][32];
+        cJSON *json = NULL;
+        int count;
+
+        char *start = line;
+        while (*start == ' ' || *start == '\t') start++;
+        if (*start == '{') {
+            json = cJSON_Parse(start);
+            count = json ? json_command_args(json, args, numbers, SERVE_MAX_ARGS) : 0;
+            if (!json) fprintf(stderr, "Error: Invalid JSON request: %s", start);
+            if (count < 0) fprintf(stderr, "Error: Request has more than %d arguments.\n", SERVE_MAX_ARGS);
+        } else {
+            count = split_command_line(start, args, SERVE_MAX_ARGS);
+            if (count == 0) {
+                continue;
+            }
+        }
+
+        if (count > 0 && (strcmp(args[0], "quit") == 0 || strcmp(args[0], "exit") == 0)) {
+            cJSON_Delete(json);
+            break;
+        }
+
+        int ok = count > 0 && serve_allows(count, args) && run_command(count, args);
+        printf("{\"done\":true,\"ok\":%s}\n", ok ? "true" : "false");
+        fflush(stdout);
+        cJSON_Delete(json);
+        metrics_tick();
     }
 
+    // The zone map stays in memory between commands; write it once per session
+    flush_zone_map();
+    free(line);
+}
+
+// Function to serve commands on a Unix socket, one client at a time. The
+// client connection becomes stdout while its commands run.
+static int serve_socket(const char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path is too long: %s\n", path);
+        return 0;
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        fprintf(stderr, "Error: Could not create socket: %s\n", strerror(errno));
+        return 0;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(server, 16) < 0) {
+        fprintf(stderr, "Error: Could not listen on %s: %s\n", path, strerror(errno));
+        close(server);
+        return 0;
+    }
+
+    // A client hanging up mid-response must not take the daemon down
+    signal(SIGPIPE, SIG_IGN);
+    int saved_stdout = dup(STDOUT_FILENO);
+
+    for (;;) {
+        int client = accept(server, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: accept() failed: %s\n", strerror(errno));
+            break;
+        }
+
+        FILE *in = fdopen(client, "r");
+        if (!in) {
+            close(client);
+            continue;
+        }
+
+        fflush(stdout);
+        dup2(client, STDOUT_FILENO);
+        serve_stream(in);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        fclose(in);
+    }
+
+    close(saved_stdout);
+    close(server);
+    unlink(path);
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char *argv[]) {
+    if (!load_config(load_local_config)) {
+        return 1;
+    }
+
+    metrics_init();
+    if (!http_init(API_KEY)) {
+        return 1;
+    }
+
+    if (argc < 2) {
+        printf("Usage: ./cloudflare <command> [args]\n");
+        printf("Commands:\n");
+        printf("  list_zones\n");
+        printf("  add_update_record <zone_id> <type> <name> <content> <ttl> <proxied>\n");
+        printf("  delete_record <zone_id> <record_id>\n");
+        printf("  purge_cache <zone_id> [[--files|--hosts|--prefixes|--tags] <target>...] [--from <path>]\n");
+        printf("  apply [--dry-run] [--cached] <records.csv|records.ndjson>\n");
+        printf("  sync [--dry-run] [--cached] <records.csv|records.ndjson>\n");
+        printf("  export [--format bind|ndjson] [--zone <zone_id>]... [--output <path>]\n");
+        printf("  import [--dry-run] [--prune] [--zone <zone_id>] <zone.txt|records.ndjson|->\n");
+        printf("  watch [--interval <seconds>] [--settle <seconds>] [--once] <watch.txt>\n");
+        printf("  query [--name <fqdn|*.domain>] [--suffix <domain>] [--content <value>] [--type <type>] [--zone <zone_id>] [--proxied 0|1] [--limit <n>] [--count]\n");
+        printf("  metrics [json|prometheus]\n");
+        printf("  serve [socket_path]\n");
+        return 1;
+    }
+
+    // Keep the configuration and connections warm across many commands
+    if (strcmp(argv[1], "serve") == 0) {
+        if (argc == 3) {
+            return serve_socket(argv[2]) ? 0 : 1;
+        }
+        serve_stream(stdin);
+        return 0;
+    }
+
+    int ok = run_command(argc - 1, argv + 1);
+    if (!flush_zone_map()) {
+        return 1;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+// End-to-end benchmark for ./cloudflare and ./map. Starts ./mock_server with a
+// synthetic account, runs each scenario against it from a scratch directory
+// and prints one JSON line per scenario: requests/sec seen by the server,
+// p50/p99 latency of a whole command, and the peak RSS of the slowest child.
+//
+//   ./bench [-z zones] [-r records] [-n runs] [-l latency_ms] [-p port] [-b bin_dir]
+//
+// Keep the numbers of two builds comparable by running them with the same
+// options on the same machine.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_DEFAULT_PORT 8766
+#define BENCH_MAX_ARGS 16
+#define BENCH_ARG_SIZE 1100 // Room for bin_dir plus a tool name
+
+// Configuration from the command line
+static int zone_total = 20;
+static int records_per_zone = 500;
+static int runs = 20;
+static int latency_ms = 0;
+static int port = BENCH_DEFAULT_PORT;
+static char bin_dir[1024] = ".";
+
+// Results of one scenario
+struct scenario_result {
+    double *latencies; // Milliseconds per run
+    int count;
+    int failed;
+    long peak_rss_kb;
+    double wall_ms;
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Send a request to the mock server and copy the response body into body.
+// Returns 1 on a 200 response.
+static int mock_request(const char *method, const char *path, char *body, size_t size) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return 0;
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return 0;
+    }
+
+    char request[256];
+    int length = snprintf(request, sizeof(request),
+                          "%s %s HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", method, path);
+    if (send(fd, request, (size_t)length, MSG_NOSIGNAL) != length) {
+        close(fd);
+        return 0;
+    }
+
+    char response[4096];
+    size_t received = 0;
+    ssize_t got;
+    while (received + 1 < sizeof(response) && (got = recv(fd, response + received, sizeof(response) - received - 1, 0)) > 0) {
+        received += (size_t)got;
+    }
+    close(fd);
+    response[received] = '\0';
+
+    char *start = strstr(response, "\r\n\r\n");
+    if (body && size) snprintf(body, size, "%s", start ? start + 4 : "");
+    return strncmp(response, "HTTP/1.1 200", 12) == 0;
+}
+
+// Requests the mock server has answered since the last reset
+static long mock_request_count(void) {
+    char body[512];
+    if (!mock_request("GET", "/__stats", body, sizeof(body))) return -1;
+    char *requests = strstr(body, "\"requests\":");
+    return requests ? atol(requests + 11) : -1;
+}
+
+static pid_t start_mock_server(void) {
+    char path[1100], zones[16], records[16], latency[16], port_text[16];
+    snprintf(path, sizeof(path), "%s/mock_server", bin_dir);
+    snprintf(zones, sizeof(zones), "%d", zone_total);
+    snprintf(records, sizeof(records), "%d", records_per_zone);
+    snprintf(latency, sizeof(latency), "%d", latency_ms);
+    snprintf(port_text, sizeof(port_text), "%d", port);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) dup2(null_fd, STDERR_FILENO);
+        execl(path, path, "-p", port_text, "-z", zones, "-r", records, "-l", latency, (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0) return -1;
+
+    // Wait for the listener
+    for (int attempt = 0; attempt < 500; attempt++) {
+        if (mock_request("POST", "/__reset", NULL, 0)) return pid;
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) return -1;
+        usleep(10000);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// Run a tool in the scratch directory with its output discarded. Records the
+// wall time and peak RSS of the run. Returns 1 if it exited with status 0.
+static int run_command(char *const argv[], double *elapsed_ms, long *rss_kb) {
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (pid < 0) return 0;
+
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    while (wait4(pid, &status, 0, &usage) < 0 && errno == EINTR) {
+    }
+    *elapsed_ms = now_ms() - start;
+    *rss_kb = usage.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    if (count == 0) return 0;
+    int index = (int)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Builds the command line of run i of a scenario into argv
+typedef void (*scenario_args)(int i, char *argv[], char storage[][BENCH_ARG_SIZE]);
+
+static void run_scenario(const char *name, int count, scenario_args build) {
+    struct scenario_result result;
+    memset(&result, 0, sizeof(result));
+    result.latencies = calloc(count > 0 ? count : 1, sizeof(double));
+    if (!result.latencies) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+
+    mock_request("POST", "/__reset", NULL, 0);
+    double start = now_ms();
+    for (int i = 0; i < count; i++) {
+        char storage[BENCH_MAX_ARGS][BENCH_ARG_SIZE];
+        char *argv[BENCH_MAX_ARGS + 1];
+        build(i, argv, storage);
+
+        double elapsed = 0;
+        long rss = 0;
+        if (!run_command(argv, &elapsed, &rss)) result.failed++;
+        result.latencies[result.count++] = elapsed;
+        if (rss > result.peak_rss_kb) result.peak_rss_kb = rss;
+    }
+    result.wall_ms = now_ms() - start;
+    long requests = mock_request_count();
+
+    qsort(result.latencies, result.count, sizeof(double), compare_double);
+    printf("{\"scenario\":\"%s\",\"runs\":%d,\"failed\":%d,\"requests\":%ld,\"requests_per_sec\":%.1f,"
+           "\"p50_ms\":%.2f,\"p99_ms\":%.2f,\"peak_rss_kb\":%ld}\n",
+           name, result.count, result.failed, requests,
+           result.wall_ms > 0 ? requests * 1000.0 / result.wall_ms : 0,
+           percentile(result.latencies, result.count, 0.50),
+           percentile(result.latencies, result.count, 0.99), result.peak_rss_kb);
+    fflush(stdout);
+    free(result.latencies);
+}
+
+static void zone_id(int zone, char *out) {
+    snprintf(out, 33, "%032x", zone + 1);
+}
+
+static void map_list_zones_args(int i, char *argv[], char storage[][BENCH_ARG_SIZE]) {
+    (void)i;
+    snprintf(storage[0], BENCH_ARG_SIZE, "%s/map", bin_dir);
+    argv[0] = storage[0];
+    argv[1] = "list_zones";
+    argv[2] = NULL;
+}
+
+static void list_zones_args(int i, char *argv[], char storage[][BENCH_ARG_SIZE]) {
+    (void)i;
+    snprintf(storage[0], BENCH_ARG_SIZE, "%s/cloudflare", bin_dir);
+    argv[0] = storage[0];
+    argv[1] = "list_zones";
+    argv[2] = NULL;
+}
+
+// Change the address of a different record on every run
+static void add_update_record_args(int i, char *argv[], char storage[][BENCH_ARG_SIZE]) {
+    int zone = i % (zone_total > 0 ? zone_total : 1);
+    int record = records_per_zone > 0 ? (i / (zone_total > 0 ? zone_total : 1)) % records_per_zone : i;
+    snprintf(storage[0], BENCH_ARG_SIZE, "%s/cloudflare", bin_dir);
+    zone_id(zone, storage[1]);
+    snprintf(storage[2], BENCH_ARG_SIZE, "host%d.zone%d.example", record, zone);
+    snprintf(storage[3], BENCH_ARG_SIZE, "192.0.2.%d", i % 250 + 1);
+    argv[0] = storage[0];
+    argv[1] = "add_update_record";
+    argv[2] = storage[1];
+    argv[3] = "A";
+    argv[4] = storage[2];
+    argv[5] = storage[3];
+    argv[6] = "1";
+    argv[7] = "0";
+    argv[8] = NULL;
+}
+
+static void apply_args(int i, char *argv[], char storage[][BENCH_ARG_SIZE]) {
+    (void)i;
+    snprintf(storage[0], BENCH_ARG_SIZE, "%s/cloudflare", bin_dir);
+    argv[0] = storage[0];
+    argv[1] = "apply";
+    argv[2] = "bench_apply.csv";
+    argv[3] = NULL;
+}
+
+static void purge_args(int i, char *argv[], char storage[][BENCH_ARG_SIZE]) {
+    snprintf(storage[0], BENCH_ARG_SIZE, "%s/cloudflare", bin_dir);
+    zone_id(i % (zone_total > 0 ? zone_total : 1), storage[1]);
+    argv[0] = storage[0];
+    argv[1] = "purge_cache";
+    argv[2] = storage[1];
+    argv[3] = "--from";
+    argv[4] = "bench_purge.txt";
+    argv[5] = NULL;
+}
+
+// Write the inputs of the bulk scenarios: every record of the account with a
+// new address, and a thousand URLs to purge
+static int write_bulk_inputs(void) {
+    FILE *csv = fopen("bench_apply.csv", "w");
+    if (!csv) return 0;
+    for (int z = 0; z < zone_total; z++) {
+        char id[33];
+        zone_id(z, id);
+        for (int r = 0; r < records_per_zone; r++) {
+            fprintf(csv, "%s,A,host%d.zone%d.example,198.51.100.%d,1,%s\n", id, r, z, r % 250 + 1, r % 2 ? "true" : "false");
+        }
+    }
+    fclose(csv);
+
+    FILE *purge = fopen("bench_purge.txt", "w");
+    if (!purge) return 0;
+    for (int i = 0; i < 1000; i++) fprintf(purge, "https://zone0.example/static/%d.js\n", i);
+    fclose(purge);
+    return 1;
+}
+
+static int write_config(void) {
+    FILE *config = fopen("config.txt", "w");
+    if (!config) return 0;
+    fprintf(config, "API_KEY=bench\nEMAIL=bench@example.com\nAPI_URL=http://127.0.0.1:%d/client/v4\nRATE_LIMIT=0\n", port);
+    fclose(config);
+    return 1;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: ./bench [-z zones] [-r records] [-n runs] [-l latency_ms] [-p port] [-b bin_dir]\n");
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "z:r:n:l:p:b:h")) != -1) {
+        switch (option) {
+        case 'z': zone_total = atoi(optarg); break;
+        case 'r': records_per_zone = atoi(optarg); break;
+        case 'n': runs = atoi(optarg); break;
+        case 'l': latency_ms = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'b': snprintf(bin_dir, sizeof(bin_dir), "%s", optarg); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (zone_total < 1 || records_per_zone < 1 || runs < 1) {
+        usage();
+        return 1;
+    }
+
+    // The tools read config.txt and write zone_map.txt in the working
+    // directory, so run them from a scratch directory with absolute paths
+    char absolute[PATH_MAX];
+    if (!realpath(bin_dir, absolute) || strlen(absolute) >= sizeof(bin_dir)) {
+        fprintf(stderr, "Error: Could not resolve %s.\n", bin_dir);
+        return 1;
+    }
+    snprintf(bin_dir, sizeof(bin_dir), "%s", absolute);
+    char scratch[] = "/tmp/cloudflare-bench-XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch) != 0) {
+        fprintf(stderr, "Error: Could not create a scratch directory.\n");
+        return 1;
+    }
+    if (!write_config() || !write_bulk_inputs()) {
+        fprintf(stderr, "Error: Could not write the benchmark inputs in %s.\n", scratch);
+        return 1;
+    }
+
+    pid_t server = start_mock_server();
+    if (server < 0) {
+        fprintf(stderr, "Error: Could not start %s/mock_server on port %d.\n", bin_dir, port);
+        return 1;
+    }
+    fprintf(stderr, "Benchmarking %d zones x %d records in %s\n", zone_total, records_per_zone, scratch);
+
+    run_scenario("map list_zones", runs, map_list_zones_args);
+    run_scenario("list_zones", runs, list_zones_args);
+    run_scenario("add_update_record", runs, add_update_record_args);
+    run_scenario("apply", 1, apply_args);
+    run_scenario("purge_cache --from", runs, purge_args);
+
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    return 0;
+}
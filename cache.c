@@ -0,0 +1,432 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+int CACHE_TTL = 0;
+int CACHE_ZONES_TTL = -1;
+int CACHE_RECORDS_TTL = -1;
+char CACHE_DIR[256] = DEFAULT_CACHE_DIR;
+int CACHE_MEMORY = DEFAULT_CACHE_MEMORY;
+
+#define CACHE_MAGIC "CFCACHE1"
+// Fixed width, so a streamed entry can fill in its header once the body is complete
+#define CACHE_HEADER_FORMAT CACHE_MAGIC " %017.6f %03ld %020zu\n"
+#define CACHE_GROUP_SIZE 65  // Zone IDs are 32 hex digits; anything longer is not a zone
+#define CACHE_PATH_SIZE 512
+#define MEMORY_BUCKETS 1024
+#define INVALIDATED_FILE ".invalidated" // Time of the zone's last write, in each zone directory
+
+static uint64_t scope = 14695981039346656037ULL; // FNV offset basis, mixed with the API key
+static unsigned int writer_serial = 0;
+
+// A response also kept in memory
+struct memory_entry {
+    char *url;
+    char group[CACHE_GROUP_SIZE];
+    double fetched_at;
+    long status;
+    char *body;
+    size_t size;
+    struct memory_entry *next;
+};
+
+static struct memory_entry *memory_buckets[MEMORY_BUCKETS];
+static size_t memory_bytes = 0;
+
+struct cache_writer {
+    FILE *file;
+    char group[CACHE_GROUP_SIZE];
+    char path[CACHE_PATH_SIZE];
+    char temp[CACHE_PATH_SIZE + 32];
+    long body_offset;
+    size_t size;
+};
+
+static uint64_t fnv1a(uint64_t hash, const char *text) {
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+void cache_init(const char *api_key) {
+    scope = fnv1a(14695981039346656037ULL, api_key ? api_key : "");
+}
+
+uint64_t cache_hash(const char *url) {
+    return fnv1a(14695981039346656037ULL, url);
+}
+
+double cache_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Seconds responses to url stay fresh, 0 if they are not cached
+static int cache_ttl(const char *url) {
+    int ttl = CACHE_TTL;
+    if (strstr(url, "/dns_records")) {
+        if (CACHE_RECORDS_TTL >= 0) ttl = CACHE_RECORDS_TTL;
+    } else if (strstr(url, "/zones")) {
+        if (CACHE_ZONES_TTL >= 0) ttl = CACHE_ZONES_TTL;
+    }
+    return ttl > 0 ? ttl : 0;
+}
+
+static int cache_any_enabled(void) {
+    return CACHE_TTL > 0 || CACHE_ZONES_TTL > 0 || CACHE_RECORDS_TTL > 0;
+}
+
+int cache_enabled_for(const char *url) {
+    return cache_ttl(url) > 0;
+}
+
+// Function to find the zone a URL belongs to: the ID after /zones/, or "_"
+static void url_group(const char *url, char group[CACHE_GROUP_SIZE]) {
+    strcpy(group, "_");
+
+    const char *start = strstr(url, "/zones/");
+    if (!start) return;
+    start += strlen("/zones/");
+
+    size_t length = 0;
+    while (start[length] && start[length] != '/' && start[length] != '?' && start[length] != '#') {
+        char c = start[length];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))) return;
+        if (++length >= CACHE_GROUP_SIZE) return;
+    }
+    if (length == 0) return;
+
+    memcpy(group, start, length);
+    group[length] = '\0';
+}
+
+static void group_dir(const char *group, char *path, size_t size) {
+    snprintf(path, size, "%s/%s", CACHE_DIR, group);
+}
+
+static void entry_path(const char *url, char *path, size_t size) {
+    char group[CACHE_GROUP_SIZE];
+    url_group(url, group);
+    snprintf(path, size, "%s/%s/%016llx", CACHE_DIR, group, (unsigned long long)fnv1a(scope, url));
+}
+
+// Create the cache directory and a zone's directory inside it
+static int make_group_dir(const char *group) {
+    char path[CACHE_PATH_SIZE];
+    if (mkdir(CACHE_DIR, 0700) != 0 && errno != EEXIST) return 0;
+    group_dir(group, path, sizeof(path));
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) return 0;
+    return 1;
+}
+
+// When the zone was last written to, 0 if never
+static double invalidated_at(const char *group) {
+    char path[CACHE_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%s/" INVALIDATED_FILE, CACHE_DIR, group);
+
+    FILE *file = fopen(path, "r");
+    if (!file) return 0;
+    double when = 0;
+    if (fscanf(file, "%lf", &when) != 1) when = 0;
+    fclose(file);
+    return when;
+}
+
+static int is_fresh(const char *url, const char *group, double fetched_at, double now) {
+    return fetched_at + cache_ttl(url) > now && fetched_at >= invalidated_at(group);
+}
+
+static char *copy_body(const char *body, size_t size) {
+    char *copy = malloc(size + 1);
+    if (!copy) return NULL;
+    memcpy(copy, body, size);
+    copy[size] = '\0';
+    return copy;
+}
+
+static void free_memory_entry(struct memory_entry *entry) {
+    memory_bytes -= entry->size;
+    free(entry->url);
+    free(entry->body);
+    free(entry);
+}
+
+// Unlink the entries matching url (or, with url NULL, every stale entry or
+// every entry of group) from the memory cache
+static void drop_memory_entries(const char *url, const char *group) {
+    double now = cache_clock();
+    int first = url ? (int)(cache_hash(url) % MEMORY_BUCKETS) : 0;
+    int last = url ? first : MEMORY_BUCKETS - 1;
+
+    for (int b = first; b <= last; b++) {
+        struct memory_entry **link = &memory_buckets[b];
+        while (*link) {
+            struct memory_entry *entry = *link;
+            int drop = url ? strcmp(entry->url, url) == 0
+                           : group ? strcmp(entry->group, group) == 0
+                                   : entry->fetched_at + cache_ttl(entry->url) <= now;
+            if (drop) {
+                *link = entry->next;
+                free_memory_entry(entry);
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+static void remember(const char *url, double fetched_at, long status, const char *body, size_t size) {
+    size_t limit = (size_t)(CACHE_MEMORY > 0 ? CACHE_MEMORY : 0) * 1024 * 1024;
+    drop_memory_entries(url, NULL);
+    if (memory_bytes + size > limit) drop_memory_entries(NULL, NULL);
+    if (memory_bytes + size > limit) return;
+
+    struct memory_entry *entry = calloc(1, sizeof(struct memory_entry));
+    if (!entry) return;
+    entry->url = strdup(url);
+    entry->body = copy_body(body, size);
+    if (!entry->url || !entry->body) {
+        free(entry->url);
+        free(entry->body);
+        free(entry);
+        return;
+    }
+    url_group(url, entry->group);
+    entry->fetched_at = fetched_at;
+    entry->status = status;
+    entry->size = size;
+
+    int b = (int)(cache_hash(url) % MEMORY_BUCKETS);
+    entry->next = memory_buckets[b];
+    memory_buckets[b] = entry;
+    memory_bytes += size;
+}
+
+// Read an entry file. Returns the body (caller frees) or NULL if it is missing,
+// damaged or belongs to another URL.
+static char *read_entry(const char *path, const char *url, double *fetched_at, long *status, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    char header[64];
+    char *stored_url = NULL;
+    size_t stored_capacity = 0;
+    char *body = NULL;
+
+    if (fgets(header, sizeof(header), file) &&
+        sscanf(header, CACHE_MAGIC " %lf %ld %zu", fetched_at, status, size) == 3 &&
+        getline(&stored_url, &stored_capacity, file) > 0) {
+        stored_url[strcspn(stored_url, "\n")] = '\0';
+        if (strcmp(stored_url, url) == 0 && (body = malloc(*size + 1))) {
+            if (fread(body, 1, *size, file) == *size) {
+                body[*size] = '\0';
+            } else {
+                free(body);
+                body = NULL;
+            }
+        }
+    }
+
+    free(stored_url);
+    fclose(file);
+    return body;
+}
+
+int cache_lookup(const char *url, char **body, size_t *size, long *status) {
+    if (!cache_enabled_for(url)) return 0;
+
+    double now = cache_clock();
+    char group[CACHE_GROUP_SIZE];
+    url_group(url, group);
+
+    struct memory_entry *entry = memory_buckets[cache_hash(url) % MEMORY_BUCKETS];
+    while (entry && strcmp(entry->url, url) != 0) entry = entry->next;
+    if (entry) {
+        if (is_fresh(url, group, entry->fetched_at, now) && (*body = copy_body(entry->body, entry->size))) {
+            *size = entry->size;
+            *status = entry->status;
+            return 1;
+        }
+        drop_memory_entries(url, NULL);
+    }
+
+    char path[CACHE_PATH_SIZE];
+    entry_path(url, path, sizeof(path));
+    double fetched_at = 0;
+    char *stored = read_entry(path, url, &fetched_at, status, size);
+    if (!stored) return 0;
+    if (!is_fresh(url, group, fetched_at, now)) {
+        free(stored);
+        return 0;
+    }
+
+    remember(url, fetched_at, *status, stored, *size);
+    *body = stored;
+    return 1;
+}
+
+// Write a file next to its final path and rename it into place. With url
+// set, the body is preceded by an entry header.
+static int write_entry(const char *path, const char *url, double fetched_at, long status, const char *body, size_t size) {
+    char temp[CACHE_PATH_SIZE + 32];
+    snprintf(temp, sizeof(temp), "%s.tmp.%d.%u", path, (int)getpid(), writer_serial++);
+
+    FILE *file = fopen(temp, "wb");
+    if (!file) return 0;
+    int ok = (!url || fprintf(file, CACHE_HEADER_FORMAT "%s\n", fetched_at, status, size, url) > 0) &&
+             fwrite(body, 1, size, file) == size;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) {
+        unlink(temp);
+        return 0;
+    }
+    return 1;
+}
+
+void cache_store(const char *url, double fetched_at, long status, const char *body, size_t size) {
+    if (!cache_enabled_for(url) || status != 200 || !body) return;
+
+    char group[CACHE_GROUP_SIZE];
+    url_group(url, group);
+    if (fetched_at < invalidated_at(group)) return; // A write landed while this was in flight
+
+    remember(url, fetched_at, status, body, size);
+
+    char path[CACHE_PATH_SIZE];
+    entry_path(url, path, sizeof(path));
+    if (make_group_dir(group)) write_entry(path, url, fetched_at, status, body, size);
+}
+
+CacheWriter *cache_writer_open(const char *url) {
+    if (!cache_enabled_for(url)) return NULL;
+
+    char group[CACHE_GROUP_SIZE];
+    url_group(url, group);
+    if (!make_group_dir(group)) return NULL;
+
+    CacheWriter *writer = calloc(1, sizeof(CacheWriter));
+    if (!writer) return NULL;
+    strcpy(writer->group, group);
+    entry_path(url, writer->path, sizeof(writer->path));
+    snprintf(writer->temp, sizeof(writer->temp), "%s.tmp.%d.%u", writer->path, (int)getpid(), writer_serial++);
+
+    writer->file = fopen(writer->temp, "w+b");
+    if (!writer->file || fprintf(writer->file, CACHE_HEADER_FORMAT "%s\n", 0.0, 0L, (size_t)0, url) < 0) {
+        if (writer->file) {
+            fclose(writer->file);
+            unlink(writer->temp);
+        }
+        free(writer);
+        return NULL;
+    }
+    writer->body_offset = ftell(writer->file);
+    return writer;
+}
+
+int cache_writer_write(CacheWriter *writer, const char *data, size_t size) {
+    if (!writer || !writer->file) return 0;
+    if (fwrite(data, 1, size, writer->file) != size) {
+        fclose(writer->file);
+        unlink(writer->temp);
+        writer->file = NULL;
+        return 0;
+    }
+    writer->size += size;
+    return 1;
+}
+
+char *cache_writer_read(CacheWriter *writer, size_t *size) {
+    if (!writer || !writer->file || fflush(writer->file) != 0) return NULL;
+
+    char *body = malloc(writer->size + 1);
+    if (!body) return NULL;
+    if (fseek(writer->file, writer->body_offset, SEEK_SET) != 0 ||
+        fread(body, 1, writer->size, writer->file) != writer->size ||
+        fseek(writer->file, 0, SEEK_END) != 0) {
+        free(body);
+        return NULL;
+    }
+    body[writer->size] = '\0';
+    *size = writer->size;
+    return body;
+}
+
+void cache_writer_close(CacheWriter *writer, long status, double fetched_at) {
+    if (!writer) return;
+
+    if (writer->file) {
+        int ok = status == 200 && fetched_at >= invalidated_at(writer->group) &&
+                 fseek(writer->file, 0, SEEK_SET) == 0 &&
+                 fprintf(writer->file, CACHE_HEADER_FORMAT, fetched_at, status, writer->size) > 0;
+        ok = fclose(writer->file) == 0 && ok;
+        if (!ok || rename(writer->temp, writer->path) != 0) unlink(writer->temp);
+    }
+    free(writer);
+}
+
+void cache_invalidate_url(const char *url) {
+    if (!cache_any_enabled()) return;
+
+    char group[CACHE_GROUP_SIZE];
+    url_group(url, group);
+    drop_memory_entries(NULL, group);
+    if (!make_group_dir(group)) return;
+
+    // The marker also rejects responses other processes are still fetching
+    char dir[CACHE_PATH_SIZE];
+    char marker[CACHE_PATH_SIZE + 32];
+    char text[32];
+    group_dir(group, dir, sizeof(dir));
+    snprintf(marker, sizeof(marker), "%s/" INVALIDATED_FILE, dir);
+    int length = snprintf(text, sizeof(text), "%.6f\n", cache_clock());
+    write_entry(marker, NULL, 0, 0, text, (size_t)length);
+
+    DIR *entries = opendir(dir);
+    if (!entries) return;
+    struct dirent *entry;
+    while ((entry = readdir(entries))) {
+        if (entry->d_name[0] == '.' || strstr(entry->d_name, ".lock") || strstr(entry->d_name, ".tmp.")) continue;
+        char path[CACHE_PATH_SIZE + 256];
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(entries);
+}
+
+int cache_lock(const char *url, int wait) {
+    if (!cache_enabled_for(url)) return -1;
+
+    char group[CACHE_GROUP_SIZE];
+    char path[CACHE_PATH_SIZE + 8];
+    url_group(url, group);
+    if (!make_group_dir(group)) return -1;
+    entry_path(url, path, CACHE_PATH_SIZE);
+    strcat(path, ".lock");
+
+    int lock = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock < 0) return -1;
+    if (flock(lock, wait ? LOCK_EX : LOCK_EX | LOCK_NB) != 0) {
+        int busy = errno == EWOULDBLOCK;
+        close(lock);
+        return busy ? CACHE_LOCK_BUSY : -1;
+    }
+    return lock;
+}
+
+void cache_unlock(int lock) {
+    if (lock < 0) return;
+    flock(lock, LOCK_UN);
+    close(lock);
+}
@@ -0,0 +1,70 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DEFAULT_CACHE_DIR ".cache" // Where cached responses are kept, relative to the working directory
+#define DEFAULT_CACHE_MEMORY 16    // Megabytes of responses also kept in memory
+
+// Read-through cache of GET responses, read from the configuration file.
+// Entries live in CACHE_DIR/<zone_id>/ (CACHE_DIR/_/ for account-wide URLs)
+// and are dropped whenever a write goes to the same zone.
+extern int CACHE_TTL;         // Seconds a response is reused, 0 to disable the cache (default)
+extern int CACHE_ZONES_TTL;   // Overrides CACHE_TTL for zone listings and details, -1 to inherit
+extern int CACHE_RECORDS_TTL; // Overrides CACHE_TTL for dns_records listings, -1 to inherit
+extern char CACHE_DIR[256];
+extern int CACHE_MEMORY;      // Megabytes kept in memory besides the disk copy, 0 for disk only
+
+// A cache entry being written as its body streams in (opaque)
+typedef struct cache_writer CacheWriter;
+
+// Function to set the credentials the cache is scoped to, so accounts sharing
+// a CACHE_DIR never see each other's responses. Called by http_init.
+void cache_init(const char *api_key);
+
+// Returns 1 if responses to url are cached at all
+int cache_enabled_for(const char *url);
+
+// Function to hash a URL (64-bit FNV-1a)
+uint64_t cache_hash(const char *url);
+
+// Wall-clock time in seconds, comparable across processes
+double cache_clock(void);
+
+// Function to find a fresh response for url, in memory first and then on disk.
+// Returns 1 with a NUL-terminated copy of the body (caller frees), 0 on a miss.
+int cache_lookup(const char *url, char **body, size_t *size, long *status);
+
+// Function to store a response fetched by a request that started at fetched_at.
+// Only 200 responses are kept.
+void cache_store(const char *url, double fetched_at, long status, const char *body, size_t size);
+
+// Function to start writing an entry for a streamed response.
+// Returns NULL if url is not cached or the entry could not be created.
+CacheWriter *cache_writer_open(const char *url);
+
+// Append streamed bytes. Returns 1 on success; after a failure the entry is discarded.
+int cache_writer_write(CacheWriter *writer, const char *data, size_t size);
+
+// Read back everything written so far (caller frees), or NULL on failure
+char *cache_writer_read(CacheWriter *writer, size_t *size);
+
+// Publish the entry if status is 200, otherwise discard it, then free the writer
+void cache_writer_close(CacheWriter *writer, long status, double fetched_at);
+
+// Function to drop every cached response of the zone url belongs to,
+// including those other processes are still fetching. Called after each write.
+void cache_invalidate_url(const char *url);
+
+#define CACHE_LOCK_BUSY -2 // cache_lock without wait: another process is fetching the URL
+
+// Function to take an exclusive lock on url's entry, so identical requests
+// across processes fetch only once. With wait set, blocks while another
+// process holds it; otherwise returns CACHE_LOCK_BUSY.
+// Returns a descriptor for cache_unlock, or -1 if no lock was taken.
+int cache_lock(const char *url, int wait);
+
+void cache_unlock(int lock);
+
+#endif
@@ -3,9 +3,29 @@
 # Wrapper for the Cloudflare C Program
 PROGRAM="./cloudflare"  # Path to the compiled C program
 
+# One long-running process serves every menu action, so the configuration,
+# connections and TLS sessions stay warm between commands
+coproc CLOUDFLARE { $PROGRAM serve; }
+
+# Send one command to the running program and print its output
+function run_command() {
+    local line="" arg reply
+    for arg in "$@"; do
+        arg=${arg//\\/\\\\}
+        arg=${arg//\"/\\\"}
+        line+="\"$arg\" "
+    done
+    echo "$line" >&"${CLOUDFLARE[1]}"
+
+    while IFS= read -r reply <&"${CLOUDFLARE[0]}"; do
+        [[ $reply == '{"done":'* ]] && break
+        echo "$reply"
+    done
+}
+
 function list_zones() {
     echo "Fetching zones..."
-    $PROGRAM list_zones
+    run_command list_zones
 }
 
 function add_update_record() {
@@ -23,7 +43,7 @@ function add_update_record() {
     read -r proxied
 
     echo "Adding/Updating record..."
-    $PROGRAM add_update_record "$zone_id" "$record_type" "$record_name" "$record_content" "$ttl" "$proxied"
+    run_command add_update_record "$zone_id" "$record_type" "$record_name" "$record_content" "$ttl" "$proxied"
 }
 
 function delete_record() {
@@ -33,15 +53,22 @@ function delete_record() {
     read -r record_id
 
     echo "Deleting record..."
-    $PROGRAM delete_record "$zone_id" "$record_id"
+    run_command delete_record "$zone_id" "$record_id"
 }
 
 function purge_cache() {
     echo "Enter Zone ID:"
     read -r zone_id
 
+    echo "Enter a file of URLs, host:, prefix: and tag: lines to purge (empty purges everything):"
+    read -r targets
+
     echo "Purging cache..."
-    $PROGRAM purge_cache "$zone_id"
+    if [ -n "$targets" ]; then
+        run_command purge_cache "$zone_id" --from "$targets"
+    else
+        run_command purge_cache "$zone_id"
+    fi
 }
 
 # Main menu
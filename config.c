@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "account.h"
+#include "api.h"
+#include "cache.h"
+#include "config.h"
+#include "http.h"
+#include "metrics.h"
+#include "zone_map.h"
+
+// Global variables for API credentials
+char API_KEY[256] = "";
+char EMAIL[256] = "";
+int MAX_IN_FLIGHT = DEFAULT_MAX_IN_FLIGHT;
+
+// Function to load API key and email from configuration file
+int load_config(config_key_fn extra) {
+    FILE *file = fopen(CONFIG_FILE, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open configuration file: %s\n", CONFIG_FILE);
+        return 0;
+    }
+
+    char line[512];
+    int line_number = 0;
+    int ok = 1;
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *key = strtok(line, "=");
+        char *value = strtok(NULL, "\n");
+
+        if (key && value) {
+            if (strcmp(key, "API_KEY") == 0) {
+                strncpy(API_KEY, value, sizeof(API_KEY) - 1);
+            } else if (strcmp(key, "ACCOUNT") == 0) {
+                ok = account_add(value, line_number) && ok;
+            } else if (strcmp(key, "ZONE") == 0) {
+                ok = account_pin_zone(value, line_number) && ok;
+            } else if (strcmp(key, "API_URL") == 0) {
+                api_set_url(value);
+            } else if (strcmp(key, "EMAIL") == 0) {
+                strncpy(EMAIL, value, sizeof(EMAIL) - 1);
+            } else if (strcmp(key, "MAX_IN_FLIGHT") == 0) {
+                MAX_IN_FLIGHT = atoi(value);
+            } else if (strcmp(key, "ZONE_MAP_JOURNAL") == 0) {
+                ZONE_MAP_JOURNAL_MODE = atoi(value);
+            } else if (strcmp(key, "ZONE_MAP_FORMAT") == 0) {
+                ZONE_MAP_BINARY_MODE = strcmp(value, "binary") == 0;
+            } else if (strcmp(key, "RATE_LIMIT") == 0) {
+                RATE_LIMIT = atoi(value);
+            } else if (strcmp(key, "RATE_WINDOW") == 0) {
+                RATE_WINDOW = atoi(value);
+            } else if (strcmp(key, "RATE_BURST") == 0) {
+                RATE_BURST = atoi(value);
+            } else if (strcmp(key, "RETRY_LIMIT") == 0) {
+                RETRY_LIMIT = atoi(value);
+            } else if (strcmp(key, "METRICS") == 0) {
+                METRICS_FORMAT = metrics_parse_format(value);
+            } else if (strcmp(key, "METRICS_FILE") == 0) {
+                strncpy(METRICS_FILE, value, sizeof(METRICS_FILE) - 1);
+            } else if (strcmp(key, "METRICS_INTERVAL") == 0) {
+                METRICS_INTERVAL = atoi(value);
+            } else if (strcmp(key, "CACHE_TTL") == 0) {
+                CACHE_TTL = atoi(value);
+            } else if (strcmp(key, "CACHE_ZONES_TTL") == 0) {
+                CACHE_ZONES_TTL = atoi(value);
+            } else if (strcmp(key, "CACHE_RECORDS_TTL") == 0) {
+                CACHE_RECORDS_TTL = atoi(value);
+            } else if (strcmp(key, "CACHE_DIR") == 0) {
+                strncpy(CACHE_DIR, value, sizeof(CACHE_DIR) - 1);
+            } else if (strcmp(key, "CACHE_MEMORY") == 0) {
+                CACHE_MEMORY = atoi(value);
+            } else if (extra) {
+                extra(key, value);
+            }
+        }
+    }
+
+    fclose(file);
+
+    // Pins naming unknown accounts are reported by account_finish
+    int accounts_ok = account_finish(API_KEY);
+    if (ACCOUNT_COUNT == 0 || strlen(EMAIL) == 0) {
+        fprintf(stderr, "Error: API_KEY (or an ACCOUNT) and EMAIL must be set in the configuration file.\n");
+        return 0;
+    }
+    if (!accounts_ok || !ok) return 0;
+
+    // Without a default token the first account stands in for it
+    if (strlen(API_KEY) == 0) snprintf(API_KEY, sizeof(API_KEY), "%s", ACCOUNTS[0].api_key);
+
+    return 1;
+}
@@ -0,0 +1,21 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CONFIG_FILE "config.txt" // Configuration file path
+
+// Global variables for API credentials
+extern char API_KEY[256];
+extern char EMAIL[256];
+extern int MAX_IN_FLIGHT; // Concurrent requests for batched and paginated work
+
+// Handles a key that only one binary knows about.
+// Returns 1 if the key was recognised, 0 otherwise.
+typedef int (*config_key_fn)(const char *key, const char *value);
+
+// Function to load the configuration file shared by both binaries: credentials,
+// API URL, rate limiting, metrics and zone map settings. Keys it does not know
+// are passed to extra (which may be NULL).
+// Returns 1 on success, 0 if the file is missing or incomplete.
+int load_config(config_key_fn extra);
+
+#endif
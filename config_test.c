@@ -0,0 +1,88 @@
+// Checks that load_config accepts well-formed ACCOUNT and ZONE lines and rejects
+// malformed ones. Each case writes a config.txt into a scratch directory and
+// loads it in a child process, since the configuration lives in globals.
+//
+//   ./config_test
+//
+// Prints one line per case and exits non-zero if any case fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "account.h"
+#include "config.h"
+
+#define BASE_CONFIG "API_KEY=key\nEMAIL=user@example.com\n"
+
+struct config_case {
+    const char *name;
+    const char *lines; // Appended to BASE_CONFIG
+    int loads;         // 1 if load_config should succeed
+};
+
+static const struct config_case CASES[] = {
+    {"account with key only", "ACCOUNT=ops tok\n", 1},
+    {"account with rate limit", "ACCOUNT=ops tok 1200\n", 1},
+    {"account with rate limit and in flight", "ACCOUNT=ops tok 1200 16\n", 1},
+    {"account missing key", "ACCOUNT=ops\n", 0},
+    {"rate limit not a number", "ACCOUNT=ops tok abc\n", 0},
+    {"rate limit with trailing text", "ACCOUNT=ops tok 12x\n", 0},
+    {"negative rate limit", "ACCOUNT=ops tok -5 0\n", 0},
+    {"zero rate limit", "ACCOUNT=ops tok 0\n", 0},
+    {"zero in flight", "ACCOUNT=ops tok 1200 0\n", 0},
+    {"in flight not a number", "ACCOUNT=ops tok 1200 many\n", 0},
+    {"rate limit out of range", "ACCOUNT=ops tok 99999999999\n", 0},
+    {"trailing token", "ACCOUNT=ops tok 1200 16 extra\n", 0},
+    {"reserved name", "ACCOUNT=default tok\n", 0},
+    {"duplicate name", "ACCOUNT=ops tok\nACCOUNT=ops other\n", 0},
+    {"zone pinned to an account", "ACCOUNT=ops tok\nZONE=0123456789abcdef0123456789abcdef ops\n", 1},
+    {"zone pinned to an unknown account", "ZONE=0123456789abcdef0123456789abcdef shop\n", 0},
+    {"zone missing its account", "ACCOUNT=ops tok\nZONE=0123456789abcdef0123456789abcdef\n", 0},
+};
+
+// Load a configuration in a child process. Returns 1 if it loaded, 0 if not, -1 on a setup error.
+static int load_case(const struct config_case *config_case) {
+    FILE *file = fopen(CONFIG_FILE, "w");
+    if (!file) return -1;
+    fprintf(file, "%s%s", BASE_CONFIG, config_case->lines);
+    fclose(file);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        // Rejections are expected; their messages would only clutter the output
+        if (!freopen("/dev/null", "w", stderr)) _exit(2);
+        _exit(load_config(NULL) ? 0 : 1);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) > 1) return -1;
+    return WEXITSTATUS(status) == 0;
+}
+
+int main(void) {
+    char scratch[] = "/tmp/cloudflare-config-test-XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch) != 0) {
+        fprintf(stderr, "Error: Could not create a scratch directory.\n");
+        return 1;
+    }
+
+    int failures = 0;
+    int count = sizeof(CASES) / sizeof(CASES[0]);
+    for (int i = 0; i < count; i++) {
+        int loaded = load_case(&CASES[i]);
+        int passed = loaded == CASES[i].loads;
+        printf("%s: %s (expected %s)\n", passed ? "ok" : "FAIL", CASES[i].name, CASES[i].loads ? "load" : "reject");
+        if (!passed) failures++;
+    }
+
+    remove(CONFIG_FILE);
+    remove(ZONE_ACCOUNTS_FILE);
+    rmdir(scratch);
+    printf("%d of %d cases passed\n", count - failures, count);
+    return failures > 0;
+}
@@ -0,0 +1,1148 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <curl/curl.h>
+
+#include "account.h"
+#include "cache.h"
+#include "http.h"
+#include "metrics.h"
+
+// Shared state: one share handle (DNS cache, TLS sessions, connections)
+// and one persistent easy handle for the whole process.
+static CURLSH *share = NULL;
+static CURL *curl = NULL;
+static int initialised = 0;
+
+int RATE_LIMIT = 1200; // Cloudflare's global limit: 1200 requests per five minutes
+int RATE_WINDOW = 300;
+int RATE_BURST = 0;
+int RETRY_LIMIT = 4;
+
+#define RETRY_BASE_DELAY 0.5 // Seconds before the first retry; doubles with each attempt
+#define RETRY_MAX_DELAY 30.0 // Longest backoff between two attempts
+
+// Per-token state: its headers and a token bucket shared by every request
+// the process sends with it. The bucket refills at (limit - burst) / RATE_WINDOW
+// tokens per second, so a full burst plus a whole window of refills still fits
+// within the token's limit (RATE_LIMIT unless its ACCOUNT line sets one).
+struct account_state {
+    struct curl_slist *headers; // Content type and this token's Authorization
+    double bucket_rate;         // Tokens per second, 0 when unlimited
+    double bucket_capacity;
+    double bucket_tokens;
+    double bucket_updated;      // When bucket_tokens was last refilled
+    double bucket_reserve;      // Tokens only interactive requests may take
+    double paused_until;        // No request starts before this (set by 429s)
+};
+
+static struct account_state *accounts = NULL;
+static int account_count = 0;
+static int current_account = 0; // Blocking requests that name no known zone go out on this one
+static unsigned int jitter_seed = 0;
+
+// Idle easy handles kept for reuse by batches, so their connections stay warm
+#define HANDLE_POOL_SIZE 64
+static CURL *handle_pool[HANDLE_POOL_SIZE];
+static int handle_pool_size = 0;
+
+#define COALESCE_BUCKETS 256 // Buckets for finding an identical GET already in flight
+#define CACHE_LOCK_POLL 0.05 // Seconds between checks on a GET another process is fetching
+
+// A queued or running batch request
+struct batch_request {
+    char *url;
+    char *key;          // What the cache and coalescing go by (see cache_key), NULL if not cached
+    char method[8];
+    char *payload;
+    http_callback callback;
+    http_stream_callback stream; // Receives the body instead of chunk when set
+    void *userdata;
+    struct memory chunk;
+    CURL *handle;
+    int priority;
+    int account;        // Index of the token the request goes out with
+    int attempts;       // Retries made so far
+    size_t streamed;    // Bytes already handed to stream; such requests cannot be retried
+    double not_before;  // Earliest start time of a scheduled retry
+    int cached;         // GET answered from and stored in the response cache
+    int lock;           // Cache entry lock held while it is fetched, -1 if none
+    double fetched_at;  // Wall-clock start of the current attempt, for the cache
+    CacheWriter *capture;  // Copy of a streamed body on its way into the cache
+    long ready_status;     // Status of a response known without a transfer (cache hit or coalesced)
+    struct batch_request *followers; // Identical GETs waiting for this one's response
+    struct batch_request *same_bucket; // Next GET in flight in the same coalescing bucket
+    struct batch_request *next;
+};
+
+// The requests of one account in a batch. Each account has its own queues,
+// in-flight limit and rate limiter, so accounts never wait on each other.
+struct batch_lane {
+    struct batch_request *queue_head[HTTP_PRIORITIES]; // Ready to start, FIFO per priority
+    struct batch_request *queue_tail[HTTP_PRIORITIES];
+    int running;
+    int max_in_flight;
+};
+
+struct http_batch {
+    CURLM *multi;
+    int epoll_fd;  // Sockets curl is waiting on, kept up to date by socket_callback
+    double timer_at; // When curl next wants CURL_SOCKET_TIMEOUT, 0 if it has no timer
+    int running;
+    int priority; // Given to requests as they are added
+    int account;  // Given to requests whose URL names no zone of a known account
+    struct batch_lane *lanes; // One per account
+    int lane_count;
+    struct batch_request *waiting; // Retries whose backoff has not yet elapsed
+    struct batch_request *active;  // Currently on the multi handle
+    double wake_at;                // When the rate limiter next has a token, 0 if not waiting
+    struct batch_request *fetching[COALESCE_BUCKETS]; // Cached GETs in flight, by URL hash
+    struct batch_request *ready_head; // Answered without a transfer, waiting for their callback
+    struct batch_request *ready_tail;
+};
+
+#define INITIAL_RESPONSE_CAPACITY 16384 // First allocation when the length is unknown
+#define EPOLL_BATCH_EVENTS 64            // Socket events handled per epoll_wait
+
+// Monotonic clock in seconds
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void sleep_seconds(double seconds) {
+    if (seconds <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+// Size a token bucket for limit requests per RATE_WINDOW and fill it
+static void init_rate_limiter(struct account_state *state, int limit) {
+    if (limit <= 0 || RATE_WINDOW <= 0) {
+        state->bucket_rate = 0;
+        return;
+    }
+
+    int burst = RATE_BURST > 0 ? RATE_BURST : limit / 12;
+    if (burst < 1) burst = 1;
+    if (burst >= limit) burst = limit > 1 ? limit - 1 : 1;
+
+    state->bucket_rate = (double)(limit - burst) / RATE_WINDOW;
+    if (state->bucket_rate <= 0) state->bucket_rate = (double)limit / RATE_WINDOW;
+    state->bucket_capacity = burst;
+    state->bucket_tokens = burst;
+    state->bucket_reserve = (double)(burst / 4);
+    state->bucket_updated = now_seconds();
+}
+
+// Take a rate-limit token of an account for a request of the given priority.
+// Returns 0 if one was taken, otherwise the seconds until one will be available.
+static double take_token(struct account_state *state, int priority) {
+    double now = now_seconds();
+    if (now < state->paused_until) return state->paused_until - now;
+    if (state->bucket_rate <= 0) return 0;
+
+    state->bucket_tokens += (now - state->bucket_updated) * state->bucket_rate;
+    if (state->bucket_tokens > state->bucket_capacity) state->bucket_tokens = state->bucket_capacity;
+    state->bucket_updated = now;
+
+    double needed = 1 + (priority == HTTP_PRIORITY_BULK ? state->bucket_reserve : 0);
+    if (state->bucket_tokens >= needed) {
+        state->bucket_tokens -= 1;
+        return 0;
+    }
+    return (needed - state->bucket_tokens) / state->bucket_rate;
+}
+
+// Block until a token for an interactive request is available
+static void wait_for_token(struct account_state *state) {
+    double delay;
+    while ((delay = take_token(state, HTTP_PRIORITY_INTERACTIVE)) > 0) {
+        sleep_seconds(delay);
+    }
+}
+
+// The account a request to url goes out on: the one its zone belongs to,
+// else fallback
+static int route_account(const char *url, int fallback) {
+    int account = account_for_url(url);
+    if (account < 0 || account >= account_count) account = fallback;
+    return account >= 0 && account < account_count ? account : 0;
+}
+
+// The key a request is cached and coalesced under (caller frees): the URL for
+// the first account, tagged with the account's name for the others so tokens
+// never see each other's listings. The fragment is never sent.
+static char *cache_key(const char *url, int account) {
+    if (account == 0 || account >= ACCOUNT_COUNT) return strdup(url);
+
+    size_t size = strlen(url) + strlen(ACCOUNTS[account].name) + 2;
+    char *key = malloc(size);
+    if (key) snprintf(key, size, "%s#%s", url, ACCOUNTS[account].name);
+    return key;
+}
+
+// Requests that can be repeated without changing the outcome. Every PATCH this
+// client sends sets fields to absolute values, so it is safe to repeat too.
+// POST creates records, except a cache purge, which only asks for the cache
+// to be emptied and can be asked again.
+static int is_idempotent(const char *method, const char *url) {
+    if (strcmp(method, "POST") != 0) return 1;
+    const char *path_end = url + strcspn(url, "?#");
+    size_t suffix = strlen("/purge_cache");
+    return path_end - url >= (ptrdiff_t)suffix && strncmp(path_end - suffix, "/purge_cache", suffix) == 0;
+}
+
+// Retry-worthy server errors; the request may or may not have been applied
+static int is_server_error(long status) {
+    return status == 500 || status == 502 || status == 503 || status == 504;
+}
+
+// A transfer that failed before the request could reach the server
+static int never_sent(CURLcode result) {
+    return result == CURLE_COULDNT_RESOLVE_HOST || result == CURLE_COULDNT_CONNECT;
+}
+
+// Exponential backoff with jitter: between half and all of the doubled delay
+static double backoff_delay(int attempt) {
+    double delay = RETRY_BASE_DELAY;
+    for (int i = 0; i < attempt && delay < RETRY_MAX_DELAY; i++) delay *= 2;
+    if (delay > RETRY_MAX_DELAY) delay = RETRY_MAX_DELAY;
+    return delay / 2 + (delay / 2) * ((double)rand_r(&jitter_seed) / RAND_MAX);
+}
+
+// Decide whether a finished attempt should be repeated.
+// Returns the seconds to wait before the next attempt, or -1 to give up.
+static double retry_delay(struct account_state *state, CURL *handle, const char *method, const char *url,
+                          CURLcode result, long status, int attempt) {
+    if (attempt >= RETRY_LIMIT) return -1;
+
+    if (result == CURLE_OK && status == 429) {
+        // The request was rejected unprocessed; hold back the token's requests until the server allows more
+        curl_off_t retry_after = 0;
+        curl_easy_getinfo(handle, CURLINFO_RETRY_AFTER, &retry_after);
+        double delay = retry_after > 0 ? (double)retry_after : backoff_delay(attempt);
+        double until = now_seconds() + delay;
+        if (until > state->paused_until) state->paused_until = until;
+        state->bucket_tokens = 0;
+        return delay;
+    }
+
+    // A write error means the response was refused locally, which a retry would not fix
+    if (result == CURLE_OK ? is_server_error(status) && is_idempotent(method, url)
+                           : result != CURLE_WRITE_ERROR && (is_idempotent(method, url) || never_sent(result))) {
+        return backoff_delay(attempt);
+    }
+    return -1;
+}
+
+// Hand curl's timings of a finished attempt to the metrics
+static void record_attempt(CURL *handle, const char *method, const char *url, CURLcode result, long status) {
+    if (METRICS_FORMAT == METRICS_OFF) return;
+
+    curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0, bytes = 0;
+    long connects = 0;
+    curl_easy_getinfo(handle, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(handle, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(handle, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(handle, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME_T, &total);
+    curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects);
+
+    // curl reports each phase as microseconds since the start of the transfer
+    MetricsTransfer transfer;
+    transfer.dns = dns / 1e6;
+    transfer.connect = connect > dns ? (connect - dns) / 1e6 : 0;
+    transfer.tls = tls > connect ? (tls - connect) / 1e6 : 0;
+    transfer.ttfb = ttfb / 1e6;
+    transfer.total = total / 1e6;
+    transfer.bytes = (double)bytes;
+    transfer.new_connection = connects > 0;
+    metrics_record_transfer(method, url, result == CURLE_OK ? status : 0, &transfer);
+}
+
+static void report_retry(const char *method, const char *url, CURLcode result, long status, double delay) {
+    metrics_record_retry(method, url);
+    if (result == CURLE_OK) {
+        fprintf(stderr, "Retrying %s %s in %.1fs (HTTP %ld)\n", method, url, delay, status);
+    } else {
+        fprintf(stderr, "Retrying %s %s in %.1fs (%s)\n", method, url, delay, curl_easy_strerror(result));
+    }
+}
+
+size_t http_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct memory *mem = (struct memory *)userp;
+
+    if (mem->size + realsize + 1 > mem->capacity) {
+        size_t capacity = mem->capacity;
+
+        // Size the first allocation from Content-Length so most bodies never move
+        if (capacity == 0) {
+            curl_off_t length = -1;
+            if (mem->handle) {
+                curl_easy_getinfo((CURL *)mem->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+            }
+            capacity = length > 0 ? (size_t)length + 1 : INITIAL_RESPONSE_CAPACITY;
+        }
+        while (capacity < mem->size + realsize + 1) capacity *= 2;
+
+        char *ptr = realloc(mem->response, capacity);
+        if (ptr == NULL) return 0; // Out of memory
+
+        mem->response = ptr;
+        mem->capacity = capacity;
+    }
+
+    memcpy(&(mem->response[mem->size]), contents, realsize);
+    mem->size += realsize;
+    mem->response[mem->size] = '\0';
+
+    return realsize;
+}
+
+// Write callback for streamed batch requests: hand the bytes straight on
+static size_t stream_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    struct batch_request *req = (struct batch_request *)userp;
+
+    // Error bodies of responses that will be retried never reach the stream
+    long status = 0;
+    curl_easy_getinfo(req->handle, CURLINFO_RESPONSE_CODE, &status);
+    if (status == 429 || is_server_error(status)) return realsize;
+
+    if (!req->stream((const char *)contents, realsize, req->userdata)) return 0;
+    req->streamed += realsize;
+    if (req->capture && !cache_writer_write(req->capture, (const char *)contents, realsize)) {
+        cache_writer_close(req->capture, 0, 0);
+        req->capture = NULL;
+    }
+    return realsize;
+}
+
+// Apply the options every handle shares: cache, keep-alive and HTTP/2.
+// Headers are set per request, as they depend on the account.
+static void configure_handle(CURL *handle) {
+    curl_easy_setopt(handle, CURLOPT_SHARE, share);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, http_write_callback);
+    curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(handle, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+}
+
+// Set the method-specific options, clearing whatever the previous request left behind
+static void apply_method(CURL *handle, const char *method, const char *payload) {
+    curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, NULL);
+    curl_easy_setopt(handle, CURLOPT_HTTPGET, 1L);
+
+    if (strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0 || strcmp(method, "PATCH") == 0) {
+        curl_easy_setopt(handle, CURLOPT_POSTFIELDS, payload ? payload : "");
+        if (strcmp(method, "POST") != 0) {
+            curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, method);
+        }
+    } else if (strcmp(method, "DELETE") == 0) {
+        curl_easy_setopt(handle, CURLOPT_CUSTOMREQUEST, "DELETE");
+    }
+}
+
+// Take an easy handle from the pool, or create a configured one
+static CURL *acquire_handle(void) {
+    if (handle_pool_size > 0) {
+        return handle_pool[--handle_pool_size];
+    }
+
+    CURL *handle = curl_easy_init();
+    if (handle) {
+        configure_handle(handle);
+    }
+    return handle;
+}
+
+// Return an easy handle to the pool, or free it if the pool is full
+static void release_handle(CURL *handle) {
+    if (handle_pool_size < HANDLE_POOL_SIZE) {
+        handle_pool[handle_pool_size++] = handle;
+    } else {
+        curl_easy_cleanup(handle);
+    }
+}
+
+static void free_batch_request(struct batch_request *req) {
+    while (req->followers) {
+        struct batch_request *follower = req->followers;
+        req->followers = follower->next;
+        free_batch_request(follower);
+    }
+    cache_writer_close(req->capture, 0, 0);
+    cache_unlock(req->lock);
+    free(req->url);
+    free(req->key);
+    free(req->payload);
+    free(req->chunk.response);
+    free(req);
+}
+
+int http_init(const char *api_key) {
+    if (initialised) return 1;
+
+    if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+        fprintf(stderr, "Error: curl_global_init() failed.\n");
+        return 0;
+    }
+    initialised = 1;
+    atexit(http_cleanup);
+
+    jitter_seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    cache_init(api_key);
+
+    share = curl_share_init();
+    if (!share) {
+        fprintf(stderr, "Error: curl_share_init() failed.\n");
+        return 0;
+    }
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+    // Account 0 uses api_key; the others come from the ACCOUNT lines
+    account_count = ACCOUNT_COUNT > 0 ? ACCOUNT_COUNT : 1;
+    accounts = calloc(account_count, sizeof(struct account_state));
+    if (!accounts) {
+        account_count = 0;
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+
+    // Headers are identical for every call with a token, so build them once
+    for (int i = 0; i < account_count; i++) {
+        struct account_state *state = &accounts[i];
+        const char *key = i == 0 ? api_key : ACCOUNTS[i].api_key;
+        int limit = i < ACCOUNT_COUNT && ACCOUNTS[i].rate_limit > 0 ? ACCOUNTS[i].rate_limit : RATE_LIMIT;
+
+        char auth_header[320];
+        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", key);
+        state->headers = curl_slist_append(state->headers, "Content-Type: application/json");
+        state->headers = curl_slist_append(state->headers, "Accept: application/json");
+        state->headers = curl_slist_append(state->headers, auth_header);
+        if (!state->headers) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return 0;
+        }
+        init_rate_limiter(state, limit);
+    }
+
+    curl = curl_easy_init();
+    if (!curl) {
+        fprintf(stderr, "Error: curl_easy_init() failed.\n");
+        return 0;
+    }
+    configure_handle(curl);
+
+    return 1;
+}
+
+int http_perform(const char *url, const char *method, const char *payload, HttpResponse *response) {
+    response->body = NULL;
+    response->size = 0;
+    response->status = 0;
+
+    if (!curl) {
+        fprintf(stderr, "Error: HTTP client not initialised.\n");
+        return 0;
+    }
+
+    int account = route_account(url, current_account);
+    struct account_state *state = &accounts[account];
+
+    // Cached GETs are answered locally; otherwise the entry is locked while it
+    // is fetched, so identical requests from other processes wait for this one
+    int is_get = strcmp(method, "GET") == 0;
+    int lock = -1;
+    char *key = NULL;
+    if (is_get && cache_enabled_for(url) && (key = cache_key(url, account))) {
+        if (cache_lookup(key, &response->body, &response->size, &response->status)) {
+            free(key);
+            return 1;
+        }
+        lock = cache_lock(key, 1);
+        if (cache_lookup(key, &response->body, &response->size, &response->status)) {
+            cache_unlock(lock);
+            free(key);
+            return 1;
+        }
+    }
+
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, state->headers);
+    apply_method(curl, method, payload);
+
+    for (int attempt = 0;; attempt++) {
+        struct memory chunk = {NULL, 0, 0, curl};
+        long status = 0;
+
+        wait_for_token(state);
+        double fetched_at = cache_clock();
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
+        CURLcode res = curl_easy_perform(curl);
+        if (res == CURLE_OK) curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+        record_attempt(curl, method, url, res, status);
+
+        double delay = retry_delay(state, curl, method, url, res, status, attempt);
+        if (delay >= 0) {
+            report_retry(method, url, res, status, delay);
+            free(chunk.response);
+            sleep_seconds(delay);
+            continue;
+        }
+
+        // A write may have changed the zone even if its response never arrived
+        if (!is_get) cache_invalidate_url(url);
+
+        if (res != CURLE_OK) {
+            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+            free(chunk.response);
+            cache_unlock(lock);
+            free(key);
+            return 0;
+        }
+
+        if (key) cache_store(key, fetched_at, status, chunk.response, chunk.size);
+        cache_unlock(lock);
+        free(key);
+
+        response->status = status;
+        response->body = chunk.response;
+        response->size = chunk.size;
+        return 1;
+    }
+}
+
+char *http_request(const char *url, const char *method, const char *payload) {
+    HttpResponse response;
+    http_perform(url, method, payload, &response);
+    return response.body;
+}
+
+int http_account_count(void) {
+    return account_count > 0 ? account_count : 1;
+}
+
+void http_use_account(int account) {
+    if (account >= 0 && account < account_count) current_account = account;
+}
+
+// Socket callback for curl_multi: mirror the sockets curl waits on in the batch's epoll set
+static int socket_callback(CURL *easy, curl_socket_t socket, int what, void *userp, void *socketp) {
+    (void)easy;
+    (void)socketp;
+    HttpBatch *batch = (HttpBatch *)userp;
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(batch->epoll_fd, EPOLL_CTL_DEL, socket, NULL);
+        return 0;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.data.fd = socket;
+    if (what & CURL_POLL_IN) event.events |= EPOLLIN;
+    if (what & CURL_POLL_OUT) event.events |= EPOLLOUT;
+    if (epoll_ctl(batch->epoll_fd, EPOLL_CTL_MOD, socket, &event) != 0 && errno == ENOENT) {
+        epoll_ctl(batch->epoll_fd, EPOLL_CTL_ADD, socket, &event);
+    }
+    return 0;
+}
+
+// Timer callback for curl_multi: remember when curl wants to be called back
+static int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    (void)multi;
+    HttpBatch *batch = (HttpBatch *)userp;
+    batch->timer_at = timeout_ms < 0 ? 0 : now_seconds() + timeout_ms / 1000.0;
+    return 0;
+}
+
+HttpBatch *http_batch_create(int max_in_flight) {
+    HttpBatch *batch = calloc(1, sizeof(HttpBatch));
+    if (!batch) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+
+    batch->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (batch->epoll_fd < 0) {
+        fprintf(stderr, "Error: epoll_create1() failed: %s\n", strerror(errno));
+        free(batch);
+        return NULL;
+    }
+
+    batch->multi = curl_multi_init();
+    if (!batch->multi) {
+        fprintf(stderr, "Error: curl_multi_init() failed.\n");
+        close(batch->epoll_fd);
+        free(batch);
+        return NULL;
+    }
+
+    // Every account gets the batch's limit unless its ACCOUNT line sets its own
+    batch->lane_count = account_count > 0 ? account_count : 1;
+    batch->lanes = calloc(batch->lane_count, sizeof(struct batch_lane));
+    if (!batch->lanes) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        curl_multi_cleanup(batch->multi);
+        close(batch->epoll_fd);
+        free(batch);
+        return NULL;
+    }
+    for (int i = 0; i < batch->lane_count; i++) {
+        int limit = i < ACCOUNT_COUNT ? ACCOUNTS[i].max_in_flight : 0;
+        if (limit <= 0) limit = max_in_flight > 0 ? max_in_flight : DEFAULT_MAX_IN_FLIGHT;
+        batch->lanes[i].max_in_flight = limit;
+    }
+
+    curl_multi_setopt(batch->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    curl_multi_setopt(batch->multi, CURLMOPT_MAX_HOST_CONNECTIONS, (long)http_batch_capacity(batch));
+    curl_multi_setopt(batch->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(batch->multi, CURLMOPT_SOCKETDATA, (void *)batch);
+    curl_multi_setopt(batch->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(batch->multi, CURLMOPT_TIMERDATA, (void *)batch);
+
+    return batch;
+}
+
+void http_batch_set_priority(HttpBatch *batch, int priority) {
+    if (batch && priority >= 0 && priority < HTTP_PRIORITIES) batch->priority = priority;
+}
+
+void http_batch_set_account(HttpBatch *batch, int account) {
+    if (batch && account >= 0 && account < batch->lane_count) batch->account = account;
+}
+
+int http_batch_account(const HttpBatch *batch) {
+    return batch ? batch->account : 0;
+}
+
+int http_batch_capacity(const HttpBatch *batch) {
+    int capacity = 0;
+    for (int i = 0; batch && i < batch->lane_count; i++) capacity += batch->lanes[i].max_in_flight;
+    return capacity;
+}
+
+int http_batch_add(HttpBatch *batch, const char *url, const char *method, const char *payload,
+                   http_callback callback, void *userdata) {
+    return http_batch_add_stream(batch, url, method, payload, NULL, callback, userdata);
+}
+
+// Queue a request whose response is already known, to be delivered on the next step
+static void push_ready(HttpBatch *batch, struct batch_request *req) {
+    req->next = NULL;
+    if (batch->ready_tail) {
+        batch->ready_tail->next = req;
+    } else {
+        batch->ready_head = req;
+    }
+    batch->ready_tail = req;
+}
+
+int http_batch_add_stream(HttpBatch *batch, const char *url, const char *method, const char *payload,
+                          http_stream_callback stream, http_callback callback, void *userdata) {
+    if (!batch || !url || !method) return 0;
+
+    struct batch_request *req = calloc(1, sizeof(struct batch_request));
+    if (!req) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    req->lock = -1;
+
+    req->url = strdup(url);
+    req->payload = payload ? strdup(payload) : NULL;
+    if (!req->url || (payload && !req->payload)) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free_batch_request(req);
+        return 0;
+    }
+    strncpy(req->method, method, sizeof(req->method) - 1);
+    req->callback = callback;
+    req->stream = stream;
+    req->userdata = userdata;
+    req->priority = batch->priority;
+    req->account = route_account(url, batch->account);
+    if (req->account >= batch->lane_count) req->account = 0;
+
+    if (strcmp(method, "GET") == 0 && cache_enabled_for(url)) {
+        req->key = cache_key(url, req->account);
+        if (!req->key) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            free_batch_request(req);
+            return 0;
+        }
+
+        // A fresh cached response is delivered on the next step without a transfer
+        if (cache_lookup(req->key, &req->chunk.response, &req->chunk.size, &req->ready_status)) {
+            push_ready(batch, req);
+            return 1;
+        }
+
+        // An identical GET already in flight with the same token answers this one too
+        struct batch_request **bucket = &batch->fetching[cache_hash(req->key) % COALESCE_BUCKETS];
+        for (struct batch_request *leader = *bucket; leader; leader = leader->same_bucket) {
+            if (strcmp(leader->key, req->key) == 0) {
+                req->next = leader->followers;
+                leader->followers = req;
+                return 1;
+            }
+        }
+
+        req->cached = 1;
+        req->same_bucket = *bucket;
+        *bucket = req;
+    }
+
+    struct batch_lane *lane = &batch->lanes[req->account];
+    if (lane->queue_tail[req->priority]) {
+        lane->queue_tail[req->priority]->next = req;
+    } else {
+        lane->queue_head[req->priority] = req;
+    }
+    lane->queue_tail[req->priority] = req;
+
+    return 1;
+}
+
+// Highest-priority request of an account that is ready to start, or NULL
+static struct batch_request *next_queued(const struct batch_lane *lane) {
+    for (int p = 0; p < HTTP_PRIORITIES; p++) {
+        if (lane->queue_head[p]) return lane->queue_head[p];
+    }
+    return NULL;
+}
+
+// Returns 1 if any account has a request ready to start
+static int any_queued(const HttpBatch *batch) {
+    for (int i = 0; i < batch->lane_count; i++) {
+        if (next_queued(&batch->lanes[i])) return 1;
+    }
+    return 0;
+}
+
+// Take the request at the head of its queue off it
+static void dequeue(HttpBatch *batch, struct batch_request *req) {
+    struct batch_lane *lane = &batch->lanes[req->account];
+    lane->queue_head[req->priority] = req->next;
+    if (!lane->queue_head[req->priority]) lane->queue_tail[req->priority] = NULL;
+}
+
+// Put retries whose backoff has elapsed back at the front of their queue
+static void promote_waiting(HttpBatch *batch) {
+    double now = now_seconds();
+    struct batch_request **link = &batch->waiting;
+
+    while (*link) {
+        struct batch_request *req = *link;
+        if (req->not_before > now) {
+            link = &req->next;
+            continue;
+        }
+
+        *link = req->next;
+        struct batch_lane *lane = &batch->lanes[req->account];
+        req->next = lane->queue_head[req->priority];
+        lane->queue_head[req->priority] = req;
+        if (!lane->queue_tail[req->priority]) lane->queue_tail[req->priority] = req;
+    }
+}
+
+// Remove a cached GET from the requests identical ones can follow
+static void unlink_fetching(HttpBatch *batch, struct batch_request *req) {
+    struct batch_request **link = &batch->fetching[cache_hash(req->key) % COALESCE_BUCKETS];
+    while (*link && *link != req) link = &(*link)->same_bucket;
+    if (*link) *link = req->same_bucket;
+}
+
+// Queue the requests that followed req with copies of body (which they take
+// over). Followers without a copy see the transfer as failed.
+static void answer_followers(HttpBatch *batch, struct batch_request *req, char *body, size_t size, long status) {
+    while (req->followers) {
+        struct batch_request *follower = req->followers;
+        req->followers = follower->next;
+        if (!req->followers) {
+            follower->chunk.response = body; // The last one takes the copy itself
+            body = NULL;
+        } else if (body && (follower->chunk.response = malloc(size + 1))) {
+            memcpy(follower->chunk.response, body, size + 1);
+        }
+        follower->chunk.size = follower->chunk.response ? size : 0;
+        follower->ready_status = follower->chunk.response ? status : 0;
+        push_ready(batch, follower);
+    }
+    free(body);
+}
+
+static char *copy_response(const struct memory *chunk) {
+    char *copy = malloc(chunk->size + 1);
+    if (copy) memcpy(copy, chunk->response, chunk->size + 1);
+    return copy;
+}
+
+// Before a cached GET goes out, check whether another process has just
+// fetched it or is fetching it now. Returns 1 to send it; otherwise the
+// request, taken off the head of its queue, has been answered from the
+// cache or set aside until the other process is done.
+static int claim_cached(HttpBatch *batch, struct batch_request *req) {
+    int hit = cache_lookup(req->key, &req->chunk.response, &req->chunk.size, &req->ready_status);
+    if (!hit) {
+        int lock = cache_lock(req->key, 0);
+        if (lock != CACHE_LOCK_BUSY) {
+            hit = lock >= 0 && cache_lookup(req->key, &req->chunk.response, &req->chunk.size, &req->ready_status);
+            if (!hit) {
+                req->lock = lock;
+                return 1;
+            }
+            cache_unlock(lock);
+        }
+    }
+
+    dequeue(batch, req);
+
+    if (hit) {
+        unlink_fetching(batch, req);
+        answer_followers(batch, req, req->followers ? copy_response(&req->chunk) : NULL, req->chunk.size,
+                         req->ready_status);
+        push_ready(batch, req);
+    } else {
+        req->not_before = now_seconds() + CACHE_LOCK_POLL;
+        req->next = batch->waiting;
+        batch->waiting = req;
+    }
+    return 0;
+}
+
+// Move queued requests onto the multi handle until each account reaches its
+// in-flight limit or its rate limiter runs out of tokens
+static void start_queued(HttpBatch *batch) {
+    promote_waiting(batch);
+    batch->wake_at = 0;
+
+    for (int i = 0; i < batch->lane_count; i++) {
+        struct batch_lane *lane = &batch->lanes[i];
+        struct batch_request *req;
+        while ((req = next_queued(lane)) && lane->running < lane->max_in_flight) {
+            if (req->cached && req->lock < 0 && !claim_cached(batch, req)) continue;
+
+            double delay = take_token(&accounts[i], req->priority);
+            if (delay > 0) {
+                double wake_at = now_seconds() + delay;
+                if (batch->wake_at == 0 || wake_at < batch->wake_at) batch->wake_at = wake_at;
+                break;
+            }
+
+            dequeue(batch, req);
+            req->next = NULL;
+
+            req->handle = acquire_handle();
+            if (!req->handle) {
+                fprintf(stderr, "Error: curl_easy_init() failed.\n");
+                if (req->callback) req->callback(NULL, 0, req->userdata);
+                free_batch_request(req);
+                continue;
+            }
+
+            req->chunk.handle = req->handle;
+            req->fetched_at = cache_clock();
+            if (req->cached && req->stream && !req->capture) req->capture = cache_writer_open(req->key);
+            curl_easy_setopt(req->handle, CURLOPT_URL, req->url);
+            curl_easy_setopt(req->handle, CURLOPT_HTTPHEADER, accounts[i].headers);
+            if (req->stream) {
+                curl_easy_setopt(req->handle, CURLOPT_WRITEFUNCTION, stream_callback);
+                curl_easy_setopt(req->handle, CURLOPT_WRITEDATA, (void *)req);
+            } else {
+                curl_easy_setopt(req->handle, CURLOPT_WRITEFUNCTION, http_write_callback);
+                curl_easy_setopt(req->handle, CURLOPT_WRITEDATA, (void *)&req->chunk);
+            }
+            curl_easy_setopt(req->handle, CURLOPT_PRIVATE, (void *)req);
+            apply_method(req->handle, req->method, req->payload);
+
+            curl_multi_add_handle(batch->multi, req->handle);
+            req->next = batch->active;
+            batch->active = req;
+            batch->running++;
+            lane->running++;
+        }
+    }
+}
+
+// Store a cached GET's final response and hand copies to the identical
+// requests that waited for it
+static void finish_cached(HttpBatch *batch, struct batch_request *req, long status) {
+    unlink_fetching(batch, req);
+
+    char *body = NULL;
+    size_t size = 0;
+    if (req->stream) {
+        if (req->followers && req->capture) body = cache_writer_read(req->capture, &size);
+        cache_writer_close(req->capture, status, req->fetched_at);
+        req->capture = NULL;
+    } else if (req->chunk.response) {
+        cache_store(req->key, req->fetched_at, status, req->chunk.response, req->chunk.size);
+        if (req->followers) {
+            body = copy_response(&req->chunk);
+            size = req->chunk.size;
+        }
+    }
+    cache_unlock(req->lock);
+    req->lock = -1;
+
+    answer_followers(batch, req, body, size, status);
+}
+
+// Run the callbacks of requests answered without a transfer
+static void finish_ready(HttpBatch *batch) {
+    struct batch_request *req;
+    while ((req = batch->ready_head)) {
+        batch->ready_head = req->next;
+        if (!batch->ready_head) batch->ready_tail = NULL;
+
+        char *response = req->chunk.response;
+        long status = req->ready_status;
+        req->chunk.response = NULL;
+
+        if (req->stream) {
+            // Mirror a live transfer: the body goes to the stream, the callback gets none
+            if (response && req->chunk.size > 0 && status != 429 && !is_server_error(status) &&
+                !req->stream(response, req->chunk.size, req->userdata)) {
+                status = 0;
+            }
+            free(response);
+            response = NULL;
+        }
+
+        if (req->callback) {
+            req->callback(response, status, req->userdata);
+        } else {
+            free(response);
+        }
+        free_batch_request(req);
+    }
+}
+
+// Hand every finished transfer to its callback
+static void finish_completed(HttpBatch *batch) {
+    CURLMsg *msg;
+    int msgs_left;
+
+    while ((msg = curl_multi_info_read(batch->multi, &msgs_left))) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        CURL *handle = msg->easy_handle;
+        struct batch_request *req = NULL;
+        long status = 0;
+        curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&req);
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &status);
+        record_attempt(handle, req->method, req->url, msg->data.result, status);
+
+        double delay = req->streamed > 0 ? -1
+                                         : retry_delay(&accounts[req->account], handle, req->method, req->url,
+                                                       msg->data.result, status, req->attempts);
+
+        if (msg->data.result != CURLE_OK && delay < 0) {
+            fprintf(stderr, "Request to %s failed: %s\n", req->url, curl_easy_strerror(msg->data.result));
+            free(req->chunk.response);
+            req->chunk.response = NULL;
+            if (req->stream) status = 0;
+        }
+
+        curl_multi_remove_handle(batch->multi, handle);
+        release_handle(handle);
+        batch->running--;
+        batch->lanes[req->account].running--;
+
+        struct batch_request **link = &batch->active;
+        while (*link && *link != req) link = &(*link)->next;
+        if (*link) *link = req->next;
+
+        if (delay >= 0) {
+            report_retry(req->method, req->url, msg->data.result, status, delay);
+            free(req->chunk.response);
+            memset(&req->chunk, 0, sizeof(req->chunk));
+            req->handle = NULL;
+            req->attempts++;
+            req->not_before = now_seconds() + delay;
+            req->next = batch->waiting;
+            batch->waiting = req;
+            continue;
+        }
+
+        if (req->cached) {
+            finish_cached(batch, req, status);
+        } else if (strcmp(req->method, "GET") != 0) {
+            cache_invalidate_url(req->url);
+        }
+
+        // The callback owns the response from here on
+        char *response = req->chunk.response;
+        req->chunk.response = NULL;
+        if (req->callback) {
+            req->callback(response, status, req->userdata);
+        } else {
+            free(response);
+        }
+        free_batch_request(req);
+    }
+}
+
+int http_batch_pending(const HttpBatch *batch) {
+    return batch && (batch->running > 0 || any_queued(batch) || batch->waiting || batch->ready_head);
+}
+
+int http_batch_fd(const HttpBatch *batch) {
+    return batch ? batch->epoll_fd : -1;
+}
+
+int http_batch_timeout(const HttpBatch *batch) {
+    if (!http_batch_pending(batch)) return -1;
+    if (batch->ready_head) return 0;
+
+    // The earliest of curl's timer, a free rate-limit token and a due retry
+    double wake = batch->wake_at;
+    if (batch->timer_at > 0 && (wake == 0 || batch->timer_at < wake)) wake = batch->timer_at;
+    for (struct batch_request *req = batch->waiting; req; req = req->next) {
+        if (wake == 0 || req->not_before < wake) wake = req->not_before;
+    }
+    if (wake == 0) return -1;
+
+    double ms = (wake - now_seconds()) * 1000 + 1;
+    return ms > 0 ? (int)ms : 0;
+}
+
+// Let curl act on one socket or, with CURL_SOCKET_TIMEOUT, on its timer
+static int socket_action(HttpBatch *batch, curl_socket_t socket, int mask) {
+    int still_running = 0;
+    CURLMcode mc = curl_multi_socket_action(batch->multi, socket, mask, &still_running);
+    if (mc != CURLM_OK) {
+        fprintf(stderr, "curl_multi_socket_action() failed: %s\n", curl_multi_strerror(mc));
+        return 0;
+    }
+    return 1;
+}
+
+int http_batch_step(HttpBatch *batch, int timeout_ms) {
+    if (!batch) return -1;
+
+    start_queued(batch);
+    finish_ready(batch);
+    if (!http_batch_pending(batch)) return 0;
+
+    int timeout = http_batch_timeout(batch);
+    if (timeout < 0 || (timeout_ms >= 0 && timeout_ms < timeout)) timeout = timeout_ms;
+
+    struct epoll_event events[EPOLL_BATCH_EVENTS];
+    int count = epoll_wait(batch->epoll_fd, events, EPOLL_BATCH_EVENTS, timeout);
+    if (count < 0) {
+        if (errno != EINTR) {
+            fprintf(stderr, "Error: epoll_wait() failed: %s\n", strerror(errno));
+            return -1;
+        }
+        count = 0;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int mask = 0;
+        if (events[i].events & EPOLLIN) mask |= CURL_CSELECT_IN;
+        if (events[i].events & EPOLLOUT) mask |= CURL_CSELECT_OUT;
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) mask |= CURL_CSELECT_ERR;
+        if (!socket_action(batch, events[i].data.fd, mask)) return -1;
+    }
+
+    if (batch->timer_at > 0 && now_seconds() >= batch->timer_at) {
+        batch->timer_at = 0;
+        if (!socket_action(batch, CURL_SOCKET_TIMEOUT, 0)) return -1;
+    }
+
+    finish_completed(batch);
+    finish_ready(batch);
+    start_queued(batch);
+    return http_batch_pending(batch);
+}
+
+int http_batch_run(HttpBatch *batch) {
+    if (!batch) return 0;
+
+    int pending;
+    while ((pending = http_batch_step(batch, 1000)) > 0) {
+    }
+    return pending == 0;
+}
+
+void http_batch_free(HttpBatch *batch) {
+    if (!batch) return;
+
+    // Requests still on the multi handle only exist if run() bailed out
+    while (batch->active) {
+        struct batch_request *req = batch->active;
+        batch->active = req->next;
+        curl_multi_remove_handle(batch->multi, req->handle);
+        curl_easy_cleanup(req->handle);
+        free_batch_request(req);
+    }
+
+    for (int i = 0; i < batch->lane_count; i++) {
+        for (int p = 0; p < HTTP_PRIORITIES; p++) {
+            while (batch->lanes[i].queue_head[p]) {
+                struct batch_request *req = batch->lanes[i].queue_head[p];
+                batch->lanes[i].queue_head[p] = req->next;
+                free_batch_request(req);
+            }
+        }
+    }
+
+    while (batch->waiting) {
+        struct batch_request *req = batch->waiting;
+        batch->waiting = req->next;
+        free_batch_request(req);
+    }
+
+    while (batch->ready_head) {
+        struct batch_request *req = batch->ready_head;
+        batch->ready_head = req->next;
+        free_batch_request(req);
+    }
+
+    curl_multi_cleanup(batch->multi);
+    close(batch->epoll_fd);
+    free(batch->lanes);
+    free(batch);
+}
+
+void http_cleanup(void) {
+    while (handle_pool_size > 0) {
+        curl_easy_cleanup(handle_pool[--handle_pool_size]);
+    }
+    if (curl) {
+        curl_easy_cleanup(curl);
+        curl = NULL;
+    }
+    for (int i = 0; i < account_count; i++) {
+        curl_slist_free_all(accounts[i].headers);
+    }
+    free(accounts);
+    accounts = NULL;
+    account_count = 0;
+    if (share) {
+        curl_share_cleanup(share);
+        share = NULL;
+    }
+    if (initialised) {
+        curl_global_cleanup();
+        initialised = 0;
+    }
+}
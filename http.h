@@ -0,0 +1,138 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <stddef.h>
+
+// Helper structure for holding HTTP response. The buffer grows geometrically
+// and is sized up front from Content-Length when the server sends one.
+struct memory {
+    char *response;
+    size_t size;
+    size_t capacity;
+    void *handle; // CURL handle the response arrives on, used to read Content-Length
+};
+
+// Result of a blocking request
+typedef struct {
+    char *body;    // Response body (caller frees), NULL on transport failure
+    size_t size;
+    long status;   // HTTP status code, 0 if no response arrived
+} HttpResponse;
+
+#define DEFAULT_MAX_IN_FLIGHT 8 // Concurrent requests per batch unless configured otherwise
+
+// Request priorities. Bulk requests never take the last few rate-limit tokens,
+// so interactive commands are not starved behind long-running jobs.
+#define HTTP_PRIORITY_INTERACTIVE 0
+#define HTTP_PRIORITY_BULK        1
+#define HTTP_PRIORITIES           2
+
+// Client-side rate limiting and retries, read from the configuration file
+extern int RATE_LIMIT;  // Requests allowed per RATE_WINDOW seconds, 0 for no limit
+extern int RATE_WINDOW; // Length of the server's rate-limit window in seconds
+extern int RATE_BURST;  // Requests that may be sent back to back, 0 for RATE_LIMIT / 12
+extern int RETRY_LIMIT; // Retries after a 429, a 5xx or a transport failure
+
+// Completion callback for batched requests. Takes ownership of response,
+// which is NULL when the transfer failed. status is the HTTP status code.
+typedef void (*http_callback)(char *response, long status, void *userdata);
+
+// Receives response bytes as they arrive for a streamed batch request.
+// Returns 1 to continue, 0 to abort the transfer.
+typedef int (*http_stream_callback)(const char *data, size_t size, void *userdata);
+
+// libcurl write callback: append the bytes to userp, a struct memory. Public so
+// microbench.c can measure its growth without a transfer; with no handle the
+// buffer starts at INITIAL_RESPONSE_CAPACITY. Returns the bytes taken, 0 when
+// out of memory.
+size_t http_write_callback(void *contents, size_t size, size_t nmemb, void *userp);
+
+// A set of requests run concurrently over curl_multi (opaque)
+typedef struct http_batch HttpBatch;
+
+// Initialise libcurl, the shared DNS/TLS/connection cache and the request headers.
+// Must be called once (after load_config) before any request is made.
+// Returns 1 on success, 0 on failure.
+int http_init(const char *api_key);
+
+// Requests go out with the token of the account their zone belongs to (see
+// account.h). Requests that name no zone of a known account, such as zone
+// listings, use the account chosen with http_use_account or
+// http_batch_set_account, which is account 0 unless set.
+
+// Number of accounts requests can go out on, at least 1
+int http_account_count(void);
+
+// Choose the account for blocking requests that name no known zone
+void http_use_account(int account);
+
+// Perform a blocking interactive request on the persistent connection,
+// waiting for the rate limiter and retrying as configured.
+// Returns 1 if a response arrived, 0 on transport failure.
+int http_perform(const char *url, const char *method, const char *payload, HttpResponse *response);
+
+// Perform a blocking request on the persistent connection.
+// Returns the response body (caller frees) or NULL on transport failure.
+char *http_request(const char *url, const char *method, const char *payload);
+
+// Create a batch that keeps at most max_in_flight transfers running at once per account.
+HttpBatch *http_batch_create(int max_in_flight);
+
+// Set the priority of requests added to the batch from now on (interactive by default)
+void http_batch_set_priority(HttpBatch *batch, int priority);
+
+// Choose the account for requests added to the batch from now on that name no known zone
+void http_batch_set_account(HttpBatch *batch, int account);
+
+// The account http_batch_set_account chose last
+int http_batch_account(const HttpBatch *batch);
+
+// Requests the batch may run at once across all accounts: max_in_flight per
+// account, or the account's own limit when its ACCOUNT line sets one
+int http_batch_capacity(const HttpBatch *batch);
+
+// Queue a request. Callbacks may queue further requests on the same batch.
+// Requests rejected with 429 are retried after Retry-After; idempotent ones
+// are also retried with backoff after a 5xx or a transport failure.
+// Returns 1 on success, 0 on failure.
+int http_batch_add(HttpBatch *batch, const char *url, const char *method, const char *payload,
+                   http_callback callback, void *userdata);
+
+// Queue a request whose body goes to stream instead of being buffered.
+// callback then always receives a NULL response; status is 0 if the transfer failed.
+// Returns 1 on success, 0 on failure.
+int http_batch_add_stream(HttpBatch *batch, const char *url, const char *method, const char *payload,
+                          http_stream_callback stream, http_callback callback, void *userdata);
+
+// Run until every queued request (including ones added by callbacks) has completed.
+// Returns 1 on success, 0 if the event loop failed.
+int http_batch_run(HttpBatch *batch);
+
+// Non-blocking use: requests are submitted with http_batch_add and complete
+// through their callbacks while the caller drives the batch one step at a
+// time, for example from its own poll loop watching http_batch_fd.
+
+// Start what the rate limiter allows, wait at most timeout_ms (-1 for as long
+// as the batch needs, 0 to only collect what is ready) for socket activity,
+// then run the callbacks of finished requests.
+// Returns 1 while requests remain, 0 once all have completed, -1 on failure.
+int http_batch_step(HttpBatch *batch, int timeout_ms);
+
+// Returns 1 while the batch has queued, running or retrying requests
+int http_batch_pending(const HttpBatch *batch);
+
+// The epoll descriptor holding the batch's sockets; it polls readable
+// whenever one of them is ready, so it can be nested in another event loop.
+int http_batch_fd(const HttpBatch *batch);
+
+// Milliseconds until the batch needs a step even without socket activity,
+// or -1 if it only waits on its sockets
+int http_batch_timeout(const HttpBatch *batch);
+
+// Free a batch. Requests that never ran are dropped without calling their callback.
+void http_batch_free(HttpBatch *batch);
+
+// Release every handle created by http_init. Safe to call more than once.
+void http_cleanup(void);
+
+#endif
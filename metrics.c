@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+int METRICS_FORMAT = METRICS_OFF;
+char METRICS_FILE[256] = "";
+int METRICS_INTERVAL = 0;
+
+// Upper bounds of the latency histogram buckets in seconds; a last bucket
+// catches everything slower
+static const double BUCKET_BOUNDS[] = {0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+                                       0.25, 0.5, 1, 2.5, 5, 10};
+#define BUCKET_COUNT (sizeof(BUCKET_BOUNDS) / sizeof(BUCKET_BOUNDS[0]) + 1)
+
+enum phase {
+    PHASE_DNS,
+    PHASE_CONNECT,
+    PHASE_TLS,
+    PHASE_TTFB,
+    PHASE_TOTAL,
+    PHASE_PARSE,
+    PHASES
+};
+
+static const char *const PHASE_NAMES[PHASES] = {"dns", "connect", "tls", "ttfb", "total", "parse"};
+
+struct histogram {
+    long buckets[BUCKET_COUNT];
+    long count;
+    double sum;
+    double min;
+    double max;
+};
+
+// Everything measured for one method and path, with IDs folded into ":id"
+struct endpoint_metrics {
+    char name[160];
+    long requests;
+    long failed;  // Attempts that got no response
+    long status_classes[6]; // 1xx..5xx by first digit, index 0 for anything else
+    long retries;
+    long new_connections;
+    double bytes;
+    struct histogram phases[PHASES];
+};
+
+static struct endpoint_metrics *endpoints = NULL;
+static int endpoint_count = 0;
+static int endpoint_capacity = 0;
+static double started_at = 0;
+static double last_export = 0;
+
+double metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int metrics_parse_format(const char *value) {
+    if (strcmp(value, "json") == 0) return METRICS_JSON;
+    if (strcmp(value, "prometheus") == 0) return METRICS_PROMETHEUS;
+    return METRICS_OFF;
+}
+
+static void export_at_exit(void) {
+    metrics_export();
+}
+
+void metrics_init(void) {
+    if (METRICS_FORMAT == METRICS_OFF || started_at > 0) return;
+    started_at = metrics_now();
+    last_export = started_at;
+    atexit(export_at_exit);
+}
+
+// Returns 1 if segment (of the given length) is a 32-character hex ID
+static int is_id_segment(const char *segment, size_t length) {
+    if (length != 32) return 0;
+    for (size_t i = 0; i < length; i++) {
+        char c = segment[i];
+        if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'))) return 0;
+    }
+    return 1;
+}
+
+// Build the endpoint name "METHOD /path" from a URL, dropping the scheme,
+// host and query and replacing IDs with ":id"
+static void endpoint_name(const char *method, const char *url, char *out, size_t size) {
+    const char *path = strstr(url, "://");
+    path = path ? strchr(path + 3, '/') : url;
+    if (!path) path = "/";
+
+    size_t used = (size_t)snprintf(out, size, "%s ", method);
+    while (*path && *path != '?' && used + 1 < size) {
+        if (*path == '/') {
+            out[used++] = *path++;
+            continue;
+        }
+
+        size_t length = strcspn(path, "/?");
+        const char *segment = path;
+        size_t copy = length;
+        if (is_id_segment(path, length)) {
+            segment = ":id";
+            copy = 3;
+        }
+        if (used + copy >= size) break;
+        memcpy(out + used, segment, copy);
+        used += copy;
+        path += length;
+    }
+    out[used < size ? used : size - 1] = '\0';
+}
+
+static struct endpoint_metrics *find_endpoint(const char *method, const char *url) {
+    char name[160];
+    endpoint_name(method, url, name, sizeof(name));
+
+    for (int i = 0; i < endpoint_count; i++) {
+        if (strcmp(endpoints[i].name, name) == 0) return &endpoints[i];
+    }
+
+    if (endpoint_count == endpoint_capacity) {
+        int capacity = endpoint_capacity ? endpoint_capacity * 2 : 8;
+        struct endpoint_metrics *grown = realloc(endpoints, capacity * sizeof(struct endpoint_metrics));
+        if (!grown) return NULL;
+        endpoints = grown;
+        endpoint_capacity = capacity;
+    }
+
+    struct endpoint_metrics *endpoint = &endpoints[endpoint_count++];
+    memset(endpoint, 0, sizeof(*endpoint));
+    snprintf(endpoint->name, sizeof(endpoint->name), "%s", name);
+    return endpoint;
+}
+
+static void observe(struct histogram *histogram, double seconds) {
+    size_t bucket = 0;
+    while (bucket < BUCKET_COUNT - 1 && seconds > BUCKET_BOUNDS[bucket]) bucket++;
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum += seconds;
+    if (histogram->count == 1 || seconds < histogram->min) histogram->min = seconds;
+    if (seconds > histogram->max) histogram->max = seconds;
+}
+
+// Estimate a quantile by interpolating within the bucket that holds it
+static double quantile(const struct histogram *histogram, double q) {
+    if (histogram->count == 0) return 0;
+
+    double rank = q * (double)histogram->count;
+    long seen = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+        if (histogram->buckets[bucket] == 0 || seen + histogram->buckets[bucket] < rank) {
+            seen += histogram->buckets[bucket];
+            continue;
+        }
+        if (bucket == BUCKET_COUNT - 1) return histogram->max;
+
+        double lower = bucket > 0 ? BUCKET_BOUNDS[bucket - 1] : 0;
+        double upper = BUCKET_BOUNDS[bucket];
+        if (lower < histogram->min) lower = histogram->min;
+        if (upper > histogram->max) upper = histogram->max;
+        double estimate = lower + (upper - lower) * ((rank - seen) / (double)histogram->buckets[bucket]);
+        return estimate > lower ? estimate : lower;
+    }
+    return histogram->max;
+}
+
+void metrics_record_transfer(const char *method, const char *url, long status, const MetricsTransfer *transfer) {
+    if (started_at == 0) return;
+    struct endpoint_metrics *endpoint = find_endpoint(method, url);
+    if (!endpoint) return;
+
+    endpoint->requests++;
+    if (status == 0) {
+        endpoint->failed++;
+    } else {
+        endpoint->status_classes[status >= 100 && status < 600 ? status / 100 : 0]++;
+    }
+    endpoint->bytes += transfer->bytes;
+
+    if (transfer->new_connection) {
+        endpoint->new_connections++;
+        observe(&endpoint->phases[PHASE_DNS], transfer->dns);
+        observe(&endpoint->phases[PHASE_CONNECT], transfer->connect);
+        if (transfer->tls > 0) observe(&endpoint->phases[PHASE_TLS], transfer->tls);
+    }
+    if (status != 0) observe(&endpoint->phases[PHASE_TTFB], transfer->ttfb);
+    observe(&endpoint->phases[PHASE_TOTAL], transfer->total);
+}
+
+void metrics_record_retry(const char *method, const char *url) {
+    if (started_at == 0) return;
+    struct endpoint_metrics *endpoint = find_endpoint(method, url);
+    if (endpoint) endpoint->retries++;
+}
+
+void metrics_record_parse(const char *method, const char *url, double seconds) {
+    if (started_at == 0) return;
+    struct endpoint_metrics *endpoint = find_endpoint(method, url);
+    if (endpoint) observe(&endpoint->phases[PHASE_PARSE], seconds);
+}
+
+// Write a string with the characters JSON and Prometheus labels escape alike
+static void write_escaped(FILE *out, const char *str) {
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') fputc('\\', out);
+        fputc(*str, out);
+    }
+}
+
+static void write_json(FILE *out) {
+    fprintf(out, "{\"metrics\":{\"uptime_seconds\":%.3f,\"endpoints\":[", started_at > 0 ? metrics_now() - started_at : 0);
+    for (int i = 0; i < endpoint_count; i++) {
+        const struct endpoint_metrics *endpoint = &endpoints[i];
+        fprintf(out, "%s{\"endpoint\":\"", i ? "," : "");
+        write_escaped(out, endpoint->name);
+        fprintf(out, "\",\"requests\":%ld,\"failed\":%ld,\"retries\":%ld,\"new_connections\":%ld,"
+                     "\"bytes_received\":%.0f,\"status\":{\"2xx\":%ld,\"3xx\":%ld,\"4xx\":%ld,\"5xx\":%ld}",
+                endpoint->requests, endpoint->failed, endpoint->retries, endpoint->new_connections,
+                endpoint->bytes, endpoint->status_classes[2], endpoint->status_classes[3],
+                endpoint->status_classes[4], endpoint->status_classes[5]);
+
+        for (int p = 0; p < PHASES; p++) {
+            const struct histogram *histogram = &endpoint->phases[p];
+            if (histogram->count == 0) continue;
+            fprintf(out, ",\"%s_ms\":{\"count\":%ld,\"mean\":%.3f,\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}",
+                    PHASE_NAMES[p], histogram->count, histogram->sum * 1000 / histogram->count,
+                    quantile(histogram, 0.50) * 1000, quantile(histogram, 0.90) * 1000,
+                    quantile(histogram, 0.99) * 1000, histogram->max * 1000);
+        }
+        fputc('}', out);
+    }
+    fprintf(out, "]}}\n");
+}
+
+static void write_label(FILE *out, const struct endpoint_metrics *endpoint) {
+    fprintf(out, "{endpoint=\"");
+    write_escaped(out, endpoint->name);
+    fputc('"', out);
+}
+
+static void write_prometheus(FILE *out) {
+    fprintf(out, "# HELP cloudflare_requests_total API request attempts by endpoint and status class.\n"
+                 "# TYPE cloudflare_requests_total counter\n");
+    for (int i = 0; i < endpoint_count; i++) {
+        static const char *const classes[6] = {"error", "1xx", "2xx", "3xx", "4xx", "5xx"};
+        for (int c = 0; c < 6; c++) {
+            long count = c == 0 ? endpoints[i].failed + endpoints[i].status_classes[0] : endpoints[i].status_classes[c];
+            if (count == 0) continue;
+            fputs("cloudflare_requests_total", out);
+            write_label(out, &endpoints[i]);
+            fprintf(out, ",status=\"%s\"} %ld\n", classes[c], count);
+        }
+    }
+
+    static const struct {
+        const char *name;
+        const char *help;
+    } counters[] = {
+        {"cloudflare_request_retries_total", "Attempts that were retried."},
+        {"cloudflare_connections_total", "New connections opened."},
+        {"cloudflare_response_bytes_total", "Response bytes received."},
+    };
+    for (size_t k = 0; k < sizeof(counters) / sizeof(counters[0]); k++) {
+        fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", counters[k].name, counters[k].help, counters[k].name);
+        for (int i = 0; i < endpoint_count; i++) {
+            double value = k == 0 ? endpoints[i].retries : k == 1 ? endpoints[i].new_connections : endpoints[i].bytes;
+            fputs(counters[k].name, out);
+            write_label(out, &endpoints[i]);
+            fprintf(out, "} %.0f\n", value);
+        }
+    }
+
+    fprintf(out, "# HELP cloudflare_request_phase_seconds Time spent in each phase of a request.\n"
+                 "# TYPE cloudflare_request_phase_seconds histogram\n");
+    for (int i = 0; i < endpoint_count; i++) {
+        for (int p = 0; p < PHASES; p++) {
+            const struct histogram *histogram = &endpoints[i].phases[p];
+            if (histogram->count == 0) continue;
+
+            long cumulative = 0;
+            for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+                cumulative += histogram->buckets[bucket];
+                fputs("cloudflare_request_phase_seconds_bucket", out);
+                write_label(out, &endpoints[i]);
+                if (bucket < BUCKET_COUNT - 1) {
+                    fprintf(out, ",phase=\"%s\",le=\"%g\"} %ld\n", PHASE_NAMES[p], BUCKET_BOUNDS[bucket], cumulative);
+                } else {
+                    fprintf(out, ",phase=\"%s\",le=\"+Inf\"} %ld\n", PHASE_NAMES[p], cumulative);
+                }
+            }
+            fputs("cloudflare_request_phase_seconds_sum", out);
+            write_label(out, &endpoints[i]);
+            fprintf(out, ",phase=\"%s\"} %.6f\n", PHASE_NAMES[p], histogram->sum);
+            fputs("cloudflare_request_phase_seconds_count", out);
+            write_label(out, &endpoints[i]);
+            fprintf(out, ",phase=\"%s\"} %ld\n", PHASE_NAMES[p], histogram->count);
+        }
+    }
+}
+
+void metrics_write(FILE *out, int format) {
+    if (format == METRICS_PROMETHEUS) {
+        write_prometheus(out);
+    } else {
+        write_json(out);
+    }
+}
+
+int metrics_export(void) {
+    if (started_at == 0) return 1;
+    last_export = metrics_now();
+
+    if (METRICS_FILE[0] == '\0') {
+        metrics_write(stderr, METRICS_FORMAT);
+        return 1;
+    }
+
+    // Scrapers and tail readers never see a half-written file
+    char temp_path[300];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", METRICS_FILE);
+    FILE *out = fopen(temp_path, "w");
+    if (!out) {
+        fprintf(stderr, "Error: Could not write metrics to %s\n", temp_path);
+        return 0;
+    }
+    metrics_write(out, METRICS_FORMAT);
+    if (fclose(out) != 0 || rename(temp_path, METRICS_FILE) != 0) {
+        fprintf(stderr, "Error: Could not write metrics to %s\n", METRICS_FILE);
+        remove(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+void metrics_tick(void) {
+    if (started_at == 0 || METRICS_INTERVAL <= 0) return;
+    if (metrics_now() - last_export >= METRICS_INTERVAL) metrics_export();
+}
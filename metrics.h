@@ -0,0 +1,56 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+// Export formats for METRICS in the configuration file
+#define METRICS_OFF        0
+#define METRICS_JSON       1
+#define METRICS_PROMETHEUS 2
+
+extern int METRICS_FORMAT;     // METRICS=json|prometheus, off unless configured
+extern char METRICS_FILE[256]; // Where summaries are written; stderr when empty
+extern int METRICS_INTERVAL;   // Seconds between exports in serve mode, 0 for only at exit
+
+// Timings of one transfer attempt, in seconds. Connection phases are 0 when
+// an existing connection was reused.
+typedef struct {
+    double dns;     // Name lookup
+    double connect; // TCP connect after the lookup
+    double tls;     // TLS handshake after the connect
+    double ttfb;    // Start of the transfer to the first response byte
+    double total;   // Whole transfer
+    double bytes;   // Response bytes received
+    int new_connection;
+} MetricsTransfer;
+
+// Parse a METRICS value. Returns METRICS_OFF for anything unrecognised.
+int metrics_parse_format(const char *value);
+
+// Start collecting if METRICS is configured; the summary is exported at exit.
+// Must be called once after load_config.
+void metrics_init(void);
+
+// Monotonic clock in seconds, for timing work outside libcurl
+double metrics_now(void);
+
+// Record a finished attempt. status is 0 when no response arrived.
+void metrics_record_transfer(const char *method, const char *url, long status, const MetricsTransfer *transfer);
+
+// Record that an attempt is being retried
+void metrics_record_retry(const char *method, const char *url);
+
+// Record time spent parsing a response body of url
+void metrics_record_parse(const char *method, const char *url, double seconds);
+
+// Write the current summary in the given format
+void metrics_write(FILE *out, int format);
+
+// Write the summary to METRICS_FILE (atomically) or stderr. Returns 1 on success.
+int metrics_export(void);
+
+// Export if METRICS_INTERVAL seconds have passed since the last export.
+// Called between commands by long-running modes.
+void metrics_tick(void);
+
+#endif
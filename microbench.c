@@ -0,0 +1,410 @@
+// Microbenchmark for the local hot paths: zone map load/save/update, the
+// response buffer's growth, and the JSON extraction done by list_zones,
+// add_update_record and ./map list_zones. Generates a synthetic zone map and
+// dns_records listing of N records in a scratch directory, runs each stage a
+// few times and prints one JSON line per stage: ns per record, allocations
+// and bytes allocated per record, and the stage's peak RSS. No network is used.
+//
+//   ./microbench [-r records] [-z zones] [-n runs] [-c chunk_bytes] [-B]
+//
+// Allocations are counted by wrapping malloc, calloc and realloc (glibc only).
+// Peak RSS is reset before each stage through /proc/self/clear_refs; on kernels
+// without it the figure is the process peak so far.
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cjson/cJSON.h>
+
+#include "http.h"
+#include "record_stream.h"
+#include "zone_map.h"
+
+#define MICROBENCH_DEFAULT_CHUNK 16384 // Bytes per call, about what libcurl hands over
+
+// Configuration from the command line
+static int record_total = 10000;
+static int zone_total = 100;
+static int runs = 5;
+static size_t chunk_size = MICROBENCH_DEFAULT_CHUNK;
+
+// Allocation counters, only counted while a stage is timed
+static int counting = 0;
+static unsigned long alloc_count = 0;
+static unsigned long alloc_bytes = 0;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += count * size;
+    }
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+// Synthetic listing shared by the JSON stages
+static char *listing = NULL;
+static size_t listing_size = 0;
+static cJSON *listing_json = NULL;
+
+// Results of one stage
+struct stage_result {
+    double ns[64]; // Nanoseconds per run
+    int count;
+    unsigned long allocs;
+    unsigned long bytes;
+    long peak_rss_kb;
+    int failed;
+};
+
+typedef int (*stage_run)(void);  // Returns 1 on success
+typedef void (*stage_setup)(void);
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Start a fresh peak RSS measurement, from what the heap really holds
+static void reset_peak_rss(void) {
+    malloc_trim(0);
+    FILE *file = fopen("/proc/self/clear_refs", "w");
+    if (!file) return;
+    fputs("5", file);
+    fclose(file);
+}
+
+static long peak_rss_kb(void) {
+    FILE *file = fopen("/proc/self/status", "r");
+    if (!file) return -1;
+
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+    }
+    fclose(file);
+    return kb;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Run a stage runs times, with setup (untimed) before each run, and print its line
+static void run_stage(const char *name, stage_setup setup, stage_run run) {
+    struct stage_result result;
+    memset(&result, 0, sizeof(result));
+
+    for (int i = 0; i < runs && i < 64; i++) {
+        if (setup) setup();
+        reset_peak_rss();
+
+        alloc_count = 0;
+        alloc_bytes = 0;
+        counting = 1;
+        double start = now_ns();
+        int ok = run();
+        double elapsed = now_ns() - start;
+        counting = 0;
+
+        if (!ok) result.failed++;
+        result.ns[result.count++] = elapsed;
+        result.allocs = alloc_count;
+        result.bytes = alloc_bytes;
+        long rss = peak_rss_kb();
+        if (rss > result.peak_rss_kb) result.peak_rss_kb = rss;
+    }
+
+    qsort(result.ns, result.count, sizeof(double), compare_double);
+    printf("{\"stage\":\"%s\",\"records\":%d,\"runs\":%d,\"failed\":%d,\"ns_per_op\":%.1f,\"min_ns_per_op\":%.1f,"
+           "\"allocs_per_op\":%.3f,\"bytes_per_op\":%.1f,\"peak_rss_kb\":%ld}\n",
+           name, record_total, result.count, result.failed, result.ns[result.count / 2] / record_total,
+           result.ns[0] / record_total, (double)result.allocs / record_total, (double)result.bytes / record_total,
+           result.peak_rss_kb);
+    fflush(stdout);
+}
+
+// The fields of synthetic record i, shaped like the mock server's
+static void record_fields(int i, char *domain, char *zone_id, char *record_id, char *content) {
+    int zone = i % zone_total;
+    int record = i / zone_total;
+    snprintf(domain, 96, "host%d.zone%d.example", record, zone);
+    snprintf(zone_id, 33, "%032x", zone + 1);
+    snprintf(record_id, 33, "%016x%016x", zone + 1, record + 1);
+    snprintf(content, 32, "10.%d.%d.%d", (zone >> 8) & 255, zone & 255, record & 255);
+}
+
+static int write_zone_map(void) {
+    FILE *file = fopen(ZONE_MAP_FILE, "w");
+    if (!file) return 0;
+
+    int ok = 1;
+    for (int i = 0; i < record_total && ok; i++) {
+        char domain[96], zone_id[33], record_id[33], content[32];
+        record_fields(i, domain, zone_id, record_id, content);
+        ok = fprintf(file, "%s %s %s %d %s\n", domain, zone_id, record_id, i % 2, content) > 0;
+    }
+    return fclose(file) == 0 && ok;
+}
+
+// Build one dns_records response holding every record, as the API words it
+static int build_listing(void) {
+    size_t capacity = (size_t)record_total * 400 + 256;
+    listing = malloc(capacity);
+    if (!listing) return 0;
+
+    size_t used = (size_t)snprintf(listing, capacity, "{\"success\":true,\"errors\":[],\"messages\":[],\"result\":[");
+    for (int i = 0; i < record_total; i++) {
+        char domain[96], zone_id[33], record_id[33], content[32];
+        record_fields(i, domain, zone_id, record_id, content);
+        used += (size_t)snprintf(listing + used, capacity - used,
+                                 "%s{\"id\":\"%s\",\"zone_id\":\"%s\",\"zone_name\":\"zone%d.example\",\"name\":\"%s\","
+                                 "\"type\":\"A\",\"content\":\"%s\",\"proxiable\":true,\"proxied\":%s,\"ttl\":1,"
+                                 "\"locked\":false,\"created_on\":\"2024-01-01T00:00:00.000000Z\","
+                                 "\"modified_on\":\"2024-01-01T00:00:00.%06dZ\"}",
+                                 i ? "," : "", record_id, zone_id, i % zone_total, domain, content,
+                                 i % 2 ? "true" : "false", i % 1000000);
+    }
+    used += (size_t)snprintf(listing + used, capacity - used,
+                             "],\"result_info\":{\"page\":1,\"per_page\":%d,\"count\":%d,\"total_count\":%d,\"total_pages\":1}}",
+                             record_total, record_total, record_total);
+    listing_size = used;
+    return used < capacity;
+}
+
+// Zone map stages
+
+static void empty_map(void) {
+    reset_zone_map();
+}
+
+static void loaded_map(void) {
+    reset_zone_map();
+    load_zone_map();
+}
+
+static int bench_load_zone_map(void) {
+    load_zone_map();
+    return zone_map_size == record_total;
+}
+
+static int bench_save_zone_map(void) {
+    return save_zone_map();
+}
+
+// Every domain is already mapped: the lookup-only path
+static int bench_update_existing(void) {
+    for (int i = 0; i < record_total; i++) {
+        char domain[96], zone_id[33], record_id[33], content[32];
+        record_fields(i, domain, zone_id, record_id, content);
+        update_zone_map(domain, zone_id, record_id, i % 2, content);
+    }
+    return zone_map_size == record_total;
+}
+
+// Every domain is new: the append and index growth path
+static int bench_update_insert(void) {
+    return bench_update_existing();
+}
+
+// Response buffer stages
+
+static int feed_write_callback(size_t initial_capacity) {
+    struct memory mem = {NULL, 0, 0, NULL};
+    if (initial_capacity) {
+        mem.response = malloc(initial_capacity);
+        if (!mem.response) return 0;
+        mem.capacity = initial_capacity;
+    }
+
+    int ok = 1;
+    for (size_t offset = 0; offset < listing_size && ok; offset += chunk_size) {
+        size_t size = listing_size - offset < chunk_size ? listing_size - offset : chunk_size;
+        ok = http_write_callback(listing + offset, 1, size, &mem) == size;
+    }
+    ok = ok && mem.size == listing_size;
+    free(mem.response);
+    return ok;
+}
+
+// No Content-Length: the buffer doubles from its initial size
+static int bench_write_callback(void) {
+    return feed_write_callback(0);
+}
+
+// Content-Length known: one allocation up front
+static int bench_write_callback_sized(void) {
+    return feed_write_callback(listing_size + 1);
+}
+
+// JSON stages
+
+static void parsed_listing(void) {
+    if (!listing_json) listing_json = cJSON_Parse(listing);
+}
+
+static void free_parsed_listing(void) {
+    cJSON_Delete(listing_json);
+    listing_json = NULL;
+}
+
+static int bench_cjson_parse(void) {
+    listing_json = cJSON_Parse(listing);
+    return listing_json != NULL;
+}
+
+// The per-element work of list_zones: print each result object
+static int bench_list_zones_loop(void) {
+    cJSON *result = cJSON_GetObjectItem(listing_json, "result");
+    if (!cJSON_IsArray(result)) return 0;
+
+    int printed = 0;
+    cJSON *item;
+    cJSON_ArrayForEach(item, result) {
+        cJSON *id = cJSON_GetObjectItem(item, "id");
+        if (!cJSON_IsString(id)) return 0;
+        char *item_json = cJSON_PrintUnformatted(item);
+        if (!item_json) return 0;
+        free(item_json);
+        printed++;
+    }
+    return printed == record_total;
+}
+
+// add_update_record's search for the record to keep or change. The name is
+// the last record's and the content differs, so every record is looked at.
+static int bench_add_update_record_scan(void) {
+    char name[96], zone_id[33], record_id[33], content[32];
+    record_fields(record_total - 1, name, zone_id, record_id, content);
+    int proxied = (record_total - 1) % 2;
+
+    cJSON *result = cJSON_GetObjectItem(listing_json, "result");
+    if (!cJSON_IsArray(result)) return 0;
+
+    cJSON *record;
+    cJSON *existing = NULL;
+    cJSON *target = NULL;
+    cJSON_ArrayForEach(record, result) {
+        cJSON *record_name = cJSON_GetObjectItem(record, "name");
+        cJSON *record_content = cJSON_GetObjectItem(record, "content");
+        cJSON *record_proxied = cJSON_GetObjectItem(record, "proxied");
+        cJSON *record_id_item = cJSON_GetObjectItem(record, "id");
+
+        if (record_name && record_content && record_id_item && record_proxied && strcmp(record_name->valuestring, name) == 0) {
+            if (strcmp(record_content->valuestring, "192.0.2.1") == 0 && record_proxied->valueint == proxied) {
+                existing = record;
+                break;
+            } else if (!target) {
+                target = record;
+            }
+        }
+    }
+    return !existing && target != NULL;
+}
+
+static void count_record(const DnsRecord *record, void *userdata) {
+    (void)record;
+    (*(int *)userdata)++;
+}
+
+// ./map list_zones: the records are pulled out while the body arrives
+static int bench_record_stream(void) {
+    int seen = 0;
+    RecordStream *stream = record_stream_create(count_record, &seen);
+    if (!stream) return 0;
+
+    int ok = 1;
+    for (size_t offset = 0; offset < listing_size && ok; offset += chunk_size) {
+        size_t size = listing_size - offset < chunk_size ? listing_size - offset : chunk_size;
+        ok = record_stream_feed(stream, listing + offset, size);
+    }
+    ok = ok && record_stream_finish(stream) && seen == record_total;
+    record_stream_free(stream);
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: ./microbench [-r records] [-z zones] [-n runs] [-c chunk_bytes] [-B]\n");
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "r:z:n:c:Bh")) != -1) {
+        switch (option) {
+        case 'r': record_total = atoi(optarg); break;
+        case 'z': zone_total = atoi(optarg); break;
+        case 'n': runs = atoi(optarg); break;
+        case 'c': chunk_size = (size_t)atol(optarg); break;
+        case 'B': ZONE_MAP_BINARY_MODE = 1; break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (record_total < 1 || zone_total < 1 || runs < 1 || runs > 64 || chunk_size < 1) {
+        usage();
+        return 1;
+    }
+
+    // The map is read from and written to the working directory
+    char scratch[] = "/tmp/cloudflare-microbench-XXXXXX";
+    if (!mkdtemp(scratch) || chdir(scratch) != 0) {
+        fprintf(stderr, "Error: Could not create a scratch directory.\n");
+        return 1;
+    }
+    if (!write_zone_map() || !build_listing()) {
+        fprintf(stderr, "Error: Could not generate the benchmark inputs in %s.\n", scratch);
+        return 1;
+    }
+    fprintf(stderr, "Benchmarking %d records in %d zones (%zu byte listing) in %s\n", record_total, zone_total,
+            listing_size, scratch);
+
+    // In binary mode the first load reads the text map; save it so loads read zone_map.bin
+    if (ZONE_MAP_BINARY_MODE) {
+        loaded_map();
+        if (!save_zone_map()) return 1;
+    }
+
+    run_stage("load_zone_map", empty_map, bench_load_zone_map);
+    run_stage("save_zone_map", loaded_map, bench_save_zone_map);
+    run_stage("update_zone_map existing", loaded_map, bench_update_existing);
+    run_stage("update_zone_map insert", empty_map, bench_update_insert);
+    reset_zone_map();
+
+    run_stage("http_write_callback", NULL, bench_write_callback);
+    run_stage("http_write_callback sized", NULL, bench_write_callback_sized);
+
+    run_stage("cJSON_Parse", free_parsed_listing, bench_cjson_parse);
+    run_stage("list_zones loop", parsed_listing, bench_list_zones_loop);
+    run_stage("add_update_record scan", parsed_listing, bench_add_update_record_scan);
+    free_parsed_listing();
+    run_stage("record_stream", NULL, bench_record_stream);
+
+    free(listing);
+    return 0;
+}
@@ -0,0 +1,778 @@
+// A local stand-in for the parts of the Cloudflare API this tool uses, for
+// benchmarks and manual testing. It serves a synthetic account of N zones with
+// M records each, paginates like the real API, and can add latency, random
+// 503s and a rate limit that answers 429 with Retry-After.
+//
+//   ./mock_server [-p port] [-z zones] [-r records] [-l latency_ms]
+//                 [-L limit] [-w window_s] [-e error_percent] [-a accounts]
+//
+// With -a N, zone z belongs to the account whose token is "token<z % N>":
+// each token lists and reaches only its own zones and has its own rate limit.
+//
+// Point the tools at it with API_URL=http://127.0.0.1:<port>/client/v4 in
+// config.txt. GET /__stats reports request counts; POST /__reset clears them.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <cjson/cJSON.h>
+
+#define MOCK_DEFAULT_PORT 8765
+#define MOCK_MAX_HEADER 16384       // Longest request head accepted
+#define MOCK_MAX_BODY (16 << 20)    // Largest request body accepted
+#define MOCK_ZONES_MAX_PER_PAGE 50
+#define MOCK_RECORDS_MAX_PER_PAGE 5000
+
+// Configuration from the command line
+static int zone_total = 10;
+static int records_per_zone = 100;
+static int latency_ms = 0;
+static int rate_limit = 0;    // Requests per window, 0 for none
+static int rate_window = 300; // Seconds
+static int error_percent = 0; // Share of requests answered with 503
+static int account_total = 0; // Tokens the zones are split across, 0 for one that accepts any token
+
+#define MOCK_MAX_ACCOUNTS 64
+
+struct mock_record {
+    char id[33];
+    char type[16];
+    char *name;
+    char *content;
+    char modified_on[32];
+    int ttl;
+    int proxied;
+    int priority; // -1 when the record has none
+};
+
+struct mock_zone {
+    char id[33];
+    char name[64];
+    struct mock_record *records;
+    int count;
+    int capacity;
+};
+
+// Where a record lives, found by its ID through an open-addressing table
+struct record_slot {
+    int zone; // -1 when empty
+    int index;
+};
+
+// Everything below is guarded by store_lock
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct mock_zone *zones = NULL;
+static struct record_slot *slots = NULL;
+static size_t slot_count = 0;
+static size_t record_count = 0;
+static uint64_t next_record_id = 1;
+static unsigned int error_seed = 1;
+
+static long stat_requests = 0;
+static long stat_rate_limited = 0;
+static long stat_errors = 0;
+static time_t window_start[MOCK_MAX_ACCOUNTS]; // Per token; slot 0 without -a
+static int window_requests[MOCK_MAX_ACCOUNTS];
+
+// Growable output buffer
+struct buffer {
+    char *data;
+    size_t size;
+    size_t capacity;
+};
+
+static void buffer_reserve(struct buffer *buf, size_t extra) {
+    if (buf->size + extra + 1 <= buf->capacity) return;
+    size_t capacity = buf->capacity ? buf->capacity : 4096;
+    while (capacity < buf->size + extra + 1) capacity *= 2;
+    char *data = realloc(buf->data, capacity);
+    if (!data) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    buf->data = data;
+    buf->capacity = capacity;
+}
+
+static void buffer_append(struct buffer *buf, const char *str, size_t length) {
+    buffer_reserve(buf, length);
+    memcpy(buf->data + buf->size, str, length);
+    buf->size += length;
+    buf->data[buf->size] = '\0';
+}
+
+static void buffer_printf(struct buffer *buf, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void buffer_printf(struct buffer *buf, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (length < 0) return;
+
+    buffer_reserve(buf, (size_t)length);
+    va_start(args, format);
+    vsnprintf(buf->data + buf->size, (size_t)length + 1, format, args);
+    va_end(args);
+    buf->size += (size_t)length;
+}
+
+// Append a string as a JSON string literal
+static void buffer_json_string(struct buffer *buf, const char *str) {
+    buffer_append(buf, "\"", 1);
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            char escaped[2] = {'\\', (char)*p};
+            buffer_append(buf, escaped, 2);
+        } else if (*p < 0x20) {
+            buffer_printf(buf, "\\u%04x", *p);
+        } else {
+            buffer_append(buf, (const char *)p, 1);
+        }
+    }
+    buffer_append(buf, "\"", 1);
+}
+
+static uint64_t hash_id(const char *id) {
+    uint64_t hash = 14695981039346656037ULL;
+    while (*id) {
+        hash ^= (unsigned char)*id++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static const char *slot_id(const struct record_slot *slot) {
+    return zones[slot->zone].records[slot->index].id;
+}
+
+// Position of the slot holding id, or of the empty slot where it would go
+static size_t find_slot(const char *id) {
+    size_t mask = slot_count - 1;
+    size_t i = hash_id(id) & mask;
+    while (slots[i].zone >= 0 && strcmp(slot_id(&slots[i]), id) != 0) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void grow_slots(void) {
+    struct record_slot *old = slots;
+    size_t old_count = slot_count;
+
+    slot_count = slot_count ? slot_count * 2 : 1024;
+    slots = malloc(slot_count * sizeof(struct record_slot));
+    if (!slots) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < slot_count; i++) slots[i].zone = -1;
+    for (size_t i = 0; i < old_count; i++) {
+        if (old[i].zone >= 0) slots[find_slot(slot_id(&old[i]))] = old[i];
+    }
+    free(old);
+}
+
+// Remove a slot, shifting later members of its probe run back into the gap
+static void remove_slot(size_t i) {
+    size_t mask = slot_count - 1;
+    slots[i].zone = -1;
+    for (size_t j = (i + 1) & mask; slots[j].zone >= 0; j = (j + 1) & mask) {
+        struct record_slot moved = slots[j];
+        slots[j].zone = -1;
+        slots[find_slot(slot_id(&moved))] = moved;
+    }
+}
+
+static void current_timestamp(char *out, size_t size) {
+    struct timespec ts;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &tm);
+    char seconds[20];
+    strftime(seconds, sizeof(seconds), "%Y-%m-%dT%H:%M:%S", &tm);
+    snprintf(out, size, "%s.%06dZ", seconds, (int)(ts.tv_nsec / 1000) % 1000000);
+}
+
+// Append a record to a zone and index it. Takes ownership of name and content.
+static struct mock_record *add_record(int zone_index, const char *id, const char *type, char *name,
+                                      char *content, int ttl, int proxied, const char *modified_on) {
+    struct mock_zone *zone = &zones[zone_index];
+    if (zone->count == zone->capacity) {
+        int capacity = zone->capacity ? zone->capacity * 2 : 16;
+        struct mock_record *records = realloc(zone->records, capacity * sizeof(struct mock_record));
+        if (!records) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            exit(1);
+        }
+        zone->records = records;
+        zone->capacity = capacity;
+    }
+
+    if ((record_count + 1) * 2 > slot_count) grow_slots();
+
+    struct mock_record *record = &zone->records[zone->count];
+    memset(record, 0, sizeof(*record));
+    snprintf(record->id, sizeof(record->id), "%s", id);
+    snprintf(record->type, sizeof(record->type), "%s", type);
+    snprintf(record->modified_on, sizeof(record->modified_on), "%s", modified_on);
+    record->name = name;
+    record->content = content;
+    record->ttl = ttl;
+    record->proxied = proxied;
+    record->priority = -1;
+
+    size_t slot = find_slot(record->id);
+    slots[slot].zone = zone_index;
+    slots[slot].index = zone->count++;
+    record_count++;
+    return record;
+}
+
+static void delete_record(size_t slot) {
+    int zone_index = slots[slot].zone;
+    int index = slots[slot].index;
+    struct mock_zone *zone = &zones[zone_index];
+
+    free(zone->records[index].name);
+    free(zone->records[index].content);
+    remove_slot(slot);
+    record_count--;
+
+    // The last record fills the hole
+    int last = --zone->count;
+    if (index != last) {
+        zone->records[index] = zone->records[last];
+        slots[find_slot(zone->records[index].id)].index = index;
+    }
+}
+
+static void build_account(void) {
+    zones = calloc(zone_total > 0 ? zone_total : 1, sizeof(struct mock_zone));
+    if (!zones) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        exit(1);
+    }
+
+    for (int z = 0; z < zone_total; z++) {
+        snprintf(zones[z].id, sizeof(zones[z].id), "%032x", z + 1);
+        snprintf(zones[z].name, sizeof(zones[z].name), "zone%d.example", z);
+
+        for (int r = 0; r < records_per_zone; r++) {
+            char id[33], name[96], content[32], modified_on[32];
+            snprintf(id, sizeof(id), "%016x%016x", z + 1, r + 1);
+            snprintf(name, sizeof(name), "host%d.%s", r, zones[z].name);
+            snprintf(content, sizeof(content), "10.%d.%d.%d", (z >> 8) & 255, z & 255, r & 255);
+            snprintf(modified_on, sizeof(modified_on), "2024-01-01T00:%02d:%02d.%06dZ", (r / 60) % 60, r % 60, r);
+            add_record(z, id, "A", strdup(name), strdup(content), 1, r % 2, modified_on);
+        }
+    }
+}
+
+static int find_zone(const char *id) {
+    for (int z = 0; z < zone_total; z++) {
+        if (strcmp(zones[z].id, id) == 0) return z;
+    }
+    return -1;
+}
+
+static void write_record(struct buffer *out, const struct mock_zone *zone, const struct mock_record *record) {
+    buffer_printf(out, "{\"id\":\"%s\",\"zone_id\":\"%s\",\"zone_name\":", record->id, zone->id);
+    buffer_json_string(out, zone->name);
+    buffer_printf(out, ",\"name\":");
+    buffer_json_string(out, record->name);
+    buffer_printf(out, ",\"type\":");
+    buffer_json_string(out, record->type);
+    buffer_printf(out, ",\"content\":");
+    buffer_json_string(out, record->content);
+    if (record->priority >= 0) buffer_printf(out, ",\"priority\":%d", record->priority);
+    buffer_printf(out, ",\"proxiable\":true,\"proxied\":%s,\"ttl\":%d,\"locked\":false,"
+                       "\"created_on\":\"2024-01-01T00:00:00.000000Z\",\"modified_on\":\"%s\"}",
+                  record->proxied ? "true" : "false", record->ttl, record->modified_on);
+}
+
+static void write_result_info(struct buffer *out, int page, int per_page, int count, int total) {
+    int total_pages = total > 0 ? (total + per_page - 1) / per_page : 1;
+    buffer_printf(out, ",\"result_info\":{\"page\":%d,\"per_page\":%d,\"count\":%d,\"total_count\":%d,\"total_pages\":%d}}",
+                  page, per_page, count, total, total_pages);
+}
+
+static void write_error(struct buffer *out, int code, const char *message) {
+    buffer_printf(out, "{\"success\":false,\"errors\":[{\"code\":%d,\"message\":", code);
+    buffer_json_string(out, message);
+    buffer_printf(out, "}],\"messages\":[],\"result\":null}");
+}
+
+// Value of a query parameter, copied into value. Returns 1 if present.
+static int query_param(const char *query, const char *key, char *value, size_t size) {
+    size_t key_length = strlen(key);
+    for (const char *p = query; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+        if (strncmp(p, key, key_length) != 0 || p[key_length] != '=') continue;
+
+        const char *start = p + key_length + 1;
+        size_t n = 0;
+        for (const char *c = start; *c && *c != '&' && n + 1 < size; c++) {
+            if (*c == '%' && c[1] && c[2]) {
+                char hex[3] = {c[1], c[2], '\0'};
+                value[n++] = (char)strtol(hex, NULL, 16);
+                c += 2;
+            } else {
+                value[n++] = *c == '+' ? ' ' : *c;
+            }
+        }
+        value[n] = '\0';
+        return 1;
+    }
+    return 0;
+}
+
+static void paging(const char *query, int max_per_page, int *page, int *per_page) {
+    char value[32];
+    *page = query_param(query, "page", value, sizeof(value)) ? atoi(value) : 1;
+    *per_page = query_param(query, "per_page", value, sizeof(value)) ? atoi(value) : 20;
+    if (*page < 1) *page = 1;
+    if (*per_page < 1) *per_page = 1;
+    if (*per_page > max_per_page) *per_page = max_per_page;
+}
+
+// Returns 1 if the token of account may reach zone z
+static int owns_zone(int account, int z) {
+    return account_total == 0 || z % account_total == account;
+}
+
+static int list_zones(const char *query, int account, struct buffer *out) {
+    int page, per_page;
+    paging(query, MOCK_ZONES_MAX_PER_PAGE, &page, &per_page);
+
+    char name[64];
+    int by_name = query_param(query, "name", name, sizeof(name));
+
+    int first = (page - 1) * per_page;
+    int total = 0, count = 0;
+    buffer_printf(out, "{\"success\":true,\"errors\":[],\"messages\":[],\"result\":[");
+    for (int z = 0; z < zone_total; z++) {
+        if (!owns_zone(account, z) || (by_name && strcasecmp(zones[z].name, name) != 0)) continue;
+        if (total++ < first || count >= per_page) continue;
+        buffer_printf(out, "%s{\"id\":\"%s\",\"name\":", count++ ? "," : "", zones[z].id);
+        buffer_json_string(out, zones[z].name);
+        buffer_printf(out, ",\"status\":\"active\",\"modified_on\":\"2024-01-01T00:00:00.000000Z\"}");
+    }
+    buffer_printf(out, "]");
+    write_result_info(out, page, per_page, count, total);
+    return 200;
+}
+
+static int list_records(int zone_index, const char *query, struct buffer *out) {
+    const struct mock_zone *zone = &zones[zone_index];
+    int page, per_page;
+    paging(query, MOCK_RECORDS_MAX_PER_PAGE, &page, &per_page);
+
+    char type[16], name[256];
+    int by_type = query_param(query, "type", type, sizeof(type));
+    int by_name = query_param(query, "name", name, sizeof(name));
+
+    int *matches = malloc((zone->count + 1) * sizeof(int));
+    if (!matches) {
+        write_error(out, 10000, "out of memory");
+        return 500;
+    }
+    int total = 0;
+    for (int i = 0; i < zone->count; i++) {
+        if (by_type && strcasecmp(zone->records[i].type, type) != 0) continue;
+        if (by_name && strcasecmp(zone->records[i].name, name) != 0) continue;
+        matches[total++] = i;
+    }
+
+    int first = (page - 1) * per_page;
+    int count = 0;
+    buffer_printf(out, "{\"success\":true,\"errors\":[],\"messages\":[],\"result\":[");
+    for (int i = first; i < total && count < per_page; i++, count++) {
+        if (count) buffer_append(out, ",", 1);
+        write_record(out, zone, &zone->records[matches[i]]);
+    }
+    buffer_printf(out, "]");
+    write_result_info(out, page, per_page, count, total);
+    free(matches);
+    return 200;
+}
+
+// Copy the fields a client sent onto a record. Returns 0 if a field has the wrong type.
+static int apply_fields(struct mock_record *record, cJSON *json) {
+    cJSON *type = cJSON_GetObjectItem(json, "type");
+    cJSON *name = cJSON_GetObjectItem(json, "name");
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    cJSON *ttl = cJSON_GetObjectItem(json, "ttl");
+    cJSON *proxied = cJSON_GetObjectItem(json, "proxied");
+    cJSON *priority = cJSON_GetObjectItem(json, "priority");
+
+    if ((type && !cJSON_IsString(type)) || (name && !cJSON_IsString(name)) ||
+        (content && !cJSON_IsString(content)) || (ttl && !cJSON_IsNumber(ttl)) ||
+        (proxied && !cJSON_IsBool(proxied)) || (priority && !cJSON_IsNumber(priority))) {
+        return 0;
+    }
+
+    if (type) snprintf(record->type, sizeof(record->type), "%s", type->valuestring);
+    if (name) {
+        free(record->name);
+        record->name = strdup(name->valuestring);
+    }
+    if (content) {
+        free(record->content);
+        record->content = strdup(content->valuestring);
+    }
+    if (ttl) record->ttl = ttl->valueint;
+    if (proxied) record->proxied = cJSON_IsTrue(proxied);
+    if (priority) record->priority = priority->valueint;
+    current_timestamp(record->modified_on, sizeof(record->modified_on));
+    return 1;
+}
+
+static int single_result(struct buffer *out, const struct mock_zone *zone, const struct mock_record *record) {
+    buffer_printf(out, "{\"success\":true,\"errors\":[],\"messages\":[],\"result\":");
+    write_record(out, zone, record);
+    buffer_printf(out, "}");
+    return 200;
+}
+
+static int create_record(int zone_index, const char *body, struct buffer *out) {
+    cJSON *json = cJSON_Parse(body);
+    cJSON *type = cJSON_GetObjectItem(json, "type");
+    cJSON *name = cJSON_GetObjectItem(json, "name");
+    cJSON *content = cJSON_GetObjectItem(json, "content");
+    if (!cJSON_IsString(type) || !cJSON_IsString(name) || !cJSON_IsString(content)) {
+        cJSON_Delete(json);
+        write_error(out, 9000, "type, name and content are required");
+        return 400;
+    }
+
+    char id[33], modified_on[32];
+    snprintf(id, sizeof(id), "ffffffff%024llx", (unsigned long long)next_record_id++);
+    current_timestamp(modified_on, sizeof(modified_on));
+    struct mock_record *record = add_record(zone_index, id, "", NULL, NULL, 1, 0, modified_on);
+    int ok = apply_fields(record, json);
+    cJSON_Delete(json);
+    if (!ok) {
+        delete_record(find_slot(id));
+        write_error(out, 9000, "invalid field type");
+        return 400;
+    }
+    return single_result(out, &zones[zone_index], record);
+}
+
+static int record_request(const char *method, int zone_index, const char *record_id, const char *body, struct buffer *out) {
+    if (slot_count == 0) grow_slots();
+    size_t slot = find_slot(record_id);
+    if (slots[slot].zone != zone_index) {
+        write_error(out, 81044, "Record does not exist.");
+        return 404;
+    }
+    struct mock_zone *zone = &zones[zone_index];
+    struct mock_record *record = &zone->records[slots[slot].index];
+
+    if (strcmp(method, "GET") == 0) {
+        return single_result(out, zone, record);
+    }
+    if (strcmp(method, "DELETE") == 0) {
+        buffer_printf(out, "{\"success\":true,\"errors\":[],\"messages\":[],\"result\":{\"id\":\"%s\"}}", record->id);
+        delete_record(slot);
+        return 200;
+    }
+    if (strcmp(method, "PATCH") == 0 || strcmp(method, "PUT") == 0) {
+        cJSON *json = cJSON_Parse(body);
+        int ok = json && apply_fields(record, json);
+        cJSON_Delete(json);
+        if (!ok) {
+            write_error(out, 9000, "invalid request body");
+            return 400;
+        }
+        return single_result(out, zone, record);
+    }
+
+    write_error(out, 10000, "method not allowed");
+    return 405;
+}
+
+// Route one request made with the token of account. Called with the store lock held.
+static int route(const char *method, char *target, const char *body, int account, struct buffer *out) {
+    char *query = strchr(target, '?');
+    if (query) *query++ = '\0';
+
+    char *path = target;
+    if (strncmp(path, "/client/v4", 10) == 0) path += 10;
+
+    char *parts[6];
+    int count = 0;
+    for (char *part = strtok(path, "/"); part && count < 6; part = strtok(NULL, "/")) {
+        parts[count++] = part;
+    }
+
+    if (count == 1 && strcmp(parts[0], "zones") == 0 && strcmp(method, "GET") == 0) {
+        return list_zones(query, account, out);
+    }
+    if (count >= 3 && strcmp(parts[0], "zones") == 0) {
+        int zone_index = find_zone(parts[1]);
+        if (zone_index >= 0 && !owns_zone(account, zone_index)) {
+            write_error(out, 9109, "Unauthorized to access requested resource");
+            return 403;
+        }
+        if (zone_index < 0) {
+            write_error(out, 7003, "Could not route to the zone.");
+            return 404;
+        }
+        if (count == 3 && strcmp(parts[2], "dns_records") == 0) {
+            if (strcmp(method, "GET") == 0) return list_records(zone_index, query, out);
+            if (strcmp(method, "POST") == 0) return create_record(zone_index, body, out);
+        } else if (count == 4 && strcmp(parts[2], "dns_records") == 0) {
+            return record_request(method, zone_index, parts[3], body, out);
+        } else if (count == 3 && strcmp(parts[2], "purge_cache") == 0 && strcmp(method, "POST") == 0) {
+            buffer_printf(out, "{\"success\":true,\"errors\":[],\"messages\":[],\"result\":{\"id\":\"%s\"}}", zones[zone_index].id);
+            return 200;
+        }
+    }
+
+    write_error(out, 7000, "No route for that URI");
+    return 404;
+}
+
+static const char *status_text(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 429: return "Too Many Requests";
+    case 503: return "Service Unavailable";
+    default: return "Internal Server Error";
+    }
+}
+
+// Decide how to answer a request made with token, filling out. Returns the
+// status and sets *retry_after for 429s.
+static int handle_request(const char *method, char *target, const char *body, const char *token, struct buffer *out,
+                          int *retry_after) {
+    pthread_mutex_lock(&store_lock);
+
+    int status;
+    if (strcmp(target, "/__stats") == 0) {
+        buffer_printf(out, "{\"requests\":%ld,\"rate_limited\":%ld,\"errors\":%ld,\"records\":%zu}",
+                      stat_requests, stat_rate_limited, stat_errors, record_count);
+        pthread_mutex_unlock(&store_lock);
+        return 200;
+    }
+    if (strcmp(target, "/__reset") == 0) {
+        stat_requests = stat_rate_limited = stat_errors = 0;
+        memset(window_start, 0, sizeof(window_start));
+        buffer_printf(out, "{\"success\":true}");
+        pthread_mutex_unlock(&store_lock);
+        return 200;
+    }
+
+    stat_requests++;
+    int account = 0;
+    if (account_total > 0 && (sscanf(token, "token%d", &account) != 1 || account < 0 || account >= account_total)) {
+        write_error(out, 10000, "Authentication error");
+        pthread_mutex_unlock(&store_lock);
+        return 403;
+    }
+
+    time_t now = time(NULL);
+    if (rate_limit > 0 && now - window_start[account] >= rate_window) {
+        window_start[account] = now;
+        window_requests[account] = 0;
+    }
+
+    if (rate_limit > 0 && window_requests[account] >= rate_limit) {
+        stat_rate_limited++;
+        *retry_after = (int)(window_start[account] + rate_window - now);
+        if (*retry_after < 1) *retry_after = 1;
+        write_error(out, 10013, "Rate limited. Please wait and consider throttling your request speed");
+        status = 429;
+    } else if (error_percent > 0 && (int)(rand_r(&error_seed) % 100) < error_percent) {
+        window_requests[account]++;
+        stat_errors++;
+        write_error(out, 10000, "Injected server error");
+        status = 503;
+    } else {
+        window_requests[account]++;
+        status = route(method, target, body, account, out);
+    }
+
+    pthread_mutex_unlock(&store_lock);
+    return status;
+}
+
+static int send_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += sent;
+        size -= (size_t)sent;
+    }
+    return 1;
+}
+
+// Serve requests on one keep-alive connection until the client closes it
+static void *serve_connection(void *arg) {
+    int fd = (int)(intptr_t)arg;
+    struct buffer in = {NULL, 0, 0};
+    struct buffer out = {NULL, 0, 0};
+    struct buffer head = {NULL, 0, 0};
+
+    for (;;) {
+        // Read until the end of the request head
+        char *end;
+        while (!(in.data && (end = strstr(in.data, "\r\n\r\n")))) {
+            if (in.size > MOCK_MAX_HEADER) goto done;
+            buffer_reserve(&in, 65536);
+            ssize_t got = recv(fd, in.data + in.size, in.capacity - in.size - 1, 0);
+            if (got <= 0) goto done;
+            in.size += (size_t)got;
+            in.data[in.size] = '\0';
+        }
+
+        size_t head_size = (size_t)(end - in.data) + 4;
+        char method[16] = "", target[4096] = "";
+        if (sscanf(in.data, "%15s %4095s", method, target) != 2) goto done;
+
+        size_t content_length = 0;
+        int close_after = 0;
+        char token[256] = "";
+        for (char *line = strstr(in.data, "\r\n"); line && line < end; line = strstr(line + 2, "\r\n")) {
+            if (strncasecmp(line + 2, "Content-Length:", 15) == 0) {
+                content_length = strtoul(line + 17, NULL, 10);
+            } else if (strncasecmp(line + 2, "Authorization: Bearer ", 22) == 0) {
+                sscanf(line + 24, "%255s", token);
+            } else if (strncasecmp(line + 2, "Connection: close", 17) == 0) {
+                close_after = 1;
+            }
+        }
+        if (content_length > MOCK_MAX_BODY) goto done;
+
+        // Read the body
+        while (in.size < head_size + content_length) {
+            buffer_reserve(&in, head_size + content_length - in.size);
+            ssize_t got = recv(fd, in.data + in.size, in.capacity - in.size - 1, 0);
+            if (got <= 0) goto done;
+            in.size += (size_t)got;
+            in.data[in.size] = '\0';
+        }
+
+        char *body = malloc(content_length + 1);
+        if (!body) goto done;
+        memcpy(body, in.data + head_size, content_length);
+        body[content_length] = '\0';
+
+        out.size = 0;
+        int retry_after = 0;
+        int status = handle_request(method, target, body, token, &out, &retry_after);
+        free(body);
+
+        if (latency_ms > 0) {
+            struct timespec ts = {latency_ms / 1000, (long)(latency_ms % 1000) * 1000000L};
+            nanosleep(&ts, NULL);
+        }
+
+        head.size = 0;
+        buffer_printf(&head, "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n",
+                      status, status_text(status), out.size);
+        if (retry_after > 0) buffer_printf(&head, "Retry-After: %d\r\n", retry_after);
+        buffer_printf(&head, "\r\n");
+        if (!send_all(fd, head.data, head.size) || !send_all(fd, out.data ? out.data : "", out.size)) goto done;
+        if (close_after) goto done;
+
+        // Keep whatever the client pipelined after this request
+        size_t used = head_size + content_length;
+        memmove(in.data, in.data + used, in.size - used);
+        in.size -= used;
+        in.data[in.size] = '\0';
+    }
+
+done:
+    close(fd);
+    free(in.data);
+    free(out.data);
+    free(head.data);
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: ./mock_server [-p port] [-z zones] [-r records] [-l latency_ms] "
+                    "[-L limit] [-w window_s] [-e error_percent] [-a accounts]\n");
+}
+
+int main(int argc, char *argv[]) {
+    int port = MOCK_DEFAULT_PORT;
+    int option;
+    while ((option = getopt(argc, argv, "p:z:r:l:L:w:e:a:h")) != -1) {
+        switch (option) {
+        case 'p': port = atoi(optarg); break;
+        case 'z': zone_total = atoi(optarg); break;
+        case 'r': records_per_zone = atoi(optarg); break;
+        case 'l': latency_ms = atoi(optarg); break;
+        case 'L': rate_limit = atoi(optarg); break;
+        case 'w': rate_window = atoi(optarg); break;
+        case 'e': error_percent = atoi(optarg); break;
+        case 'a': account_total = atoi(optarg); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (zone_total < 0 || records_per_zone < 0 || rate_window < 1 || account_total < 0 ||
+        account_total > MOCK_MAX_ACCOUNTS) {
+        usage();
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    build_account();
+    if (slot_count == 0) grow_slots();
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(listener, 512) != 0) {
+        fprintf(stderr, "Error: Could not listen on port %d: %s\n", port, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "Serving %d zones x %d records on http://127.0.0.1:%d/client/v4\n", zone_total, records_per_zone, port);
+
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Error: accept() failed: %s\n", strerror(errno));
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, serve_connection, (void *)(intptr_t)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+}
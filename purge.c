@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+
+#include "api.h"
+#include "http.h"
+#include "purge.h"
+
+int PURGE_CHUNK_SIZE = DEFAULT_PURGE_CHUNK_SIZE;
+
+// Payload key and file-line prefix of each kind
+static const char *const KIND_KEYS[PURGE_KINDS] = {"files", "hosts", "prefixes", "tags"};
+static const char *const KIND_PREFIXES[PURGE_KINDS] = {NULL, "host:", "prefix:", "tag:"};
+
+struct purge_list {
+    char **targets[PURGE_KINDS]; // Owned strings, one growable array per kind
+    int counts[PURGE_KINDS];
+    int capacities[PURGE_KINDS];
+};
+
+// One request's worth of targets: a slice of one kind's sorted array
+struct purge_chunk {
+    struct purge_run *run;
+    int kind;
+    int first;
+    int count;
+};
+
+struct purge_run {
+    PurgeList *list;
+    int purged;
+    int requests;
+    int failed;
+};
+
+PurgeList *purge_list_create(void) {
+    PurgeList *list = calloc(1, sizeof(PurgeList));
+    if (!list) {
+        fprintf(stderr, "Error: Out of memory.\n");
+    }
+    return list;
+}
+
+int purge_list_add(PurgeList *list, int kind, const char *target) {
+    if (!list || kind < 0 || kind >= PURGE_KINDS || !target || !*target) return 0;
+
+    if (list->counts[kind] == list->capacities[kind]) {
+        int capacity = list->capacities[kind] ? list->capacities[kind] * 2 : 64;
+        char **targets = realloc(list->targets[kind], capacity * sizeof(char *));
+        if (!targets) {
+            fprintf(stderr, "Error: Out of memory.\n");
+            return 0;
+        }
+        list->targets[kind] = targets;
+        list->capacities[kind] = capacity;
+    }
+
+    char *copy = strdup(target);
+    if (!copy) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    list->targets[kind][list->counts[kind]++] = copy;
+    return 1;
+}
+
+int purge_list_add_file(PurgeList *list, int kind, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return 0;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    int ok = 1;
+    while (ok && getline(&line, &capacity, file) != -1) {
+        char *target = line;
+        while (*target == ' ' || *target == '\t') target++;
+        size_t length = strlen(target);
+        while (length > 0 && strchr(" \t\r\n", target[length - 1])) target[--length] = '\0';
+        if (length == 0) continue;
+
+        int line_kind = kind;
+        for (int k = 0; k < PURGE_KINDS; k++) {
+            if (KIND_PREFIXES[k] && strncmp(target, KIND_PREFIXES[k], strlen(KIND_PREFIXES[k])) == 0) {
+                line_kind = k;
+                target += strlen(KIND_PREFIXES[k]);
+                break;
+            }
+        }
+        ok = !*target || purge_list_add(list, line_kind, target);
+    }
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+static int compare_strings(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Sort each kind and drop repeated targets
+static void dedupe_targets(PurgeList *list) {
+    for (int kind = 0; kind < PURGE_KINDS; kind++) {
+        char **targets = list->targets[kind];
+        if (list->counts[kind] < 2) continue;
+
+        qsort(targets, list->counts[kind], sizeof(char *), compare_strings);
+        int count = 1;
+        for (int i = 1; i < list->counts[kind]; i++) {
+            if (strcmp(targets[count - 1], targets[i]) == 0) {
+                free(targets[i]);
+            } else {
+                targets[count++] = targets[i];
+            }
+        }
+        list->counts[kind] = count;
+    }
+}
+
+// Build {"<kind>":[...]} for a chunk. Returns a string the caller frees, or NULL.
+static char *chunk_payload(const struct purge_chunk *chunk) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON *targets = cJSON_AddArrayToObject(json, KIND_KEYS[chunk->kind]);
+    if (!targets) {
+        cJSON_Delete(json);
+        return NULL;
+    }
+
+    char **kind_targets = chunk->run->list->targets[chunk->kind];
+    for (int i = chunk->first; i < chunk->first + chunk->count; i++) {
+        cJSON_AddItemToArray(targets, cJSON_CreateString(kind_targets[i]));
+    }
+
+    char *payload = cJSON_PrintUnformatted(json);
+    cJSON_Delete(json);
+    return payload;
+}
+
+static void on_purge_response(char *response, long status, void *userdata) {
+    struct purge_chunk *chunk = (struct purge_chunk *)userdata;
+    struct purge_run *run = chunk->run;
+
+    if (response) {
+        size_t size = strlen(response);
+        while (size > 0 && (response[size - 1] == '\n' || response[size - 1] == '\r')) size--;
+        fwrite(response, 1, size, stdout);
+        fputc('\n', stdout);
+    }
+    if (response && status >= 200 && status < 300) {
+        run->purged += chunk->count;
+    } else {
+        fprintf(stderr, "Error: Could not purge %d %s starting with %s (HTTP %ld).\n", chunk->count,
+                KIND_KEYS[chunk->kind], run->list->targets[chunk->kind][chunk->first], status);
+        run->failed++;
+    }
+    free(response);
+}
+
+int purge_list_run(PurgeList *list, const char *zone_id, int max_in_flight) {
+    struct purge_run run = {list, 0, 0, 0};
+    int chunk_size = PURGE_CHUNK_SIZE > 0 ? PURGE_CHUNK_SIZE : DEFAULT_PURGE_CHUNK_SIZE;
+
+    dedupe_targets(list);
+
+    int chunk_count = 0;
+    for (int kind = 0; kind < PURGE_KINDS; kind++) {
+        chunk_count += (list->counts[kind] + chunk_size - 1) / chunk_size;
+    }
+
+    struct purge_chunk *chunks = calloc(chunk_count + 1, sizeof(struct purge_chunk));
+    HttpBatch *batch = chunks ? http_batch_create(max_in_flight) : NULL;
+    if (!batch) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        free(chunks);
+        return 0;
+    }
+    http_batch_set_priority(batch, HTTP_PRIORITY_BULK);
+
+    char url[512];
+    snprintf(url, sizeof(url), "%s/zones/%s/purge_cache", API_URL, zone_id);
+
+    struct purge_chunk *chunk = chunks;
+    for (int kind = 0; kind < PURGE_KINDS; kind++) {
+        for (int first = 0; first < list->counts[kind]; first += chunk_size, chunk++) {
+            chunk->run = &run;
+            chunk->kind = kind;
+            chunk->first = first;
+            chunk->count = list->counts[kind] - first < chunk_size ? list->counts[kind] - first : chunk_size;
+
+            char *payload = chunk_payload(chunk);
+            if (!payload || !http_batch_add(batch, url, "POST", payload, on_purge_response, chunk)) {
+                fprintf(stderr, "Error: Could not queue a purge of %s.\n", KIND_KEYS[kind]);
+                run.failed++;
+            } else {
+                run.requests++;
+            }
+            free(payload);
+        }
+    }
+
+    int ok = http_batch_run(batch);
+    http_batch_free(batch);
+    free(chunks);
+
+    printf("{\"purged\":%d,\"requests\":%d,\"failed\":%d}\n", run.purged, run.requests, run.failed);
+    return ok && run.failed == 0;
+}
+
+void purge_list_free(PurgeList *list) {
+    if (!list) return;
+
+    for (int kind = 0; kind < PURGE_KINDS; kind++) {
+        for (int i = 0; i < list->counts[kind]; i++) {
+            free(list->targets[kind][i]);
+        }
+        free(list->targets[kind]);
+    }
+    free(list);
+}
@@ -0,0 +1,36 @@
+#ifndef PURGE_H
+#define PURGE_H
+
+// Kinds of purge target, in the order their chunks are sent
+#define PURGE_FILES    0 // Full URLs
+#define PURGE_HOSTS    1 // Hostnames
+#define PURGE_PREFIXES 2 // host/path prefixes, without the scheme
+#define PURGE_TAGS     3 // Cache-Tag values
+#define PURGE_KINDS    4
+
+#define DEFAULT_PURGE_CHUNK_SIZE 30 // Targets per request accepted on every plan
+
+extern int PURGE_CHUNK_SIZE; // Targets sent per purge request
+
+// A set of targets to purge from one zone (opaque)
+typedef struct purge_list PurgeList;
+
+PurgeList *purge_list_create(void);
+
+// Add one target. Returns 1 on success, 0 on failure.
+int purge_list_add(PurgeList *list, int kind, const char *target);
+
+// Add every non-empty line of a file. Lines starting with "host:", "prefix:"
+// or "tag:" are targets of that kind; any other line is a target of kind.
+// Returns 1 on success, 0 if the file could not be read.
+int purge_list_add_file(PurgeList *list, int kind, const char *path);
+
+// Purge every target from the zone. Duplicates are dropped, and each kind is
+// split into requests of at most PURGE_CHUNK_SIZE targets that run
+// concurrently, at most max_in_flight at a time. Prints each response and a
+// summary line. Returns 1 if every request succeeded, 0 otherwise.
+int purge_list_run(PurgeList *list, const char *zone_id, int max_in_flight);
+
+void purge_list_free(PurgeList *list);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "record_stream.h"
+
+#define STREAM_MAX_DEPTH 64 // Deepest nesting accepted
+#define STREAM_KEY_DEPTH 4  // Object keys are only remembered this close to the root
+#define STREAM_KEY_SIZE 32  // Longest key compared against; longer keys never match
+
+// What the lexer is in the middle of
+enum lex_state {
+    LEX_VALUE,   // Between tokens
+    LEX_STRING,  // Inside a string
+    LEX_ESCAPE,  // After a backslash
+    LEX_UNICODE, // Inside the four hex digits of \uXXXX
+    LEX_LITERAL  // Inside a number, true, false or null
+};
+
+// Which token the grammar allows next, outside strings and literals
+enum expect {
+    EXPECT_VALUE, // A value; also ']' right after '['
+    EXPECT_KEY,   // An object key; also '}' right after '{'
+    EXPECT_COLON, // The ':' after a key
+    EXPECT_NEXT,  // ',' or the closing bracket after a member
+    EXPECT_END    // The root value is complete: only whitespace may follow
+};
+
+// Which top-level member the parser is inside
+enum section {
+    SECTION_OTHER,
+    SECTION_RESULT,     // result[]: every element is a record
+    SECTION_RESULT_INFO // result_info{}: pagination
+};
+
+struct record_stream {
+    record_callback callback;
+    void *userdata;
+
+    int lex;
+    char stack[STREAM_MAX_DEPTH]; // '{' or '[' for every open container
+    int depth;
+    int expect;     // EXPECT_*
+    int opened;     // The innermost container has no members yet
+    int section;
+    int failed;
+
+    char keys[STREAM_KEY_DEPTH][STREAM_KEY_SIZE]; // Current key of each shallow object
+
+    // The token being read; strings longer than the buffer are truncated
+    char text[RECORD_CONTENT_SIZE];
+    size_t text_length;
+    unsigned int codepoint;
+    unsigned int high_surrogate;
+    int hex_digits;
+
+    int in_record;
+    DnsRecord record;
+    int total_pages;
+};
+
+RecordStream *record_stream_create(record_callback callback, void *userdata) {
+    RecordStream *stream = calloc(1, sizeof(RecordStream));
+    if (!stream) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return NULL;
+    }
+
+    stream->callback = callback;
+    stream->userdata = userdata;
+    return stream;
+}
+
+static void append_byte(RecordStream *stream, char c) {
+    if (stream->text_length < sizeof(stream->text) - 1) {
+        stream->text[stream->text_length++] = c;
+    }
+}
+
+// Append a code point as UTF-8
+static void append_codepoint(RecordStream *stream, unsigned int cp) {
+    if (cp < 0x80) {
+        append_byte(stream, (char)cp);
+    } else if (cp < 0x800) {
+        append_byte(stream, (char)(0xC0 | (cp >> 6)));
+        append_byte(stream, (char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+        append_byte(stream, (char)(0xE0 | (cp >> 12)));
+        append_byte(stream, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        append_byte(stream, (char)(0x80 | (cp & 0x3F)));
+    } else {
+        append_byte(stream, (char)(0xF0 | (cp >> 18)));
+        append_byte(stream, (char)(0x80 | ((cp >> 12) & 0x3F)));
+        append_byte(stream, (char)(0x80 | ((cp >> 6) & 0x3F)));
+        append_byte(stream, (char)(0x80 | (cp & 0x3F)));
+    }
+}
+
+// Copy the current token into a fixed-size field
+static void copy_text(const RecordStream *stream, char *field, size_t size) {
+    size_t length = stream->text_length < size - 1 ? stream->text_length : size - 1;
+    memcpy(field, stream->text, length);
+    field[length] = '\0';
+}
+
+// The key the innermost object is currently on, or "" when not tracked
+static const char *current_key(const RecordStream *stream) {
+    if (stream->depth < 1 || stream->depth > STREAM_KEY_DEPTH) return "";
+    return stream->keys[stream->depth - 1];
+}
+
+// Check a finished number, true, false or null token
+static int valid_literal(const RecordStream *stream) {
+    const char *p = stream->text;
+    if (*p >= 'a' && *p <= 'z') return strcmp(p, "true") == 0 || strcmp(p, "false") == 0 || strcmp(p, "null") == 0;
+
+    if (*p == '-') p++;
+    if (*p == '0') {
+        p++;
+    } else if (*p >= '1' && *p <= '9') {
+        while (*p >= '0' && *p <= '9') p++;
+    } else {
+        return 0;
+    }
+    if (*p == '.') {
+        if (*++p < '0' || *p > '9') return 0;
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        if (*p == '+' || *p == '-') p++;
+        if (*p < '0' || *p > '9') return 0;
+        while (*p >= '0' && *p <= '9') p++;
+    }
+    return *p == '\0';
+}
+
+// A complete scalar (string or literal) in value position
+static void on_scalar(RecordStream *stream, int is_string) {
+    stream->expect = stream->depth > 0 ? EXPECT_NEXT : EXPECT_END;
+    stream->opened = 0;
+    if (stream->depth == 0) return;
+
+    const char *key = current_key(stream);
+    stream->text[stream->text_length] = '\0';
+
+    if (stream->in_record && stream->depth == 3) {
+        DnsRecord *record = &stream->record;
+        if (is_string && strcmp(key, "id") == 0) {
+            copy_text(stream, record->id, sizeof(record->id));
+        } else if (is_string && strcmp(key, "name") == 0) {
+            copy_text(stream, record->name, sizeof(record->name));
+        } else if (is_string && strcmp(key, "type") == 0) {
+            copy_text(stream, record->type, sizeof(record->type));
+        } else if (is_string && strcmp(key, "content") == 0) {
+            copy_text(stream, record->content, sizeof(record->content));
+            record->has_content = 1;
+        } else if (is_string && strcmp(key, "modified_on") == 0) {
+            copy_text(stream, record->modified_on, sizeof(record->modified_on));
+        } else if (!is_string && strcmp(key, "proxied") == 0) {
+            record->proxied = strcmp(stream->text, "true") == 0;
+        } else if (!is_string && strcmp(key, "ttl") == 0) {
+            record->ttl = atoi(stream->text);
+        } else if (!is_string && strcmp(key, "priority") == 0) {
+            record->priority = atoi(stream->text);
+        }
+    } else if (stream->section == SECTION_RESULT_INFO && stream->depth == 2) {
+        if (!is_string && strcmp(key, "total_pages") == 0) {
+            stream->total_pages = atoi(stream->text);
+        }
+    }
+}
+
+// A complete string: either an object key or a value
+static void on_string(RecordStream *stream) {
+    if (stream->expect == EXPECT_KEY) {
+        if (stream->depth <= STREAM_KEY_DEPTH) {
+            char *key = stream->keys[stream->depth - 1];
+            if (stream->text_length < STREAM_KEY_SIZE) {
+                memcpy(key, stream->text, stream->text_length);
+                key[stream->text_length] = '\0';
+            } else {
+                key[0] = '\0';
+            }
+        }
+        stream->expect = EXPECT_COLON;
+        stream->opened = 0;
+        return;
+    }
+
+    on_scalar(stream, 1);
+}
+
+static int open_container(RecordStream *stream, char c) {
+    if (stream->expect != EXPECT_VALUE || stream->depth == STREAM_MAX_DEPTH) return 0;
+
+    // The container sits in the member named by the parent's current key
+    if (stream->depth == 1) {
+        const char *key = current_key(stream);
+        if (c == '[' && strcmp(key, "result") == 0) {
+            stream->section = SECTION_RESULT;
+        } else if (c == '{' && strcmp(key, "result_info") == 0) {
+            stream->section = SECTION_RESULT_INFO;
+        } else {
+            stream->section = SECTION_OTHER;
+        }
+    } else if (stream->depth == 2 && c == '{' && stream->section == SECTION_RESULT) {
+        memset(&stream->record, 0, sizeof(stream->record));
+        stream->record.priority = -1;
+        stream->in_record = 1;
+    }
+
+    stream->stack[stream->depth++] = c;
+    if (stream->depth <= STREAM_KEY_DEPTH) {
+        stream->keys[stream->depth - 1][0] = '\0';
+    }
+    stream->expect = (c == '{') ? EXPECT_KEY : EXPECT_VALUE;
+    stream->opened = 1;
+    return 1;
+}
+
+static int close_container(RecordStream *stream, char c) {
+    char open = (c == '}') ? '{' : '[';
+    if (stream->depth == 0 || stream->stack[stream->depth - 1] != open) return 0;
+
+    // Either after a member, or closing an empty container
+    int empty = stream->opened && stream->expect == (open == '{' ? EXPECT_KEY : EXPECT_VALUE);
+    if (stream->expect != EXPECT_NEXT && !empty) return 0;
+
+    stream->depth--;
+    stream->expect = stream->depth > 0 ? EXPECT_NEXT : EXPECT_END;
+    stream->opened = 0;
+
+    if (stream->depth == 2 && stream->in_record) {
+        stream->in_record = 0;
+        if (stream->callback) stream->callback(&stream->record, stream->userdata);
+    } else if (stream->depth == 1) {
+        stream->section = SECTION_OTHER;
+    }
+    return 1;
+}
+
+// Handle one byte between tokens. Returns 0 on a syntax error.
+static int lex_value(RecordStream *stream, char c) {
+    switch (c) {
+    case ' ': case '\t': case '\n': case '\r':
+        return 1;
+    case ':':
+        if (stream->expect != EXPECT_COLON) return 0;
+        stream->expect = EXPECT_VALUE;
+        return 1;
+    case ',':
+        if (stream->expect != EXPECT_NEXT) return 0;
+        stream->expect = (stream->stack[stream->depth - 1] == '{') ? EXPECT_KEY : EXPECT_VALUE;
+        return 1;
+    case '{': case '[':
+        return open_container(stream, c);
+    case '}': case ']':
+        return close_container(stream, c);
+    case '"':
+        if (stream->expect != EXPECT_VALUE && stream->expect != EXPECT_KEY) return 0;
+        stream->lex = LEX_STRING;
+        stream->text_length = 0;
+        stream->high_surrogate = 0;
+        return 1;
+    default:
+        if ((c >= '0' && c <= '9') || c == '-' || (c >= 'a' && c <= 'z')) {
+            if (stream->expect != EXPECT_VALUE) return 0;
+            stream->lex = LEX_LITERAL;
+            stream->text_length = 0;
+            append_byte(stream, c);
+            return 1;
+        }
+        return 0;
+    }
+}
+
+int record_stream_feed(RecordStream *stream, const char *data, size_t size) {
+    if (!stream || stream->failed) return 0;
+
+    for (size_t i = 0; i < size; i++) {
+        char c = data[i];
+
+        switch (stream->lex) {
+        case LEX_STRING:
+            if (c == '"') {
+                stream->lex = LEX_VALUE;
+                on_string(stream);
+            } else if (c == '\\') {
+                stream->lex = LEX_ESCAPE;
+            } else if ((unsigned char)c < 0x20) {
+                stream->failed = 1; // Control characters must be escaped
+                return 0;
+            } else {
+                append_byte(stream, c);
+            }
+            break;
+
+        case LEX_ESCAPE:
+            stream->lex = LEX_STRING;
+            switch (c) {
+            case 'b': append_byte(stream, '\b'); break;
+            case 'f': append_byte(stream, '\f'); break;
+            case 'n': append_byte(stream, '\n'); break;
+            case 'r': append_byte(stream, '\r'); break;
+            case 't': append_byte(stream, '\t'); break;
+            case 'u':
+                stream->lex = LEX_UNICODE;
+                stream->codepoint = 0;
+                stream->hex_digits = 0;
+                break;
+            case '"': case '\\': case '/': append_byte(stream, c); break;
+            default:
+                stream->failed = 1;
+                return 0;
+            }
+            break;
+
+        case LEX_UNICODE: {
+            int digit;
+            if (c >= '0' && c <= '9') digit = c - '0';
+            else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+            else {
+                stream->failed = 1;
+                return 0;
+            }
+            stream->codepoint = (stream->codepoint << 4) | (unsigned int)digit;
+            if (++stream->hex_digits < 4) break;
+
+            stream->lex = LEX_STRING;
+            unsigned int cp = stream->codepoint;
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                stream->high_surrogate = cp; // Wait for the low half
+            } else if (cp >= 0xDC00 && cp <= 0xDFFF && stream->high_surrogate) {
+                append_codepoint(stream, 0x10000 + ((stream->high_surrogate - 0xD800) << 10) + (cp - 0xDC00));
+                stream->high_surrogate = 0;
+            } else {
+                append_codepoint(stream, cp);
+            }
+            break;
+        }
+
+        case LEX_LITERAL:
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                c == '.' || c == '+' || c == '-' || c == 'E') {
+                append_byte(stream, c);
+                break;
+            }
+            stream->lex = LEX_VALUE;
+            stream->text[stream->text_length] = '\0';
+            if (!valid_literal(stream)) {
+                stream->failed = 1;
+                return 0;
+            }
+            on_scalar(stream, 0);
+            // The delimiter still needs handling
+            if (!lex_value(stream, c)) {
+                stream->failed = 1;
+                return 0;
+            }
+            break;
+
+        default:
+            if (!lex_value(stream, c)) {
+                stream->failed = 1;
+                return 0;
+            }
+            break;
+        }
+    }
+
+    return 1;
+}
+
+int record_stream_finish(RecordStream *stream) {
+    if (!stream || stream->failed) return 0;
+
+    // A bare top-level literal ends with the input
+    if (stream->lex == LEX_LITERAL && stream->depth == 0) {
+        stream->text[stream->text_length] = '\0';
+        if (!valid_literal(stream)) return 0;
+        stream->lex = LEX_VALUE;
+        on_scalar(stream, 0);
+    }
+
+    // Not cut off inside a string, an escape or an open container
+    return stream->lex == LEX_VALUE && stream->expect == EXPECT_END;
+}
+
+int record_stream_total_pages(const RecordStream *stream) {
+    return stream ? stream->total_pages : 0;
+}
+
+void record_stream_free(RecordStream *stream) {
+    free(stream);
+}
@@ -0,0 +1,43 @@
+#ifndef RECORD_STREAM_H
+#define RECORD_STREAM_H
+
+#include <stddef.h>
+
+#define RECORD_CONTENT_SIZE 4096 // Longest record content kept; longer values are truncated
+
+// The fields of one DNS record pulled out of a dns_records listing
+typedef struct {
+    char id[64];
+    char name[256];
+    char type[16];
+    char content[RECORD_CONTENT_SIZE];
+    char modified_on[40]; // ISO 8601 timestamp, "" if absent
+    int has_content; // 0 when the record carried no content field
+    int proxied;
+    int ttl;
+    int priority; // MX, SRV and URI preference, -1 when absent
+} DnsRecord;
+
+// Called for every element of result[] as soon as its closing brace arrives.
+// The record is only valid for the duration of the call.
+typedef void (*record_callback)(const DnsRecord *record, void *userdata);
+
+// An incremental parser for one listing response (opaque)
+typedef struct record_stream RecordStream;
+
+// Create a parser that reports each result[] element to callback
+RecordStream *record_stream_create(record_callback callback, void *userdata);
+
+// Feed the next bytes of the response, in any chunking.
+// Returns 1 on success, 0 once the input is known not to be valid JSON.
+int record_stream_feed(RecordStream *stream, const char *data, size_t size);
+
+// Returns 1 if exactly one complete JSON document was fed, 0 otherwise
+int record_stream_finish(RecordStream *stream);
+
+// result_info.total_pages as reported by the response, or 0 if absent
+int record_stream_total_pages(const RecordStream *stream);
+
+void record_stream_free(RecordStream *stream);
+
+#endif
@@ -0,0 +1,371 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <cjson/cJSON.h>
+
+#include "metrics.h"
+#include "watch.h"
+#include "zone_map.h"
+
+#define WATCH_VALUE_SIZE 256
+
+// A place addresses are read from, shared by every record naming it
+struct watch_source {
+    char *spec;   // "iface:eth0", "file:/run/wan_ip" or "cmd:..."
+    int family;   // AF_INET, AF_INET6, or AF_UNSPEC to take the first line as is
+    int polled;   // Read during the current round
+    int failing;  // Last read produced nothing (reported once)
+    char value[WATCH_VALUE_SIZE];
+};
+
+struct watched_record {
+    char zone_id[33];
+    char type[16];
+    char *name;
+    int ttl;
+    int proxied;
+    int source;
+
+    // What the record holds, as far as the zone map and our writes know
+    int known_valid;
+    int known_proxied;
+    char known[WATCH_VALUE_SIZE];
+
+    // A differing address waiting to settle
+    char pending[WATCH_VALUE_SIZE];
+    double pending_since;
+    double retry_at; // No write before this after a failed one
+};
+
+struct watch_state {
+    struct watch_source *sources;
+    int source_count;
+    struct watched_record *records;
+    int record_count;
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_stop_signal(int signal_number) {
+    (void)signal_number;
+    stop_requested = 1;
+}
+
+// Address family a record type needs from its source
+static int type_family(const char *type) {
+    if (strcasecmp(type, "A") == 0) return AF_INET;
+    if (strcasecmp(type, "AAAA") == 0) return AF_INET6;
+    return AF_UNSPEC;
+}
+
+static void trim(char *str) {
+    size_t length = strlen(str);
+    while (length > 0 && (str[length - 1] == '\n' || str[length - 1] == '\r' || str[length - 1] == ' ' || str[length - 1] == '\t')) {
+        str[--length] = '\0';
+    }
+    size_t start = strspn(str, " \t");
+    if (start > 0) memmove(str, str + start, length - start + 1);
+}
+
+// Returns 1 if value is usable for the family, normalising addresses in place
+static int accept_value(char *value, int family) {
+    trim(value);
+    if (!*value) return 0;
+    if (family == AF_UNSPEC) return 1;
+
+    unsigned char address[sizeof(struct in6_addr)];
+    if (inet_pton(family, value, address) != 1) return 0;
+    inet_ntop(family, address, value, WATCH_VALUE_SIZE);
+    return 1;
+}
+
+// First usable line of a stream
+static int read_first_value(FILE *in, int family, char *value) {
+    char line[WATCH_VALUE_SIZE];
+    while (fgets(line, sizeof(line), in)) {
+        if (accept_value(line, family)) {
+            snprintf(value, WATCH_VALUE_SIZE, "%s", line);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// First global address of the family on an interface
+static int read_interface(const char *name, int family, char *value) {
+    if (family == AF_UNSPEC) return 0;
+
+    struct ifaddrs *addresses;
+    if (getifaddrs(&addresses) != 0) return 0;
+
+    int found = 0;
+    for (struct ifaddrs *ifa = addresses; ifa && !found; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != family || strcmp(ifa->ifa_name, name) != 0) continue;
+
+        if (family == AF_INET) {
+            const struct in_addr *address = &((const struct sockaddr_in *)ifa->ifa_addr)->sin_addr;
+            found = inet_ntop(AF_INET, address, value, WATCH_VALUE_SIZE) != NULL;
+        } else {
+            const struct in6_addr *address = &((const struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr;
+            if (IN6_IS_ADDR_LINKLOCAL(address) || IN6_IS_ADDR_LOOPBACK(address)) continue;
+            found = inet_ntop(AF_INET6, address, value, WATCH_VALUE_SIZE) != NULL;
+        }
+    }
+    freeifaddrs(addresses);
+    return found;
+}
+
+// Read a source's current value; value is emptied if it has none
+static void poll_source(struct watch_source *source) {
+    char value[WATCH_VALUE_SIZE] = "";
+    int ok = 0;
+
+    if (strncmp(source->spec, "iface:", 6) == 0) {
+        ok = read_interface(source->spec + 6, source->family, value);
+    } else if (strncmp(source->spec, "file:", 5) == 0) {
+        FILE *file = fopen(source->spec + 5, "r");
+        if (file) {
+            ok = read_first_value(file, source->family, value);
+            fclose(file);
+        }
+    } else if (strncmp(source->spec, "cmd:", 4) == 0) {
+        fflush(stdout);
+        FILE *command = popen(source->spec + 4, "r");
+        if (command) {
+            ok = read_first_value(command, source->family, value);
+            pclose(command);
+        }
+    }
+
+    if (!ok) {
+        if (!source->failing) fprintf(stderr, "Error: No usable address from %s\n", source->spec);
+        source->failing = 1;
+        source->value[0] = '\0';
+    } else {
+        source->failing = 0;
+        snprintf(source->value, sizeof(source->value), "%s", value);
+    }
+    source->polled = 1;
+}
+
+// Find or add the source for a spec and family. Returns its index or -1.
+static int add_source(struct watch_state *state, const char *spec, int family) {
+    for (int i = 0; i < state->source_count; i++) {
+        if (state->sources[i].family == family && strcmp(state->sources[i].spec, spec) == 0) return i;
+    }
+
+    struct watch_source *sources = realloc(state->sources, (state->source_count + 1) * sizeof(struct watch_source));
+    if (!sources) return -1;
+    state->sources = sources;
+
+    struct watch_source *source = &state->sources[state->source_count];
+    memset(source, 0, sizeof(*source));
+    source->spec = strdup(spec);
+    source->family = family;
+    if (!source->spec) return -1;
+    return state->source_count++;
+}
+
+// Parse "zone_id type name ttl proxied source" into a record. Returns 0 on a malformed line.
+static int parse_watch_line(struct watch_state *state, char *line, int line_number) {
+    char *zone_id = strtok(line, " \t");
+    char *type = strtok(NULL, " \t");
+    char *name = strtok(NULL, " \t");
+    char *ttl = strtok(NULL, " \t");
+    char *proxied = strtok(NULL, " \t");
+    char *spec = strtok(NULL, "\n");
+
+    if (!(zone_id && type && name && ttl && proxied && spec)) {
+        fprintf(stderr, "Error: Line %d: expected zone_id type name ttl proxied source.\n", line_number);
+        return 0;
+    }
+    trim(spec);
+    int family = type_family(type);
+    if (strncmp(spec, "iface:", 6) == 0 ? family == AF_UNSPEC
+                                        : strncmp(spec, "file:", 5) != 0 && strncmp(spec, "cmd:", 4) != 0) {
+        fprintf(stderr, "Error: Line %d: source must be iface:<name> (A/AAAA only), file:<path> or cmd:<command>.\n", line_number);
+        return 0;
+    }
+
+    struct watched_record *records = realloc(state->records, (state->record_count + 1) * sizeof(struct watched_record));
+    if (!records) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    state->records = records;
+
+    struct watched_record *record = &state->records[state->record_count];
+    memset(record, 0, sizeof(*record));
+    snprintf(record->zone_id, sizeof(record->zone_id), "%s", zone_id);
+    snprintf(record->type, sizeof(record->type), "%s", type);
+    record->name = strdup(name);
+    record->ttl = atoi(ttl);
+    record->proxied = atoi(proxied) ? 1 : 0;
+    record->source = add_source(state, spec, family);
+    if (!record->name || record->source < 0) {
+        free(record->name);
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    state->record_count++;
+    return 1;
+}
+
+static int load_watch_file(struct watch_state *state, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return 0;
+    }
+
+    char line[1024];
+    int line_number = 0, ok = 1;
+    while (ok && fgets(line, sizeof(line), file)) {
+        line_number++;
+        char *start = line + strspn(line, " \t");
+        if (*start == '#' || *start == '\n' || *start == '\0') continue;
+        ok = parse_watch_line(state, start, line_number);
+    }
+    fclose(file);
+    return ok;
+}
+
+// Take what the zone map says a record holds as its known state
+static void seed_from_zone_map(struct watched_record *record) {
+    ZoneMap entry;
+    record->known_valid = get_zone_entry(find_domain(record->name), &entry) &&
+                          strcmp(entry.zone_id, record->zone_id) == 0;
+    if (record->known_valid) {
+        snprintf(record->known, sizeof(record->known), "%s", entry.ip_address);
+        record->known_proxied = entry.proxied;
+    }
+}
+
+static void print_update(const struct watched_record *record, const char *to) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "watch", "update");
+    cJSON_AddStringToObject(json, "name", record->name);
+    cJSON_AddStringToObject(json, "type", record->type);
+    cJSON_AddStringToObject(json, "from", record->known_valid ? record->known : "");
+    cJSON_AddStringToObject(json, "to", to);
+
+    char *line = cJSON_PrintUnformatted(json);
+    if (line) {
+        printf("%s\n", line);
+        free(line);
+    }
+    cJSON_Delete(json);
+}
+
+// Compare a record with its source and write it once a differing value has
+// settled. Returns 0 if a write was attempted and failed.
+static int check_record(struct watched_record *record, const struct watch_source *source, double now,
+                        int settle, int interval, watch_write_fn write) {
+    const char *value = source->value;
+    if (!source->polled || !*value) return 1;
+
+    if (record->known_valid && strcmp(record->known, value) == 0 && record->known_proxied == record->proxied) {
+        record->pending[0] = '\0'; // Changed back before it settled, or never changed
+        return 1;
+    }
+
+    // Any new value restarts the settle period, folding bursts into one write
+    if (strcmp(record->pending, value) != 0) {
+        snprintf(record->pending, sizeof(record->pending), "%s", value);
+        record->pending_since = now;
+    }
+    if (now - record->pending_since < settle || now < record->retry_at) return 1;
+
+    print_update(record, value);
+    write(record->zone_id, record->type, record->name, value, record->ttl, record->proxied);
+
+    // The zone map is updated only by a successful write
+    seed_from_zone_map(record);
+    if (record->known_valid && strcmp(record->known, value) == 0 && record->known_proxied == record->proxied) {
+        record->pending[0] = '\0';
+        record->retry_at = 0;
+        return 1;
+    }
+    fprintf(stderr, "Error: Update of %s failed; retrying in %ds.\n", record->name, interval);
+    record->retry_at = now + interval;
+    return 0;
+}
+
+static void free_watch_state(struct watch_state *state) {
+    for (int i = 0; i < state->source_count; i++) free(state->sources[i].spec);
+    for (int i = 0; i < state->record_count; i++) free(state->records[i].name);
+    free(state->sources);
+    free(state->records);
+}
+
+static void sleep_until(double deadline) {
+    double seconds = deadline - metrics_now();
+    if (seconds <= 0) return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL); // Cut short by SIGINT/SIGTERM
+}
+
+int watch_records(const char *path, int interval, int settle, int once, watch_write_fn write) {
+    struct watch_state state = {NULL, 0, NULL, 0};
+    if (!load_watch_file(&state, path)) {
+        free_watch_state(&state);
+        return 0;
+    }
+    if (interval < 1) interval = DEFAULT_WATCH_INTERVAL;
+    if (settle < 0 || once) settle = 0;
+
+    load_zone_map_once();
+    for (int i = 0; i < state.record_count; i++) seed_from_zone_map(&state.records[i]);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int ok = 1;
+    double next_poll = 0;
+    while (!stop_requested) {
+        double now = metrics_now();
+        int full_poll = now >= next_poll;
+        if (full_poll) next_poll = now + interval;
+
+        // Between full polls, only sources with a value waiting to settle are read again
+        for (int s = 0; s < state.source_count; s++) state.sources[s].polled = 0;
+        for (int i = 0; i < state.record_count; i++) {
+            struct watch_source *source = &state.sources[state.records[i].source];
+            if (!source->polled && (full_poll || state.records[i].pending[0])) poll_source(source);
+        }
+
+        ok = 1;
+        double wake = next_poll;
+        for (int i = 0; i < state.record_count && !stop_requested; i++) {
+            struct watched_record *record = &state.records[i];
+            if (!check_record(record, &state.sources[record->source], metrics_now(), settle, interval, write)) ok = 0;
+            if (record->pending[0]) {
+                double due = record->pending_since + settle;
+                if (record->retry_at > due) due = record->retry_at;
+                if (due < metrics_now() + 1) due = metrics_now() + 1; // A failing source is not polled in a tight loop
+                if (due < wake) wake = due;
+            }
+        }
+
+        flush_zone_map();
+        metrics_tick();
+        fflush(stdout);
+        if (once) break;
+        sleep_until(wake);
+    }
+
+    free_watch_state(&state);
+    return ok;
+}
@@ -0,0 +1,24 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#define DEFAULT_WATCH_INTERVAL 30 // Seconds between polls of the address sources
+#define DEFAULT_WATCH_SETTLE 10   // Seconds a new address must hold before it is written
+
+// Writes one record through the API and the zone map (add_update_record).
+// The watcher checks the zone map afterwards to learn whether it succeeded.
+typedef void (*watch_write_fn)(const char *zone_id, const char *type, const char *name, const char *content,
+                               int ttl, int proxied);
+
+// Keep DNS records in step with local addresses. Each line of the watch file is
+//   zone_id type name ttl proxied source
+// where source is iface:<interface>, file:<path> or cmd:<shell command> (the
+// rest of the line). Each distinct source is polled once every interval
+// seconds and its first address of the record's family is used. What each
+// record holds now is seeded from the zone map, so nothing is sent until an
+// address differs from it; a new address is written once it has held for
+// settle seconds, which folds bursts of changes into one write. With once set,
+// polls a single time and writes right away.
+// Runs until SIGINT or SIGTERM. Returns 1 if the last round of writes succeeded.
+int watch_records(const char *path, int interval, int settle, int once, watch_write_fn write);
+
+#endif
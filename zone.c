@@ -1,309 +1,550 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <curl/curl.h>
 #include <cjson/cJSON.h>
 
-#define CONFIG_FILE "config.txt"    // Configuration file path
-#define ZONE_MAP_FILE "zone_map.txt" // Zone map file path
-#define API_URL "https://api.cloudflare.com/client/v4"
+#include "account.h"
+#include "api.h"
+#include "config.h"
+#include "http.h"
+#include "metrics.h"
+#include "zone_map.h"
+#include "zone_query.h"
 
-// Global variables for API credentials
-char API_KEY[256] = "";
-char EMAIL[256] = "";
-
-// Structure to hold domain-to-zone mappings along with record ID, proxied status, and IP address
+// A zone whose records are being fetched, and its fingerprint so far
 typedef struct {
-    char domain[256];
-    char zone_id[256];
-    char record_id[256];
-    int proxied; // 0 or 1 (not proxied or proxied)
-    char ip_address[256];
-} ZoneMap;
-
-ZoneMap *zone_map = NULL;
-int zone_map_size = 0;
-
-// Helper structure for holding HTTP response
-struct memory {
-    char *response;
-    size_t size;
-};
+    ZoneFingerprint fingerprint;
+    int previous; // Index into the refresh's previous fingerprints for a cached zone, -1 otherwise
+} ZoneSource;
 
-// Write callback for libcurl
-static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
-    size_t realsize = size * nmemb;
-    struct memory *mem = (struct memory *)userp;
+// A per_page=1 probe of a cached zone's records in flight
+typedef struct ZoneCrawl ZoneCrawl;
+typedef struct {
+    ZoneCrawl *state;
+    int previous;
+    int account;
+    char zone_modified_on[40];
+} ZoneProbe;
 
-    char *ptr = realloc(mem->response, mem->size + realsize + 1);
-    if (ptr == NULL) return 0; // Out of memory
+// A record of a cached zone, held until the zone's listing is complete
+typedef struct {
+    char id[64];
+    char *name;
+    char *content; // NULL when the record had no content
+    int proxied;
+} StagedRecord;
+
+// State shared by the list_zones and refresh callbacks
+struct ZoneCrawl {
+    ApiCrawl *crawl;
+    HttpBatch *batch;
+    ZoneSource *sources; // One per crawl source; zone_id is "" for /zones listings
+    int sources_capacity;
+    int listings;        // Sources before this are the /zones listings, one per account
+    int settled;         // Sources before this have been compared with their fingerprints
+
+    // Incremental refresh only: fingerprints from the last run, sorted by zone ID
+    ZoneFingerprint *previous;
+    int *previous_state; // PREVIOUS_* for each previous fingerprint
+    int previous_count;
+    int new_zones;       // Listed zones without a fingerprint
+    int check_failures;
+
+    // Records of the cached zone now arriving; merged only if the zone changed
+    StagedRecord *staged;
+    int staged_count;
+    int staged_capacity;
+    int staged_source;
+    int staged_lost;     // A record could not be held, so the zone can't be compared
+};
 
-    mem->response = ptr;
-    memcpy(&(mem->response[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->response[mem->size] = '\0';
+// What a refresh decided about a zone it had a fingerprint for
+#define PREVIOUS_UNSEEN 0    // Not (yet) in the /zones listing
+#define PREVIOUS_KEPT 1      // Unchanged, or could not be checked; its cached records stay
+#define PREVIOUS_REFETCHED 2 // Changed; its cached records were replaced
+
+// Function to print a DNS record and merge it into the zone map
+static void merge_zone_entry(const char *zone_id, const char *name, const char *record_id, int proxied,
+                             const char *content) {
+    printf("Domain/Subdomain: %s, Zone ID: %s, Record ID: %s, Proxied: %d, IP: %s\n",
+           name, zone_id, record_id, proxied, content ? content : "N/A");
+    update_zone_map(name, zone_id, record_id, proxied, content ? content : "");
+}
 
-    return realsize;
+// Function to print one of a zone's DNS records and merge it into the zone map
+void merge_zone_record(const char *zone_id, const DnsRecord *record) {
+    if (record->id[0] == '\0' || record->name[0] == '\0') return;
+    merge_zone_entry(zone_id, record->name, record->id, record->proxied, record->has_content ? record->content : NULL);
 }
 
-// Function to load API key and email from configuration file
-int load_config() {
-    FILE *file = fopen(CONFIG_FILE, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Error: Could not open configuration file: %s\n", CONFIG_FILE);
-        return 0;
+// FNV-1a of one field, ending with a separator so adjacent fields can't run together
+static uint64_t hash_field(uint64_t hash, const char *value) {
+    for (const char *p = value;; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+        if (*p == '\0') return hash;
     }
+}
 
-    char line[512];
-    while (fgets(line, sizeof(line), file)) {
-        char *key = strtok(line, "=");
-        char *value = strtok(NULL, "\n");
+// Hash of the fields of a record the map and its fingerprint depend on. The
+// fingerprint sums these, so the order the API lists records in doesn't matter.
+static uint64_t hash_record(const DnsRecord *record) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_field(hash, record->id);
+    hash = hash_field(hash, record->name);
+    hash = hash_field(hash, record->has_content ? record->content : "");
+    hash = hash_field(hash, record->proxied ? "1" : "0");
+    return hash_field(hash, record->modified_on);
+}
 
-        if (key && value) {
-            if (strcmp(key, "API_KEY") == 0) {
-                strncpy(API_KEY, value, sizeof(API_KEY) - 1);
-            } else if (strcmp(key, "EMAIL") == 0) {
-                strncpy(EMAIL, value, sizeof(EMAIL) - 1);
-            }
+static int compare_fingerprints(const void *a, const void *b) {
+    return strcmp(((const ZoneFingerprint *)a)->zone_id, ((const ZoneFingerprint *)b)->zone_id);
+}
+
+// Queue the full dns_records listing of a zone. previous is the index of its
+// fingerprint when a refresh is checking a cached zone, -1 otherwise.
+static void fetch_zone_records(ZoneCrawl *state, const char *zone_id, int previous, const char *zone_modified_on) {
+    char record_url[512];
+    snprintf(record_url, sizeof(record_url), "%s/zones/%s/dns_records", API_URL, zone_id);
+    int source = api_crawl_add_records(state->crawl, record_url, DNS_RECORDS_PER_PAGE);
+    if (source < 0) return;
+
+    if (source >= state->sources_capacity) {
+        int capacity = state->sources_capacity ? state->sources_capacity * 2 : 64;
+        while (capacity <= source) capacity *= 2;
+        ZoneSource *sources = realloc(state->sources, capacity * sizeof(ZoneSource));
+        if (!sources) {
+            fprintf(stderr, "Memory allocation error\n");
+            return;
         }
+        memset(&sources[state->sources_capacity], 0, (capacity - state->sources_capacity) * sizeof(ZoneSource));
+        state->sources = sources;
+        state->sources_capacity = capacity;
     }
+    ZoneFingerprint *fingerprint = &state->sources[source].fingerprint;
+    snprintf(fingerprint->zone_id, sizeof(fingerprint->zone_id), "%s", zone_id);
+    snprintf(fingerprint->zone_modified_on, sizeof(fingerprint->zone_modified_on), "%s", zone_modified_on);
+    state->sources[source].previous = previous;
+}
 
-    fclose(file);
-
-    if (strlen(API_KEY) == 0 || strlen(EMAIL) == 0) {
-        fprintf(stderr, "Error: API_KEY and EMAIL must be set in the configuration file.\n");
-        return 0;
+static void clear_staged(ZoneCrawl *state) {
+    for (int i = 0; i < state->staged_count; i++) {
+        free(state->staged[i].name);
+        free(state->staged[i].content);
     }
-
-    return 1;
+    state->staged_count = 0;
+    state->staged_lost = 0;
+    state->staged_source = -1;
 }
 
-// Function to load zone map from file
-void load_zone_map() {
-    FILE *file = fopen(ZONE_MAP_FILE, "r");
-    if (file == NULL) return;
-
-    char line[512];
-    while (fgets(line, sizeof(line), file)) {
-        char *domain = strtok(line, " ");
-        char *zone_id = strtok(NULL, " ");
-        char *record_id = strtok(NULL, " ");
-        char *proxied = strtok(NULL, " ");
-        char *ip_address = strtok(NULL, "\n");
-
-        if (domain && zone_id && record_id && proxied && ip_address) {
-            zone_map = realloc(zone_map, (zone_map_size + 1) * sizeof(ZoneMap));
-            if (zone_map == NULL) {
-                fprintf(stderr, "Memory allocation error\n");
-                return;
-            }
+// Hold a record of a cached zone until its listing is complete
+static void stage_record(ZoneCrawl *state, int source, const DnsRecord *record) {
+    if (state->staged_source != source) {
+        clear_staged(state);
+        state->staged_source = source;
+    }
+    if (record->id[0] == '\0' || record->name[0] == '\0') return;
 
-            strncpy(zone_map[zone_map_size].domain, domain, sizeof(zone_map[zone_map_size].domain) - 1);
-            strncpy(zone_map[zone_map_size].zone_id, zone_id, sizeof(zone_map[zone_map_size].zone_id) - 1);
-            strncpy(zone_map[zone_map_size].record_id, record_id, sizeof(zone_map[zone_map_size].record_id) - 1);
-            zone_map[zone_map_size].proxied = atoi(proxied);
-            strncpy(zone_map[zone_map_size].ip_address, ip_address, sizeof(zone_map[zone_map_size].ip_address) - 1);
-            zone_map_size++;
+    if (state->staged_count == state->staged_capacity) {
+        int capacity = state->staged_capacity ? state->staged_capacity * 2 : 256;
+        StagedRecord *staged = realloc(state->staged, capacity * sizeof(StagedRecord));
+        if (!staged) {
+            state->staged_lost = 1;
+            return;
         }
+        state->staged = staged;
+        state->staged_capacity = capacity;
     }
 
-    fclose(file);
-}
-
-// Function to save zone map to file
-void save_zone_map() {
-    FILE *file = fopen(ZONE_MAP_FILE, "w");
-    if (file == NULL) {
-        fprintf(stderr, "Error: Could not open zone map file for writing.\n");
+    StagedRecord *staged = &state->staged[state->staged_count];
+    snprintf(staged->id, sizeof(staged->id), "%s", record->id);
+    staged->proxied = record->proxied;
+    staged->name = strdup(record->name);
+    staged->content = record->has_content ? strdup(record->content) : NULL;
+    if (!staged->name || (record->has_content && !staged->content)) {
+        free(staged->name);
+        free(staged->content);
+        state->staged_lost = 1;
         return;
     }
+    state->staged_count++;
+}
 
-    for (int i = 0; i < zone_map_size; i++) {
-        fprintf(file, "%s %s %s %d %s\n", zone_map[i].domain, zone_map[i].zone_id, zone_map[i].record_id, zone_map[i].proxied, zone_map[i].ip_address);
+// Compare a cached zone's fresh listing with its fingerprint: an unchanged zone
+// keeps its cached entries, a changed one has them replaced by the listing.
+// complete is 0 when the crawl stopped early, so the listing may be cut short.
+static void settle_source(ZoneCrawl *state, int source, int complete) {
+    ZoneSource *zone = &state->sources[source];
+    if (zone->fingerprint.zone_id[0] == '\0' || zone->previous < 0) return; // New zones merge as they arrive
+
+    ZoneFingerprint *previous = &state->previous[zone->previous];
+    const ZoneFingerprint *current = &zone->fingerprint;
+    int staged = state->staged_source == source;
+
+    if (!complete || api_crawl_failed(state->crawl, source) || (staged && state->staged_lost)) {
+        fprintf(stderr, "Error: Could not check zone %s, keeping its cached records.\n", previous->zone_id);
+        state->check_failures++;
+        state->previous_state[zone->previous] = PREVIOUS_KEPT;
+        zone->fingerprint.zone_id[0] = '\0'; // The old fingerprint is saved instead
+    } else if (current->record_count == previous->record_count && current->hash == previous->hash &&
+               strcmp(current->modified_on, previous->modified_on) == 0) {
+        // The old fingerprint is saved, with the signal that moved brought up to date
+        state->previous_state[zone->previous] = PREVIOUS_KEPT;
+        memcpy(previous->zone_modified_on, current->zone_modified_on, sizeof(previous->zone_modified_on));
+        zone->fingerprint.zone_id[0] = '\0';
+    } else {
+        state->previous_state[zone->previous] = PREVIOUS_REFETCHED;
+        remove_zone_map_zone(current->zone_id);
+        for (int i = 0; staged && i < state->staged_count; i++) {
+            const StagedRecord *record = &state->staged[i];
+            merge_zone_entry(current->zone_id, record->name, record->id, record->proxied, record->content);
+        }
     }
+    if (staged) clear_staged(state);
+}
 
-    fclose(file);
+// Settle every source before end; records arrive in source order, so those are complete
+static void settle_sources(ZoneCrawl *state, int end, int complete) {
+    for (; state->settled < end && state->settled < state->sources_capacity; state->settled++) {
+        settle_source(state, state->settled, complete);
+    }
 }
 
-// Function to update the zone map with a new mapping
-void update_zone_map(const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address) {
-    for (int i = 0; i < zone_map_size; i++) {
-        if (strcmp(zone_map[i].domain, domain) == 0) {
-            if (strcmp(zone_map[i].zone_id, zone_id) != 0) {
-                strncpy(zone_map[i].zone_id, zone_id, sizeof(zone_map[i].zone_id) - 1);
-                strncpy(zone_map[i].record_id, record_id, sizeof(zone_map[i].record_id) - 1);
-                zone_map[i].proxied = proxied;
-                strncpy(zone_map[i].ip_address, ip_address, sizeof(zone_map[i].ip_address) - 1);
-                save_zone_map();
-            }
-            return;
-        }
+// Completion callback for a zone probe: keep the zone's cached records if its
+// record count still matches, otherwise list the zone in full
+static void on_zone_probe(char *response, long status, void *userdata) {
+    ZoneProbe *probe = (ZoneProbe *)userdata;
+    ZoneCrawl *state = probe->state;
+    const ZoneFingerprint *previous = &state->previous[probe->previous];
+
+    cJSON *json = (response && status < 400) ? cJSON_Parse(response) : NULL;
+    free(response);
+    cJSON *total_count = cJSON_GetObjectItem(cJSON_GetObjectItem(json, "result_info"), "total_count");
+
+    if (!cJSON_IsNumber(total_count)) {
+        fprintf(stderr, "Error: Could not check zone %s, keeping its cached records.\n", previous->zone_id);
+        state->check_failures++;
+    } else if (total_count->valueint != previous->record_count) {
+        // Listed with the zone's own token, whichever account the batch is on now
+        int account = http_batch_account(state->batch);
+        http_batch_set_account(state->batch, probe->account);
+        fetch_zone_records(state, previous->zone_id, probe->previous, probe->zone_modified_on);
+        http_batch_set_account(state->batch, account);
     }
+    cJSON_Delete(json);
+    free(probe);
+}
 
-    // New entry
-    zone_map = realloc(zone_map, (zone_map_size + 1) * sizeof(ZoneMap));
-    if (zone_map == NULL) {
+// Ask a cached zone for one record, to learn its record count
+static void probe_zone(ZoneCrawl *state, int previous, int account, const char *zone_modified_on) {
+    ZoneProbe *probe = malloc(sizeof(ZoneProbe));
+    if (!probe) {
         fprintf(stderr, "Memory allocation error\n");
+        state->check_failures++;
         return;
     }
-    strncpy(zone_map[zone_map_size].domain, domain, sizeof(zone_map[zone_map_size].domain) - 1);
-    strncpy(zone_map[zone_map_size].zone_id, zone_id, sizeof(zone_map[zone_map_size].zone_id) - 1);
-    strncpy(zone_map[zone_map_size].record_id, record_id, sizeof(zone_map[zone_map_size].record_id) - 1);
-    zone_map[zone_map_size].proxied = proxied;
-    strncpy(zone_map[zone_map_size].ip_address, ip_address, sizeof(zone_map[zone_map_size].ip_address) - 1);
-    zone_map_size++;
-    save_zone_map();
+    probe->state = state;
+    probe->previous = previous;
+    probe->account = account;
+    snprintf(probe->zone_modified_on, sizeof(probe->zone_modified_on), "%s", zone_modified_on);
+
+    char url[512];
+    snprintf(url, sizeof(url), "%s/zones/%s/dns_records?per_page=1", API_URL, state->previous[previous].zone_id);
+    if (!http_batch_add(state->batch, url, "GET", NULL, on_zone_probe, probe)) {
+        fprintf(stderr, "Error: Could not check zone %s, keeping its cached records.\n", state->previous[previous].zone_id);
+        state->check_failures++;
+        free(probe);
+    }
 }
 
-// Function to make HTTP requests
-char *make_request(const char *url, const char *method, const char *payload) {
-    CURL *curl;
-    CURLcode res;
-    struct curl_slist *headers = NULL;
-    struct memory chunk = {NULL, 0};
-
-    curl = curl_easy_init();
-    if (curl) {
-        headers = curl_slist_append(headers, "Content-Type: application/json");
-        headers = curl_slist_append(headers, "Accept: application/json");
-
-        char auth_header[256];
-        snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", API_KEY);
-        headers = curl_slist_append(headers, auth_header);
-
-        curl_easy_setopt(curl, CURLOPT_URL, url);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&chunk);
-
-        if (strcmp(method, "POST") == 0 || strcmp(method, "PUT") == 0) {
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, payload);
-            if (strcmp(method, "PUT") == 0) {
-                curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
-            }
-        } else if (strcmp(method, "DELETE") == 0) {
-            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");
+// Queue the records of every zone on a /zones page. They go out with the
+// token of the account whose listing it is. A cached zone is only listed in
+// full when its modified_on or its record count moved.
+static void queue_zone_records(ZoneCrawl *state, int account, cJSON *zones_json) {
+    cJSON *result = cJSON_GetObjectItem(zones_json, "result");
+    if (!cJSON_IsArray(result)) {
+        fprintf(stderr, "Error: Invalid response structure.\n");
+        return;
+    }
+    http_batch_set_account(state->batch, account);
+
+    cJSON *zone;
+    cJSON_ArrayForEach(zone, result) {
+        cJSON *zone_id = cJSON_GetObjectItem(zone, "id");
+        cJSON *zone_name = cJSON_GetObjectItem(zone, "name");
+        cJSON *zone_modified = cJSON_GetObjectItem(zone, "modified_on");
+        if (!cJSON_IsString(zone_id) || !cJSON_IsString(zone_name)) continue;
+        account_learn_zone(zone_id->valuestring, account);
+        const char *modified_on = cJSON_IsString(zone_modified) ? zone_modified->valuestring : "";
+
+        ZoneFingerprint *found = NULL;
+        if (state->previous_count > 0 && strlen(zone_id->valuestring) < sizeof(found->zone_id)) {
+            ZoneFingerprint key;
+            strcpy(key.zone_id, zone_id->valuestring);
+            found = bsearch(&key, state->previous, state->previous_count, sizeof(ZoneFingerprint), compare_fingerprints);
         }
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            fprintf(stderr, "curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+        if (found && state->previous_state[found - state->previous] == PREVIOUS_UNSEEN) {
+            int previous = found - state->previous;
+            // Kept unless the probe or the listing finds it changed
+            state->previous_state[previous] = PREVIOUS_KEPT;
+            if (modified_on[0] && strcmp(modified_on, found->zone_modified_on) == 0) {
+                probe_zone(state, previous, account, modified_on);
+            } else {
+                fetch_zone_records(state, zone_id->valuestring, previous, modified_on);
+            }
+        } else if (!found) {
+            state->new_zones++;
+            fetch_zone_records(state, zone_id->valuestring, -1, modified_on);
         }
-
-        curl_easy_cleanup(curl);
     }
+}
+
+// Page callback for the /zones listing
+static void on_crawl_page(int source, int page, cJSON *json, void *userdata) {
+    ZoneCrawl *state = (ZoneCrawl *)userdata;
+    (void)page;
 
-    return chunk.response;
+    if (source < state->listings) {
+        queue_zone_records(state, api_crawl_account(state->crawl, source), json);
+    }
 }
 
-// Function to list zones
-void list_zones() {
-    // Delete the existing zone_map.txt file to ensure all new records are input
-    if (remove(ZONE_MAP_FILE) == 0) {
-        printf("Deleted existing zone_map.txt to input all new records.\n");
+// Record callback for the dns_records listings; records arrive in (source, page) order
+static void on_crawl_record(int source, int page, const DnsRecord *record, void *userdata) {
+    ZoneCrawl *state = (ZoneCrawl *)userdata;
+    (void)page;
+
+    if (source >= state->sources_capacity || !state->sources[source].fingerprint.zone_id[0]) return;
+    settle_sources(state, source, 1);
+
+    ZoneSource *zone = &state->sources[source];
+    zone->fingerprint.record_count++;
+    zone->fingerprint.hash += hash_record(record);
+    if (strcmp(record->modified_on, zone->fingerprint.modified_on) > 0) {
+        snprintf(zone->fingerprint.modified_on, sizeof(zone->fingerprint.modified_on), "%s", record->modified_on);
+    }
+
+    if (zone->previous < 0) {
+        merge_zone_record(zone->fingerprint.zone_id, record);
     } else {
-        printf("zone_map.txt does not exist or could not be deleted. Proceeding to fetch records.\n");
+        stage_record(state, source, record);
     }
+}
 
-    // Reset the in-memory zone map
-    free(zone_map);
-    zone_map = NULL;
-    zone_map_size = 0;
+// Function to crawl /zones and the records of every zone that needs fetching,
+// then save the map and the fingerprints of what it now holds. A full rebuild
+// (no previous fingerprints) that did not list everything saves nothing, so the
+// old files stay in place. Returns 0 if nothing was saved.
+static int crawl_zones(ZoneCrawl *state) {
+    // A rebuild is a single batch, so it bypasses the journal
+    int journal_mode = ZONE_MAP_JOURNAL_MODE;
+    ZONE_MAP_JOURNAL_MODE = 0;
+    state->staged_source = -1;
+
+    state->batch = http_batch_create(MAX_IN_FLIGHT);
+    if (state->batch) {
+        http_batch_set_priority(state->batch, HTTP_PRIORITY_BULK);
+        state->crawl = api_crawl_create(state->batch, http_batch_capacity(state->batch) * 2, on_crawl_page, state);
+        api_crawl_set_record_callback(state->crawl, on_crawl_record);
+    }
+    if (!state->crawl) {
+        ZONE_MAP_JOURNAL_MODE = journal_mode;
+        http_batch_free(state->batch);
+        return 0;
+    }
 
+    // Every page of each account's /zones and of each zone's dns_records is
+    // fetched concurrently; records are parsed and merged in order as they stream in
     char url[512];
     snprintf(url, sizeof(url), "%s/zones", API_URL);
-    char *response = make_request(url, "GET", NULL);
-
-    if (response) {
-        cJSON *json = cJSON_Parse(response);
-        if (json) {
-            cJSON *result = cJSON_GetObjectItem(json, "result");
-            if (cJSON_IsArray(result)) {
-                cJSON *zone;
-                cJSON_ArrayForEach(zone, result) {
-                    cJSON *zone_id = cJSON_GetObjectItem(zone, "id");
-                    cJSON *zone_name = cJSON_GetObjectItem(zone, "name");
-
-                    if (cJSON_IsString(zone_id) && cJSON_IsString(zone_name)) {
-                        // Fetch DNS records for the zone
-                        char record_url[512];
-                        snprintf(record_url, sizeof(record_url), "%s/zones/%s/dns_records", API_URL, zone_id->valuestring);
-                        char *records_response = make_request(record_url, "GET", NULL);
-
-                        if (records_response) {
-                            cJSON *records_json = cJSON_Parse(records_response);
-                            if (records_json) {
-                                cJSON *records_result = cJSON_GetObjectItem(records_json, "result");
-                                if (cJSON_IsArray(records_result)) {
-                                    cJSON *record;
-                                    cJSON_ArrayForEach(record, records_result) {
-                                        cJSON *record_id = cJSON_GetObjectItem(record, "id");
-                                        cJSON *name = cJSON_GetObjectItem(record, "name");
-                                        cJSON *proxied = cJSON_GetObjectItem(record, "proxied");
-                                        cJSON *content = cJSON_GetObjectItem(record, "content");
-
-                                        if (cJSON_IsString(record_id) && cJSON_IsString(name)) {
-                                            printf("Domain/Subdomain: %s, Zone ID: %s, Record ID: %s, Proxied: %d, IP: %s\n",
-                                                   name->valuestring, zone_id->valuestring, record_id->valuestring,
-                                                   proxied ? proxied->valueint : 0, content ? content->valuestring : "N/A");
-                                            update_zone_map(name->valuestring, zone_id->valuestring, record_id->valuestring,
-                                                            proxied ? proxied->valueint : 0, content ? content->valuestring : "");
-                                        }
-                                    }
-                                }
-                                cJSON_Delete(records_json);
-                            }
-                            free(records_response);
-                        }
-                    }
-                }
-            }
-            cJSON_Delete(json);
+    int complete = 1;
+    state->listings = http_account_count();
+    for (int account = 0; account < state->listings; account++) {
+        http_batch_set_account(state->batch, account);
+        if (api_crawl_add(state->crawl, url, ZONES_PER_PAGE) != account) complete = 0;
+    }
+    complete = complete && api_crawl_run(state->crawl);
+    if (!complete) {
+        fprintf(stderr, "Error: Zone crawl did not complete.\n");
+    }
+    settle_sources(state, state->sources_capacity, complete);
+    clear_staged(state);
+    free(state->staged);
+    account_save_zones();
+
+    // Zones gone from complete listings are gone from the accounts
+    int listed = complete;
+    for (int account = 0; account < state->listings; account++) {
+        if (api_crawl_failed(state->crawl, account)) listed = 0;
+    }
+
+    // A rebuild has no cached records to fall back on for a zone it missed
+    if (!state->previous_state) {
+        int saved = listed;
+        for (int source = state->listings; saved && source < state->sources_capacity; source++) {
+            if (state->sources[source].fingerprint.zone_id[0] && api_crawl_failed(state->crawl, source)) saved = 0;
+        }
+        if (!saved) {
+            fprintf(stderr, "Error: Not every zone could be listed; %s was left unchanged.\n",
+                    ZONE_MAP_BINARY_MODE ? ZONE_MAP_BIN_FILE : ZONE_MAP_FILE);
+            ZONE_MAP_JOURNAL_MODE = journal_mode;
+            http_batch_free(state->batch);
+            api_crawl_free(state->crawl);
+            free(state->sources);
+            return 0;
+        }
+    }
+    int count = 0;
+    ZoneFingerprint *fingerprints = malloc((state->previous_count + state->sources_capacity + 1) * sizeof(ZoneFingerprint));
+    for (int i = 0; i < state->previous_count; i++) {
+        if (state->previous_state[i] == PREVIOUS_KEPT || (state->previous_state[i] == PREVIOUS_UNSEEN && !listed)) {
+            if (fingerprints) fingerprints[count++] = state->previous[i];
+        } else if (state->previous_state[i] == PREVIOUS_UNSEEN) {
+            remove_zone_map_zone(state->previous[i].zone_id);
         }
-        free(response);
     }
+    // A zone whose listing failed gets no fingerprint, so the next refresh fetches it again
+    for (int source = state->listings; source < state->sources_capacity; source++) {
+        const ZoneFingerprint *fingerprint = &state->sources[source].fingerprint;
+        if (fingerprint->zone_id[0] && !api_crawl_failed(state->crawl, source) && fingerprints) {
+            fingerprints[count++] = *fingerprint;
+        }
+    }
+
+    // Write the map in one go (and retire any journal), then the fingerprints it matches
+    ZONE_MAP_JOURNAL_MODE = journal_mode;
+    int saved = compact_zone_map();
+    if (!saved) {
+        fprintf(stderr, "Error: Zone map was not saved.\n");
+    } else if (!fingerprints || !save_zone_fingerprints(fingerprints, count)) {
+        remove(ZONE_STATE_FILE);
+    }
+
+    free(fingerprints);
+    http_batch_free(state->batch);
+    api_crawl_free(state->crawl);
+    free(state->sources);
+    return saved;
+}
+
+// Function to list zones. Returns 0 if the map could not be rebuilt.
+int list_zones() {
+    // Rebuild the map from scratch; the old zone_map.txt stays in place unless
+    // every zone was listed and the new one renamed over it
+    printf("Rebuilding zone_map.txt from all current records.\n");
+    reset_zone_map();
+
+    ZoneCrawl state;
+    memset(&state, 0, sizeof(state));
+    return crawl_zones(&state);
 }
 
+// Function to bring the zone map up to date, fetching only the zones whose
+// records changed since the last list_zones or refresh. Returns 0 if the map
+// could not be saved.
+int refresh_zones() {
+    ZoneCrawl state;
+    memset(&state, 0, sizeof(state));
+
+    // Fingerprints only describe a map that is still there
+    load_zone_map();
+    if (zone_map_size > 0) {
+        state.previous_count = load_zone_fingerprints(&state.previous);
+    }
+    state.previous_state = calloc(state.previous_count + 1, sizeof(int));
+    if (!state.previous_state) {
+        fprintf(stderr, "Memory allocation error\n");
+        free(state.previous);
+        return 0;
+    }
+    qsort(state.previous, state.previous_count, sizeof(ZoneFingerprint), compare_fingerprints);
+
+    int saved = crawl_zones(&state);
+
+    int kept = 0, refetched = 0;
+    for (int i = 0; i < state.previous_count; i++) {
+        if (state.previous_state[i] == PREVIOUS_KEPT) kept++;
+        else if (state.previous_state[i] == PREVIOUS_REFETCHED) refetched++;
+    }
+    printf("Refreshed zone_map.txt: %d zones unchanged, %d changed, %d new",
+           kept - state.check_failures, refetched, state.new_zones);
+    if (state.check_failures > 0) printf(", %d could not be checked", state.check_failures);
+    printf(".\n");
+
+    free(state.previous);
+    free(state.previous_state);
+    return saved;
+}
 
 // Function to display record details for a domain/subdomain
 void display_record(const char *domain) {
-    for (int i = 0; i < zone_map_size; i++) {
-        if (strcmp(zone_map[i].domain, domain) == 0) {
-            printf("Domain/Subdomain: %s\n", domain);
-            printf("Zone ID: %s\n", zone_map[i].zone_id);
-            printf("Record ID: %s\n", zone_map[i].record_id);
-            printf("Proxied: %d\n", zone_map[i].proxied);
-            printf("IP: %s\n", zone_map[i].ip_address);
-            return;
-        }
+    ZoneMap entry;
+    const ZoneMap *found = NULL;
+
+    // A binary map answers straight from the file; otherwise load and index it
+    int result = lookup_zone_map_file(domain, &entry);
+    if (result > 0) {
+        found = &entry;
+    } else if (result < 0) {
+        load_zone_map();
+        if (get_zone_entry(find_domain(domain), &entry)) found = &entry;
+    }
+
+    if (!found) {
+        printf("Domain/Subdomain not found.\n");
+        return;
     }
-    printf("Domain/Subdomain not found.\n");
+
+    printf("Domain/Subdomain: %s\n", domain);
+    printf("Zone ID: %s\n", found->zone_id);
+    printf("Record ID: %s\n", found->record_id);
+    printf("Proxied: %d\n", found->proxied);
+    printf("IP: %s\n", found->ip_address);
 }
 
 int main(int argc, char *argv[]) {
-    if (!load_config()) {
+    if (!load_config(NULL)) {
         return 1;
     }
 
-    load_zone_map();
+    metrics_init();
+    if (!http_init(API_KEY)) {
+        return 1;
+    }
 
     if (argc < 2) {
         printf("Usage: ./map <command> [args]\n");
         printf("Commands:\n");
         printf("  list_zones\n");
+        printf("  refresh\n");
         printf("  display_record <domain/subdomain>\n");
+        printf("  query [--name <fqdn|*.domain>] [--suffix <domain>] [--content <value>] [--type <type>] [--zone <zone_id>] [--proxied 0|1] [--limit <n>] [--count]\n");
+        printf("  compact\n");
         return 1;
     }
 
     const char *command = argv[1];
 
     if (strcmp(command, "list_zones") == 0) {
-        list_zones();
+        // A failed rebuild leaves a partial map in memory; it must not be flushed
+        if (!list_zones()) return 1;
+    } else if (strcmp(command, "refresh") == 0) {
+        if (!refresh_zones()) return 1;
     } else if (strcmp(command, "display_record") == 0 && argc == 3) {
         display_record(argv[2]);
+    } else if (strcmp(command, "query") == 0) {
+        if (!query_zone_map(argc - 2, argv + 2)) return 1;
+    } else if (strcmp(command, "compact") == 0) {
+        load_zone_map();
+        compact_zone_map();
     } else {
         printf("Unknown command: %s\n", command);
     }
 
+    if (!flush_zone_map()) {
+        return 1;
+    }
+
     return 0;
 }
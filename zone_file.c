@@ -0,0 +1,652 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <cjson/cJSON.h>
+
+#include "account.h"
+#include "api.h"
+#include "apply.h"
+#include "http.h"
+#include "zone_file.h"
+
+#define EXPORT_BIND   0
+#define EXPORT_NDJSON 1
+
+#define ZONE_NAME_SIZE 256
+#define ZONE_ID_SIZE 64
+
+// A zone being exported; source s of the crawl is zones[s - listings]
+struct export_zone {
+    char id[ZONE_ID_SIZE];
+    char name[ZONE_NAME_SIZE];
+};
+
+// State of one export run
+typedef struct {
+    ApiCrawl *crawl;
+    FILE *out;
+    int format;               // EXPORT_BIND or EXPORT_NDJSON
+    int listings;             // Sources before this are the /zones listings, one per account
+    char **only;              // Zone IDs given with --zone, or NULL for every zone
+    int only_count;
+    struct export_zone *zones;
+    int zone_count;
+    int zone_capacity;
+    int current;              // Source whose $ORIGIN was written last, 0 before the first
+    long records;
+} ZoneExport;
+
+// State of one import run
+typedef struct {
+    ApplyRun *run;
+    const char *zone_override; // --zone: every record goes to this zone
+    char origin[ZONE_NAME_SIZE]; // Without the trailing dot
+    char zone_id[ZONE_ID_SIZE];  // Zone of the current $ORIGIN, "" until known
+    char owner[ZONE_NAME_SIZE];  // Owner of the previous record, for lines that omit it
+    int default_ttl;
+    int skipped;               // SOA and apex NS records, which Cloudflare manages itself
+} ZoneImport;
+
+// Types whose content is a single host name
+static int is_host_type(const char *type) {
+    return strcmp(type, "CNAME") == 0 || strcmp(type, "NS") == 0 || strcmp(type, "PTR") == 0 ||
+           strcmp(type, "DNAME") == 0 || strcmp(type, "MX") == 0;
+}
+
+// Types that carry a priority in front of their content
+static int has_priority(const char *type) {
+    return strcmp(type, "MX") == 0 || strcmp(type, "SRV") == 0 || strcmp(type, "URI") == 0;
+}
+
+// Write a name relative to the origin: "@" for the apex, "www" below it,
+// an absolute name with its trailing dot otherwise
+static void write_owner(FILE *out, const char *name, const char *origin) {
+    size_t name_length = strlen(name);
+    size_t origin_length = strlen(origin);
+
+    if (strcasecmp(name, origin) == 0) {
+        fputc('@', out);
+    } else if (name_length > origin_length + 1 && name[name_length - origin_length - 1] == '.' &&
+               strcasecmp(name + name_length - origin_length, origin) == 0) {
+        fwrite(name, 1, name_length - origin_length - 1, out);
+    } else {
+        fprintf(out, "%s.", name);
+    }
+}
+
+// Write a host name as an absolute name
+static void write_host(FILE *out, const char *host, size_t length) {
+    fwrite(host, 1, length, out);
+    if (length > 0 && host[length - 1] != '.') fputc('.', out);
+}
+
+// Write text as one quoted character-string
+static void write_quoted(FILE *out, const char *text) {
+    fputc('"', out);
+    for (const char *p = text; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', out);
+        fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+static void write_bind_record(FILE *out, const struct export_zone *zone, const DnsRecord *record) {
+    write_owner(out, record->name, zone->name);
+    fprintf(out, "\t%d\tIN\t%s\t", record->ttl > 0 ? record->ttl : 1, record->type);
+
+    if (has_priority(record->type)) fprintf(out, "%d ", record->priority >= 0 ? record->priority : 0);
+
+    const char *content = record->content;
+    if (is_host_type(record->type)) {
+        write_host(out, content, strlen(content));
+    } else if (strcmp(record->type, "SRV") == 0) {
+        // weight port target
+        const char *target = strrchr(content, ' ');
+        target = target ? target + 1 : content;
+        fwrite(content, 1, target - content, out);
+        write_host(out, target, strlen(target));
+    } else if ((strcmp(record->type, "TXT") == 0 || strcmp(record->type, "SPF") == 0) && content[0] != '"') {
+        write_quoted(out, content);
+    } else {
+        fputs(content, out);
+    }
+
+    // Zone files have no notion of proxying, so it rides along as a comment
+    if (record->proxied) fputs(" ; proxied", out);
+    fputc('\n', out);
+}
+
+static void write_ndjson_record(FILE *out, const struct export_zone *zone, const DnsRecord *record) {
+    cJSON *json = cJSON_CreateObject();
+    if (!json) return;
+    cJSON_AddStringToObject(json, "zone_id", zone->id);
+    cJSON_AddStringToObject(json, "zone_name", zone->name);
+    cJSON_AddStringToObject(json, "id", record->id);
+    cJSON_AddStringToObject(json, "type", record->type);
+    cJSON_AddStringToObject(json, "name", record->name);
+    cJSON_AddStringToObject(json, "content", record->content);
+    cJSON_AddNumberToObject(json, "ttl", record->ttl);
+    cJSON_AddBoolToObject(json, "proxied", record->proxied);
+    if (record->priority >= 0) cJSON_AddNumberToObject(json, "priority", record->priority);
+
+    char *line = cJSON_PrintUnformatted(json);
+    if (line) {
+        fprintf(out, "%s\n", line);
+        free(line);
+    }
+    cJSON_Delete(json);
+}
+
+static int export_wanted(const ZoneExport *state, const char *zone_id) {
+    if (!state->only) return 1;
+    for (int i = 0; i < state->only_count; i++) {
+        if (strcmp(state->only[i], zone_id) == 0) return 1;
+    }
+    return 0;
+}
+
+// Page callback for the /zones listing: queue the records of every zone on the page
+static void on_export_zones(int source, int page, cJSON *json, void *userdata) {
+    ZoneExport *state = (ZoneExport *)userdata;
+    (void)page;
+    if (source >= state->listings) return;
+
+    cJSON *result = cJSON_GetObjectItem(json, "result");
+    if (!cJSON_IsArray(result)) {
+        fprintf(stderr, "Error: Invalid response structure.\n");
+        return;
+    }
+
+    // Each zone's records go out with the token of the account that listed it
+    int account = api_crawl_account(state->crawl, source);
+    cJSON *zone;
+    cJSON_ArrayForEach(zone, result) {
+        cJSON *zone_id = cJSON_GetObjectItem(zone, "id");
+        cJSON *zone_name = cJSON_GetObjectItem(zone, "name");
+        if (cJSON_IsString(zone_id)) account_learn_zone(zone_id->valuestring, account);
+        if (!cJSON_IsString(zone_id) || !cJSON_IsString(zone_name) ||
+            strlen(zone_id->valuestring) >= ZONE_ID_SIZE || strlen(zone_name->valuestring) >= ZONE_NAME_SIZE ||
+            !export_wanted(state, zone_id->valuestring)) {
+            continue;
+        }
+
+        if (state->zone_count == state->zone_capacity) {
+            int capacity = state->zone_capacity ? state->zone_capacity * 2 : 64;
+            struct export_zone *zones = realloc(state->zones, capacity * sizeof(struct export_zone));
+            if (!zones) {
+                fprintf(stderr, "Error: Out of memory.\n");
+                return;
+            }
+            state->zones = zones;
+            state->zone_capacity = capacity;
+        }
+
+        char url[512];
+        snprintf(url, sizeof(url), "%s/zones/%s/dns_records", API_URL, zone_id->valuestring);
+        if (api_crawl_add_records(state->crawl, url, DNS_RECORDS_PER_PAGE) != state->listings + state->zone_count) {
+            fprintf(stderr, "Error: Could not queue the records of zone %s.\n", zone_id->valuestring);
+            continue;
+        }
+        struct export_zone *entry = &state->zones[state->zone_count++];
+        strcpy(entry->id, zone_id->valuestring);
+        strcpy(entry->name, zone_name->valuestring);
+    }
+}
+
+// Record callback: records arrive zone by zone, in (source, page) order
+static void on_export_record(int source, int page, const DnsRecord *record, void *userdata) {
+    ZoneExport *state = (ZoneExport *)userdata;
+    (void)page;
+    if (source < state->listings || source >= state->listings + state->zone_count) return;
+
+    const struct export_zone *zone = &state->zones[source - state->listings];
+    if (state->format == EXPORT_BIND) {
+        if (source != state->current) {
+            fprintf(state->out, "%s$ORIGIN %s.\n; zone_id %s\n", state->current ? "\n" : "", zone->name, zone->id);
+            state->current = source;
+        }
+        write_bind_record(state->out, zone, record);
+    } else {
+        write_ndjson_record(state->out, zone, record);
+    }
+    state->records++;
+}
+
+int export_zones(int argc, char *argv[], int max_in_flight) {
+    ZoneExport state;
+    memset(&state, 0, sizeof(state));
+    const char *output = NULL;
+    int ok = 1;
+
+    state.only = calloc(argc + 1, sizeof(char *));
+    if (!state.only) {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 0;
+    }
+    for (int i = 0; ok && i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            const char *format = argv[++i];
+            if (strcmp(format, "bind") == 0) {
+                state.format = EXPORT_BIND;
+            } else if (strcmp(format, "ndjson") == 0) {
+                state.format = EXPORT_NDJSON;
+            } else {
+                ok = 0;
+            }
+        } else if (strcmp(argv[i], "--zone") == 0 && i + 1 < argc) {
+            state.only[state.only_count++] = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok) {
+        printf("Usage: ./cloudflare export [--format bind|ndjson] [--zone <zone_id>]... [--output <path>]\n");
+        free(state.only);
+        return 0;
+    }
+    if (state.only_count == 0) {
+        free(state.only);
+        state.only = NULL;
+    }
+
+    state.out = output ? fopen(output, "w") : stdout;
+    if (!state.out) {
+        fprintf(stderr, "Error: Could not open %s\n", output);
+        free(state.only);
+        return 0;
+    }
+
+    HttpBatch *batch = http_batch_create(max_in_flight);
+    state.crawl = batch ? api_crawl_create(batch, http_batch_capacity(batch) * 2, on_export_zones, &state) : NULL;
+    if (!state.crawl) {
+        http_batch_free(batch);
+        if (output) fclose(state.out);
+        free(state.only);
+        return 0;
+    }
+    http_batch_set_priority(batch, HTTP_PRIORITY_BULK);
+    api_crawl_set_record_callback(state.crawl, on_export_record);
+
+    char url[512];
+    snprintf(url, sizeof(url), "%s/zones", API_URL);
+    state.listings = http_account_count();
+    for (int account = 0; account < state.listings; account++) {
+        http_batch_set_account(batch, account);
+        if (api_crawl_add(state.crawl, url, ZONES_PER_PAGE) != account) ok = 0;
+    }
+    ok = ok && api_crawl_run(state.crawl);
+    for (int account = 0; account < state.listings; account++) {
+        if (api_crawl_failed(state.crawl, account)) ok = 0;
+    }
+    if (!ok) fprintf(stderr, "Error: The zone listing could not be fetched.\n");
+    account_save_zones();
+    for (int i = 0; i < state.zone_count; i++) {
+        if (api_crawl_failed(state.crawl, state.listings + i)) {
+            fprintf(stderr, "Error: Records of zone %s could not be exported.\n", state.zones[i].id);
+            ok = 0;
+        }
+    }
+
+    if (fflush(state.out) != 0 || (output && fclose(state.out) != 0)) {
+        fprintf(stderr, "Error: Could not write %s\n", output ? output : "the export");
+        ok = 0;
+    }
+
+    // The summary stays out of the way of an export written to stdout
+    fprintf(output ? stdout : stderr, "{\"zones\":%d,\"exported\":%ld,\"failed\":%s}\n",
+            state.zone_count, state.records, ok ? "false" : "true");
+
+    http_batch_free(batch);
+    api_crawl_free(state.crawl);
+    free(state.zones);
+    free(state.only);
+    return ok;
+}
+
+// Cut a trailing comment off a zone file line, leaving quoted semicolons
+// alone. Returns the comment text (after the ';') or NULL.
+static char *strip_comment(char *line) {
+    int quoted = 0;
+    for (char *p = line; *p; p++) {
+        if (*p == '\\' && quoted && p[1]) {
+            p++;
+        } else if (*p == '"') {
+            quoted = !quoted;
+        } else if (*p == ';' && !quoted) {
+            *p = '\0';
+            return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// Net count of parentheses outside quotes; they are blanked out as they are counted
+static int count_parentheses(char *line) {
+    int depth = 0, quoted = 0;
+    for (char *p = line; *p; p++) {
+        if (*p == '\\' && quoted && p[1]) {
+            p++;
+        } else if (*p == '"') {
+            quoted = !quoted;
+        } else if (!quoted && (*p == '(' || *p == ')')) {
+            depth += *p == '(' ? 1 : -1;
+            *p = ' ';
+        }
+    }
+    return depth;
+}
+
+// Take the next whitespace-separated token, or NULL at the end of the line
+static char *next_token(char **cursor) {
+    char *p = *cursor;
+    while (*p && isspace((unsigned char)*p)) p++;
+    if (!*p) {
+        *cursor = p;
+        return NULL;
+    }
+    char *start = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    *cursor = p;
+    return start;
+}
+
+// Parse a TTL such as 3600 or 1h30m. Returns -1 if it is not one.
+static int parse_ttl(const char *text) {
+    if (!isdigit((unsigned char)*text)) return -1;
+    long total = 0, value = 0;
+    for (const char *p = text; *p; p++) {
+        if (isdigit((unsigned char)*p)) {
+            value = value * 10 + (*p - '0');
+            continue;
+        }
+        int unit = tolower((unsigned char)*p);
+        long scale = unit == 's' ? 1 : unit == 'm' ? 60 : unit == 'h' ? 3600 : unit == 'd' ? 86400 : unit == 'w' ? 604800 : 0;
+        if (scale == 0) return -1;
+        total += value * scale;
+        value = 0;
+    }
+    total += value;
+    return total > 0x7fffffff ? -1 : (int)total;
+}
+
+static int is_class(const char *token) {
+    return strcasecmp(token, "IN") == 0 || strcasecmp(token, "CH") == 0 || strcasecmp(token, "HS") == 0 ||
+           strcasecmp(token, "CS") == 0;
+}
+
+// Turn a name from the file into a fully qualified one without the trailing dot
+static int absolute_name(const ZoneImport *state, const char *name, char *out, size_t size) {
+    size_t length = strlen(name);
+    int written;
+    if (strcmp(name, "@") == 0) {
+        written = snprintf(out, size, "%s", state->origin);
+    } else if (length > 0 && name[length - 1] == '.') {
+        written = snprintf(out, size, "%.*s", (int)(length - 1), name);
+    } else if (state->origin[0]) {
+        written = snprintf(out, size, "%s.%s", name, state->origin);
+    } else {
+        return 0;
+    }
+    return written > 0 && (size_t)written < size;
+}
+
+// Find the ID of the zone named origin, asking each account in turn
+static int lookup_zone_id(const char *origin, char *zone_id, size_t size) {
+    char url[768];
+    snprintf(url, sizeof(url), "%s/zones?name=%s", API_URL, origin);
+
+    int found = 0;
+    for (int account = 0; !found && account < http_account_count(); account++) {
+        http_use_account(account);
+        ApiResponse *response = api_request(url, "GET", NULL);
+        if (!response) continue;
+        cJSON *result = cJSON_GetObjectItem(response->json, "result");
+        cJSON *zone = cJSON_GetArrayItem(result, 0);
+        cJSON *id = cJSON_GetObjectItem(zone, "id");
+        cJSON *name = cJSON_GetObjectItem(zone, "name");
+        found = cJSON_IsString(id) && strlen(id->valuestring) < size && cJSON_IsString(name) &&
+                strcasecmp(name->valuestring, origin) == 0;
+        if (found) {
+            strcpy(zone_id, id->valuestring);
+            account_learn_zone(zone_id, account);
+        }
+        api_response_free(response);
+    }
+    http_use_account(0);
+    return found;
+}
+
+// Parse one logical zone file line (comments cut off, parentheses joined)
+// and add the record it holds. Returns 1 on success, 0 on invalid input.
+static int import_zone_line(ZoneImport *state, char *line, const char *comment, int line_number) {
+    char *cursor = line;
+    int has_owner = *line && !isspace((unsigned char)*line);
+    char *token = next_token(&cursor);
+    if (!token) return 1;
+
+    if (strcasecmp(token, "$ORIGIN") == 0) {
+        char *origin = next_token(&cursor);
+        if (!origin || !absolute_name(state, origin, state->origin, sizeof(state->origin))) {
+            fprintf(stderr, "Error: Line %d: invalid $ORIGIN.\n", line_number);
+            return 0;
+        }
+        state->zone_id[0] = '\0';
+        return 1;
+    }
+    if (strcasecmp(token, "$TTL") == 0) {
+        char *ttl = next_token(&cursor);
+        if (!ttl || (state->default_ttl = parse_ttl(ttl)) < 0) {
+            fprintf(stderr, "Error: Line %d: invalid $TTL.\n", line_number);
+            return 0;
+        }
+        return 1;
+    }
+    if (token[0] == '$') {
+        fprintf(stderr, "Error: Line %d: %s is not supported.\n", line_number, token);
+        return 0;
+    }
+
+    char name[ZONE_NAME_SIZE];
+    if (has_owner) {
+        if (!absolute_name(state, token, name, sizeof(name))) {
+            fprintf(stderr, "Error: Line %d: %s is relative but no $ORIGIN is set.\n", line_number, token);
+            return 0;
+        }
+        strcpy(state->owner, name);
+        token = next_token(&cursor);
+    } else if (state->owner[0]) {
+        strcpy(name, state->owner);
+    } else {
+        fprintf(stderr, "Error: Line %d: the first record needs an owner name.\n", line_number);
+        return 0;
+    }
+
+    // [ttl] [class] type, with ttl and class in either order
+    int ttl = state->default_ttl;
+    while (token && (parse_ttl(token) >= 0 || is_class(token))) {
+        if (!is_class(token)) ttl = parse_ttl(token);
+        token = next_token(&cursor);
+    }
+    if (!token) {
+        fprintf(stderr, "Error: Line %d: record type missing.\n", line_number);
+        return 0;
+    }
+    char type[16];
+    snprintf(type, sizeof(type), "%s", token);
+    for (char *p = type; *p; p++) *p = (char)toupper((unsigned char)*p);
+
+    if (strcmp(type, "SOA") == 0 || (strcmp(type, "NS") == 0 && strcasecmp(name, state->origin) == 0)) {
+        state->skipped++;
+        return 1;
+    }
+
+    // The rest of the line is the data, in Cloudflare's form: the priority
+    // apart and host names fully qualified without their trailing dot
+    char *rdata = cursor;
+    while (*rdata && isspace((unsigned char)*rdata)) rdata++;
+    size_t length = strlen(rdata);
+    while (length > 0 && isspace((unsigned char)rdata[length - 1])) rdata[--length] = '\0';
+
+    int priority = -1;
+    if (has_priority(type)) {
+        char *value = next_token(&rdata);
+        if (!value || !isdigit((unsigned char)*value)) {
+            fprintf(stderr, "Error: Line %d: %s record needs a priority.\n", line_number, type);
+            return 0;
+        }
+        priority = atoi(value);
+        while (*rdata && isspace((unsigned char)*rdata)) rdata++;
+    }
+
+    char content[RECORD_CONTENT_SIZE];
+    int ok = 1;
+    if (is_host_type(type)) {
+        ok = absolute_name(state, rdata, content, sizeof(content));
+    } else if (strcmp(type, "SRV") == 0) {
+        char *weight = next_token(&rdata);
+        char *port = next_token(&rdata);
+        char *target = next_token(&rdata);
+        char host[ZONE_NAME_SIZE];
+        ok = target && absolute_name(state, target, host, sizeof(host));
+        if (ok) snprintf(content, sizeof(content), "%s %s %s", weight, port, host);
+    } else {
+        ok = snprintf(content, sizeof(content), "%s", rdata) < (int)sizeof(content);
+    }
+    if (!ok || !content[0]) {
+        fprintf(stderr, "Error: Line %d: invalid %s data.\n", line_number, type);
+        return 0;
+    }
+
+    const char *zone_id = state->zone_override ? state->zone_override : state->zone_id;
+    if (!zone_id[0]) {
+        if (!state->origin[0] || !lookup_zone_id(state->origin, state->zone_id, sizeof(state->zone_id))) {
+            fprintf(stderr, "Error: Line %d: no zone for %s; add \"; zone_id <id>\" or use --zone.\n",
+                    line_number, state->origin[0] ? state->origin : name);
+            return 0;
+        }
+        zone_id = state->zone_id;
+    }
+
+    int proxied = comment && strstr(comment, "proxied") != NULL;
+    return apply_add_record(state->run, zone_id, type, name, content, ttl, proxied, priority);
+}
+
+// Read a zone file record by record into the run
+static int import_zone_file(ZoneImport *state, FILE *file) {
+    char *line = NULL, *more = NULL;
+    size_t capacity = 0, more_capacity = 0;
+    int line_number = 0;
+    int ok = 1;
+
+    while (ok && getline(&line, &capacity, file) != -1) {
+        int first_line = ++line_number;
+        line[strcspn(line, "\r\n")] = '\0';
+        char *comment = strip_comment(line);
+        char directive[ZONE_ID_SIZE];
+
+        // "; zone_id <id>" names the zone of the $ORIGIN before it
+        if (comment && sscanf(comment, " zone_id %63s", directive) == 1) {
+            strcpy(state->zone_id, directive);
+        }
+
+        // A record in parentheses continues over the following lines
+        int depth = count_parentheses(line);
+        size_t length = strlen(line);
+        while (depth > 0 && getline(&more, &more_capacity, file) != -1) {
+            line_number++;
+            more[strcspn(more, "\r\n")] = '\0';
+            strip_comment(more);
+            depth += count_parentheses(more);
+
+            size_t extra = strlen(more);
+            if (length + extra + 2 > capacity) {
+                char *grown = realloc(line, length + extra + 2);
+                if (!grown) {
+                    fprintf(stderr, "Error: Out of memory.\n");
+                    ok = 0;
+                    break;
+                }
+                line = grown;
+                capacity = length + extra + 2;
+            }
+            line[length++] = ' ';
+            memcpy(line + length, more, extra + 1);
+            length += extra;
+        }
+
+        ok = ok && import_zone_line(state, line, comment, first_line);
+    }
+
+    free(line);
+    free(more);
+    return ok;
+}
+
+int import_zones(int argc, char *argv[], int max_in_flight) {
+    int flags = APPLY_BY_ZONE;
+    const char *path = NULL;
+    ZoneImport state;
+    memset(&state, 0, sizeof(state));
+    state.default_ttl = 1;
+
+    int ok = 1;
+    for (int i = 0; ok && i < argc; i++) {
+        if (strcmp(argv[i], "--dry-run") == 0) {
+            flags |= APPLY_DRY_RUN;
+        } else if (strcmp(argv[i], "--prune") == 0) {
+            flags |= APPLY_PRUNE;
+        } else if (strcmp(argv[i], "--zone") == 0 && i + 1 < argc) {
+            state.zone_override = argv[++i];
+        } else if (!path) {
+            path = argv[i];
+        } else {
+            ok = 0;
+        }
+    }
+    if (!ok || !path) {
+        printf("Usage: ./cloudflare import [--dry-run] [--prune] [--zone <zone_id>] <zone.txt|records.ndjson|->\n");
+        return 0;
+    }
+
+    FILE *file = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Error: Could not open %s\n", path);
+        return 0;
+    }
+
+    state.run = apply_create(max_in_flight, flags);
+    if (!state.run) {
+        if (file != stdin) fclose(file);
+        return 0;
+    }
+
+    // NDJSON exports start with '{'; anything else is read as a zone file
+    int c;
+    while ((c = fgetc(file)) != EOF && isspace(c)) {
+    }
+    if (c != EOF) ungetc(c, file);
+
+    if (c == '{') {
+        char *line = NULL;
+        size_t capacity = 0;
+        int line_number = 0;
+        while (ok && getline(&line, &capacity, file) != -1) {
+            ok = apply_add_line(state.run, line, ++line_number);
+        }
+        free(line);
+    } else {
+        ok = import_zone_file(&state, file);
+    }
+    if (file != stdin) fclose(file);
+    account_save_zones();
+
+    if (state.skipped > 0) {
+        fprintf(stderr, "Skipped %d SOA and apex NS records; Cloudflare manages those itself.\n", state.skipped);
+    }
+    return apply_finish(state.run) && ok;
+}
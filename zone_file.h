@@ -0,0 +1,17 @@
+#ifndef ZONE_FILE_H
+#define ZONE_FILE_H
+
+// Function to run the export command: stream every record of every zone (or
+// of the zones named with --zone) as an RFC 1035 zone file or as NDJSON.
+// Records are written as their pages arrive, so memory does not grow with
+// the account. argv holds the arguments after "export".
+// Returns 1 on success, 0 on a usage error or a failed fetch.
+int export_zones(int argc, char *argv[], int max_in_flight);
+
+// Function to run the import command: apply a zone file or NDJSON export a
+// few zones at a time, with each zone's writes sent concurrently.
+// argv holds the arguments after "import".
+// Returns 1 if every change succeeded, 0 otherwise.
+int import_zones(int argc, char *argv[], int max_in_flight);
+
+#endif
@@ -0,0 +1,1005 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zone_map.h"
+
+int zone_map_size = 0;
+
+int ZONE_MAP_JOURNAL_MODE = 0;
+int ZONE_MAP_BINARY_MODE = 0;
+
+// Records, in insertion order
+static ZoneRecord *records = NULL;
+static int records_capacity = 0;
+
+// Interned zone IDs; records refer to them by position
+static uint8_t (*zones)[ZONE_ID_SIZE] = NULL;
+static int zone_count = 0;
+static int zones_capacity = 0;
+
+// Arena of NUL-terminated domains and contents, addressed by offset.
+// Replaced strings stay behind as garbage until the pool is compacted.
+static char *string_pool = NULL;
+static uint32_t pool_size = 0;
+static uint32_t pool_capacity = 0;
+static uint32_t pool_garbage = 0;
+
+// Open-addressing hash index. Slots hold positions (-1 when empty) and are
+// probed linearly; capacity is a power of two.
+typedef struct {
+    int *slots;
+    int capacity;
+} ZoneIndex;
+
+// Keys the map is indexed by
+typedef enum {
+    INDEX_DOMAIN, // Record by FQDN
+    INDEX_RECORD, // Record by (zone, record_id)
+    INDEX_ZONE    // Zone table position by zone ID
+} ZoneIndexKind;
+
+// A lookup key; only the fields used by the index kind are set
+typedef struct {
+    const char *domain;
+    uint32_t zone;
+    const uint8_t *id;
+} ZoneKey;
+
+static ZoneIndex domain_index = {NULL, 0};
+static ZoneIndex record_index = {NULL, 0};
+static ZoneIndex zone_index = {NULL, 0};
+
+// Persistence state: changes are kept in memory and written once by flush_zone_map()
+static int zone_map_loaded = 0; // The map in memory stands for what is on disk
+static int zone_map_dirty = 0;
+static FILE *journal_file = NULL;
+static int journal_entries = 0;
+static unsigned long generation = 0; // Bumped whenever an entry is added, removed or changed
+
+// FNV-1a hash, chainable so composite keys can be hashed field by field
+static uint64_t hash_string(uint64_t hash, const char *str) {
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Hash of a key as stored in the given index. The domain hash is also the
+// one zone_map.bin is indexed by, so it must not change.
+static uint64_t hash_key(ZoneIndexKind kind, const ZoneKey *key) {
+    uint64_t hash = 14695981039346656037ULL;
+    if (kind == INDEX_DOMAIN) {
+        return hash_string(hash, key->domain);
+    }
+    if (kind == INDEX_RECORD) {
+        hash = hash_bytes(hash, &key->zone, sizeof(key->zone));
+    }
+    return hash_bytes(hash, key->id, ZONE_ID_SIZE);
+}
+
+// The key an indexed position is stored under
+static void entry_key(ZoneIndexKind kind, int entry, ZoneKey *key) {
+    if (kind == INDEX_ZONE) {
+        key->id = zones[entry];
+        return;
+    }
+    key->domain = string_pool + records[entry].domain;
+    key->zone = records[entry].zone;
+    key->id = records[entry].record_id;
+}
+
+static int entry_matches(ZoneIndexKind kind, int entry, const ZoneKey *key) {
+    switch (kind) {
+    case INDEX_DOMAIN:
+        return strcmp(string_pool + records[entry].domain, key->domain) == 0;
+    case INDEX_RECORD:
+        return records[entry].zone == key->zone && memcmp(records[entry].record_id, key->id, ZONE_ID_SIZE) == 0;
+    default:
+        return memcmp(zones[entry], key->id, ZONE_ID_SIZE) == 0;
+    }
+}
+
+static uint64_t hash_entry(ZoneIndexKind kind, int entry) {
+    ZoneKey key;
+    entry_key(kind, entry, &key);
+    return hash_key(kind, &key);
+}
+
+// Find the position stored under a key, or -1
+static int index_find(ZoneIndex *index, ZoneIndexKind kind, const ZoneKey *key) {
+    if (index->capacity == 0) return -1;
+
+    int mask = index->capacity - 1;
+    for (int slot = hash_key(kind, key) & mask; index->slots[slot] >= 0; slot = (slot + 1) & mask) {
+        if (entry_matches(kind, index->slots[slot], key)) {
+            return index->slots[slot];
+        }
+    }
+    return -1;
+}
+
+// Store an entry's position. The caller guarantees spare capacity.
+// If the key is already indexed the earlier entry is kept, matching a linear scan.
+static void index_insert(ZoneIndex *index, ZoneIndexKind kind, int entry) {
+    ZoneKey key;
+    entry_key(kind, entry, &key);
+
+    int mask = index->capacity - 1;
+    int slot = hash_key(kind, &key) & mask;
+    for (; index->slots[slot] >= 0; slot = (slot + 1) & mask) {
+        if (entry_matches(kind, index->slots[slot], &key)) {
+            return;
+        }
+    }
+    index->slots[slot] = entry;
+}
+
+// Remove an entry's position, shifting later probes back so no tombstones are needed
+static void index_remove(ZoneIndex *index, ZoneIndexKind kind, int entry) {
+    if (index->capacity == 0) return;
+
+    int mask = index->capacity - 1;
+    int slot = hash_entry(kind, entry) & mask;
+    while (index->slots[slot] >= 0 && index->slots[slot] != entry) {
+        slot = (slot + 1) & mask;
+    }
+    if (index->slots[slot] < 0) return;
+
+    int hole = slot;
+    for (int next = (hole + 1) & mask; index->slots[next] >= 0; next = (next + 1) & mask) {
+        int home = hash_entry(kind, index->slots[next]) & mask;
+        // Move the entry back if the hole lies between its home slot and where it sits now
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
+    }
+    index->slots[hole] = -1;
+}
+
+// Resize an index to hold at least twice count entries and re-insert positions 0..count-1
+static int index_rebuild(ZoneIndex *index, ZoneIndexKind kind, int count) {
+    int capacity = 16;
+    while (capacity < count * 2) capacity *= 2;
+
+    int *slots = malloc(capacity * sizeof(int));
+    if (!slots) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 0;
+    }
+    memset(slots, 0xff, capacity * sizeof(int));
+
+    free(index->slots);
+    index->slots = slots;
+    index->capacity = capacity;
+    for (int i = 0; i < count; i++) {
+        index_insert(index, kind, i);
+    }
+    return 1;
+}
+
+// Decode a 32-character hex ID into 16 bytes. Returns 0 if it isn't one.
+static int hex_to_id(const char *hex, uint8_t id[ZONE_ID_SIZE]) {
+    for (int i = 0; i < ZONE_ID_SIZE * 2; i++) {
+        char c = hex[i];
+        int nibble;
+        if (c >= '0' && c <= '9') nibble = c - '0';
+        else if (c >= 'a' && c <= 'f') nibble = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') nibble = c - 'A' + 10;
+        else return 0;
+
+        if (i % 2 == 0) id[i / 2] = nibble << 4;
+        else id[i / 2] |= nibble;
+    }
+    return hex[ZONE_ID_SIZE * 2] == '\0';
+}
+
+// Encode 16 bytes as a 32-character lowercase hex ID
+static void id_to_hex(const uint8_t id[ZONE_ID_SIZE], char *hex) {
+    static const char digits[] = "0123456789abcdef";
+    for (int i = 0; i < ZONE_ID_SIZE; i++) {
+        hex[i * 2] = digits[id[i] >> 4];
+        hex[i * 2 + 1] = digits[id[i] & 0xf];
+    }
+    hex[ZONE_ID_SIZE * 2] = '\0';
+}
+
+// Find a zone's position in the zone table, adding it if new. Returns -1 on allocation failure.
+static int intern_zone(const uint8_t id[ZONE_ID_SIZE]) {
+    ZoneKey key = {NULL, 0, id};
+    int zone = index_find(&zone_index, INDEX_ZONE, &key);
+    if (zone >= 0) return zone;
+
+    if (zone_count == zones_capacity) {
+        int capacity = zones_capacity ? zones_capacity * 2 : 16;
+        uint8_t (*table)[ZONE_ID_SIZE] = realloc(zones, capacity * ZONE_ID_SIZE);
+        if (!table) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+        zones = table;
+        zones_capacity = capacity;
+    }
+
+    zone = zone_count++;
+    memcpy(zones[zone], id, ZONE_ID_SIZE);
+    if (zone_count * 2 > zone_index.capacity) {
+        if (!index_rebuild(&zone_index, INDEX_ZONE, zone_count)) {
+            zone_count--;
+            return -1;
+        }
+    } else {
+        index_insert(&zone_index, INDEX_ZONE, zone);
+    }
+    return zone;
+}
+
+// Copy a string into the pool. Returns 0 on allocation failure.
+static int pool_add(const char *str, uint32_t *offset) {
+    size_t length = strlen(str) + 1;
+    if (length > UINT32_MAX - pool_size) {
+        fprintf(stderr, "Error: Zone map string pool is full.\n");
+        return 0;
+    }
+
+    if (pool_size + length > pool_capacity) {
+        uint64_t capacity = pool_capacity ? pool_capacity : 4096;
+        while (capacity < pool_size + length) capacity *= 2;
+        if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+
+        char *pool = realloc(string_pool, capacity);
+        if (!pool) {
+            fprintf(stderr, "Memory allocation error\n");
+            return 0;
+        }
+        string_pool = pool;
+        pool_capacity = capacity;
+    }
+
+    memcpy(string_pool + pool_size, str, length);
+    *offset = pool_size;
+    pool_size += length;
+    return 1;
+}
+
+// Rewrite the pool without the strings of replaced entries
+static int compact_string_pool() {
+    if (pool_garbage == 0) return 1;
+
+    // Size the new pool from the live strings rather than from pool_garbage, so
+    // entries that share or overlap strings cannot overrun it
+    size_t live = 0;
+    for (int i = 0; i < zone_map_size; i++) {
+        live += strlen(string_pool + records[i].domain) + 1;
+        live += strlen(string_pool + records[i].content) + 1;
+    }
+    if (live > UINT32_MAX) {
+        fprintf(stderr, "Error: Zone map string pool is full.\n");
+        return 0;
+    }
+
+    char *pool = malloc(live + 1);
+    if (!pool) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 0;
+    }
+
+    uint32_t size = 0;
+    for (int i = 0; i < zone_map_size; i++) {
+        uint32_t *fields[2] = {&records[i].domain, &records[i].content};
+        for (int f = 0; f < 2; f++) {
+            size_t length = strlen(string_pool + *fields[f]) + 1;
+            memcpy(pool + size, string_pool + *fields[f], length);
+            *fields[f] = size;
+            size += length;
+        }
+    }
+
+    free(string_pool);
+    string_pool = pool;
+    pool_size = size;
+    pool_capacity = size + 1;
+    pool_garbage = 0;
+    return 1;
+}
+
+// Fill in a record from text fields. Returns 0 if an ID is malformed or memory runs out.
+static int fill_record(ZoneRecord *record, const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address) {
+    uint8_t zone[ZONE_ID_SIZE];
+    if (!hex_to_id(zone_id, zone) || !hex_to_id(record_id, record->record_id)) {
+        fprintf(stderr, "Error: Skipping %s, zone and record IDs must be 32 hex characters.\n", domain);
+        return 0;
+    }
+
+    int zone_position = intern_zone(zone);
+    if (zone_position < 0) return 0;
+    record->zone = zone_position;
+    record->flags = proxied ? ZONE_ENTRY_PROXIED : 0;
+
+    return (!domain || pool_add(domain, &record->domain)) && pool_add(ip_address, &record->content);
+}
+
+int get_zone_entry(int i, ZoneMap *entry) {
+    if (i < 0 || i >= zone_map_size) return 0;
+
+    memset(entry, 0, sizeof(ZoneMap));
+    strncpy(entry->domain, string_pool + records[i].domain, sizeof(entry->domain) - 1);
+    id_to_hex(zones[records[i].zone], entry->zone_id);
+    id_to_hex(records[i].record_id, entry->record_id);
+    entry->proxied = (records[i].flags & ZONE_ENTRY_PROXIED) ? 1 : 0;
+    strncpy(entry->ip_address, string_pool + records[i].content, sizeof(entry->ip_address) - 1);
+    return 1;
+}
+
+const char *zone_entry_domain(int i) {
+    return string_pool + records[i].domain;
+}
+
+const char *zone_entry_content(int i) {
+    return string_pool + records[i].content;
+}
+
+int zone_entry_proxied(int i) {
+    return (records[i].flags & ZONE_ENTRY_PROXIED) ? 1 : 0;
+}
+
+int zone_entry_zone(int i) {
+    return (int)records[i].zone;
+}
+
+int find_zone(const char *zone_id) {
+    uint8_t id[ZONE_ID_SIZE];
+    if (!hex_to_id(zone_id, id)) return -1;
+
+    ZoneKey key = {NULL, 0, id};
+    return index_find(&zone_index, INDEX_ZONE, &key);
+}
+
+unsigned long zone_map_generation() {
+    return generation;
+}
+
+int find_domain(const char *domain) {
+    ZoneKey key = {domain, 0, NULL};
+    return index_find(&domain_index, INDEX_DOMAIN, &key);
+}
+
+int find_record(const char *zone_id, const char *record_id) {
+    uint8_t zone[ZONE_ID_SIZE], id[ZONE_ID_SIZE];
+    if (!hex_to_id(zone_id, zone) || !hex_to_id(record_id, id)) return -1;
+
+    ZoneKey zone_key = {NULL, 0, zone};
+    int zone_position = index_find(&zone_index, INDEX_ZONE, &zone_key);
+    if (zone_position < 0) return -1;
+
+    ZoneKey key = {NULL, zone_position, id};
+    return index_find(&record_index, INDEX_RECORD, &key);
+}
+
+static void free_index(ZoneIndex *index) {
+    free(index->slots);
+    index->slots = NULL;
+    index->capacity = 0;
+}
+
+void reset_zone_map() {
+    free(records);
+    records = NULL;
+    zone_map_size = 0;
+    records_capacity = 0;
+
+    free(zones);
+    zones = NULL;
+    zone_count = 0;
+    zones_capacity = 0;
+
+    free(string_pool);
+    string_pool = NULL;
+    pool_size = 0;
+    pool_capacity = 0;
+    pool_garbage = 0;
+
+    free_index(&domain_index);
+    free_index(&record_index);
+    free_index(&zone_index);
+
+    // An emptied map no longer matches what is on disk
+    zone_map_dirty = 1;
+    generation++;
+    zone_map_loaded = 1;
+}
+
+// Index a record just stored at the end of the array, growing the indexes geometrically
+static int index_new_record(int entry) {
+    if (zone_map_size * 2 > domain_index.capacity) {
+        return index_rebuild(&domain_index, INDEX_DOMAIN, zone_map_size) &&
+               index_rebuild(&record_index, INDEX_RECORD, zone_map_size);
+    }
+    index_insert(&domain_index, INDEX_DOMAIN, entry);
+    index_insert(&record_index, INDEX_RECORD, entry);
+    return 1;
+}
+
+// Append an entry and index it. Returns the new position, or -1 on failure.
+static int append_zone_entry(const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address) {
+    if (zone_map_size == records_capacity) {
+        int capacity = records_capacity ? records_capacity * 2 : 64;
+        ZoneRecord *grown = realloc(records, capacity * sizeof(ZoneRecord));
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation error\n");
+            return -1;
+        }
+        records = grown;
+        records_capacity = capacity;
+    }
+
+    int entry = zone_map_size;
+    if (!fill_record(&records[entry], domain, zone_id, record_id, proxied, ip_address)) {
+        return -1;
+    }
+    zone_map_size++;
+    generation++;
+
+    if (!index_new_record(entry)) {
+        zone_map_size--;
+        return -1;
+    }
+    return entry;
+}
+
+// Drop the entry at a position; the last entry moves into its place
+static void remove_zone_entry(int i) {
+    int last = zone_map_size - 1;
+    pool_garbage += strlen(string_pool + records[i].domain) + 1;
+    pool_garbage += strlen(string_pool + records[i].content) + 1;
+
+    index_remove(&domain_index, INDEX_DOMAIN, i);
+    index_remove(&record_index, INDEX_RECORD, i);
+    if (i != last) {
+        index_remove(&domain_index, INDEX_DOMAIN, last);
+        index_remove(&record_index, INDEX_RECORD, last);
+        records[i] = records[last];
+        index_insert(&domain_index, INDEX_DOMAIN, i);
+        index_insert(&record_index, INDEX_RECORD, i);
+    }
+    zone_map_size--;
+    generation++;
+}
+
+// Write one entry in zone map file format
+static int write_zone_entry(FILE *file, int i) {
+    char zone_id[33], record_id[33];
+    id_to_hex(zones[records[i].zone], zone_id);
+    id_to_hex(records[i].record_id, record_id);
+    return fprintf(file, "%s %s %s %d %s\n", string_pool + records[i].domain, zone_id, record_id,
+                   (records[i].flags & ZONE_ENTRY_PROXIED) ? 1 : 0, string_pool + records[i].content);
+}
+
+// Overwrite an entry's IDs and content in place; its domain stays the same.
+// The record index is kept in step with the new key.
+static int replace_zone_entry(int i, const char *zone_id, const char *record_id, int proxied, const char *ip_address) {
+    ZoneRecord record = records[i];
+    if (!fill_record(&record, NULL, zone_id, record_id, proxied, ip_address)) {
+        return 0;
+    }
+    pool_garbage += strlen(string_pool + records[i].content) + 1;
+
+    index_remove(&record_index, INDEX_RECORD, i);
+    records[i] = record;
+    index_insert(&record_index, INDEX_RECORD, i);
+    generation++;
+
+    // Drop replaced strings once they make up half of the pool
+    if (pool_garbage > 65536 && pool_garbage > pool_size / 2) {
+        compact_string_pool();
+    }
+    return 1;
+}
+
+// Parse a zone map or journal line and store it, overwriting any entry for the same domain
+static int apply_zone_line(char *line) {
+    // "- <zone_id> <record_id>" records a removal
+    if (line[0] == '-' && line[1] == ' ') {
+        char *zone_id = strtok(line + 2, " ");
+        char *record_id = strtok(NULL, " \n");
+        if (!(zone_id && record_id)) return 0;
+        int i = find_record(zone_id, record_id);
+        if (i >= 0) remove_zone_entry(i);
+        return 1;
+    }
+
+    char *domain = strtok(line, " ");
+    char *zone_id = strtok(NULL, " ");
+    char *record_id = strtok(NULL, " ");
+    char *proxied = strtok(NULL, " ");
+    char *ip_address = strtok(NULL, "\n");
+
+    if (!(domain && zone_id && record_id && proxied && ip_address)) return 0;
+
+    int i = find_domain(domain);
+    if (i >= 0) {
+        return replace_zone_entry(i, zone_id, record_id, atoi(proxied), ip_address);
+    }
+    return append_zone_entry(domain, zone_id, record_id, atoi(proxied), ip_address) >= 0;
+}
+
+// A read-only mapping of zone_map.bin with its sections resolved
+typedef struct {
+    void *base;
+    size_t size;
+    const ZoneMapFileHeader *header;
+    const uint8_t (*zones)[ZONE_ID_SIZE];
+    const ZoneRecord *entries;
+    const uint32_t *buckets;
+    const char *strings;
+} ZoneMapFile;
+
+// Check that a section of count items of item_size bytes lies inside the file
+static int section_fits(size_t file_size, uint64_t offset, uint64_t count, size_t item_size) {
+    return offset <= file_size && count <= (file_size - offset) / item_size;
+}
+
+// Map zone_map.bin and validate its header. Returns 1 on success.
+static int open_zone_map_file(ZoneMapFile *map) {
+    memset(map, 0, sizeof(ZoneMapFile));
+
+    int fd = open(ZONE_MAP_BIN_FILE, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ZoneMapFileHeader)) {
+        close(fd);
+        return 0;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return 0;
+
+    map->base = base;
+    map->size = st.st_size;
+    map->header = (const ZoneMapFileHeader *)base;
+
+    const ZoneMapFileHeader *h = map->header;
+    if (memcmp(h->magic, ZONE_MAP_MAGIC, sizeof(ZONE_MAP_MAGIC)) != 0 || h->byte_order != ZONE_MAP_BYTE_ORDER ||
+        h->bucket_count == 0 || (h->bucket_count & (h->bucket_count - 1)) != 0 || h->bucket_count <= h->entry_count ||
+        !section_fits(map->size, h->zones_offset, h->zone_count, ZONE_ID_SIZE) ||
+        !section_fits(map->size, h->entries_offset, h->entry_count, sizeof(ZoneRecord)) ||
+        !section_fits(map->size, h->buckets_offset, h->bucket_count, sizeof(uint32_t)) ||
+        !section_fits(map->size, h->strings_offset, h->strings_size, 1) || h->strings_size == 0 ||
+        ((const char *)base)[h->strings_offset + h->strings_size - 1] != '\0') {
+        fprintf(stderr, "Error: %s is not a valid zone map.\n", ZONE_MAP_BIN_FILE);
+        munmap(base, map->size);
+        map->base = NULL;
+        return 0;
+    }
+
+    map->zones = (const uint8_t (*)[ZONE_ID_SIZE])((const char *)base + h->zones_offset);
+    map->entries = (const ZoneRecord *)((const char *)base + h->entries_offset);
+    map->buckets = (const uint32_t *)((const char *)base + h->buckets_offset);
+    map->strings = (const char *)base + h->strings_offset;
+    return 1;
+}
+
+static void close_zone_map_file(ZoneMapFile *map) {
+    if (map->base) munmap(map->base, map->size);
+    map->base = NULL;
+}
+
+// Check that a record points inside the given tables
+static int record_fits(const ZoneRecord *record, uint32_t zone_count_limit, uint64_t strings_size) {
+    return record->zone < zone_count_limit && record->domain < strings_size && record->content < strings_size;
+}
+
+int lookup_zone_map_file(const char *domain, ZoneMap *entry) {
+    if (!ZONE_MAP_BINARY_MODE || access(ZONE_MAP_JOURNAL, F_OK) == 0) return -1;
+
+    ZoneMapFile map;
+    if (!open_zone_map_file(&map)) return -1;
+
+    int found = 0;
+    const ZoneMapFileHeader *h = map.header;
+    ZoneKey key = {domain, 0, NULL};
+    uint32_t mask = h->bucket_count - 1;
+    uint32_t slot = hash_key(INDEX_DOMAIN, &key) & mask;
+    for (uint32_t probes = 0; probes < h->bucket_count && map.buckets[slot] != 0; probes++, slot = (slot + 1) & mask) {
+        uint32_t i = map.buckets[slot] - 1;
+        if (i >= h->entry_count || !record_fits(&map.entries[i], h->zone_count, h->strings_size)) break;
+
+        const ZoneRecord *record = &map.entries[i];
+        if (strcmp(map.strings + record->domain, domain) == 0) {
+            memset(entry, 0, sizeof(ZoneMap));
+            strncpy(entry->domain, map.strings + record->domain, sizeof(entry->domain) - 1);
+            id_to_hex(map.zones[record->zone], entry->zone_id);
+            id_to_hex(record->record_id, entry->record_id);
+            entry->proxied = (record->flags & ZONE_ENTRY_PROXIED) ? 1 : 0;
+            strncpy(entry->ip_address, map.strings + record->content, sizeof(entry->ip_address) - 1);
+            found = 1;
+            break;
+        }
+    }
+
+    close_zone_map_file(&map);
+    return found;
+}
+
+// Load zone_map.bin. Its sections are the in-memory tables, so loading is a copy
+// of each plus an index rebuild. Returns 0 if there is no usable file.
+static int load_zone_map_binary() {
+    ZoneMapFile map;
+    if (!open_zone_map_file(&map)) return 0;
+    const ZoneMapFileHeader *h = map.header;
+
+    reset_zone_map();
+    records = malloc(((size_t)h->entry_count + 1) * sizeof(ZoneRecord));
+    zones = malloc(((size_t)h->zone_count + 1) * ZONE_ID_SIZE);
+    string_pool = malloc(h->strings_size);
+    if (!records || !zones || !string_pool || h->strings_size > UINT32_MAX) {
+        fprintf(stderr, "Memory allocation error\n");
+        reset_zone_map();
+        close_zone_map_file(&map);
+        return 0;
+    }
+
+    memcpy(zones, map.zones, (size_t)h->zone_count * ZONE_ID_SIZE);
+    zone_count = zones_capacity = h->zone_count;
+    memcpy(string_pool, map.strings, h->strings_size);
+    pool_size = pool_capacity = h->strings_size;
+    records_capacity = h->entry_count;
+
+    // The writer compacts the pool first, so the entries' strings never add up to
+    // more than the strings section. If they do, offsets overlap and the file is bad.
+    uint64_t referenced = 0;
+    for (uint32_t i = 0; i < h->entry_count; i++) {
+        if (!record_fits(&map.entries[i], h->zone_count, h->strings_size)) {
+            fprintf(stderr, "Error: %s entry %u is corrupt.\n", ZONE_MAP_BIN_FILE, i);
+            continue;
+        }
+        records[zone_map_size++] = map.entries[i];
+        referenced += strlen(string_pool + map.entries[i].domain) + 1;
+        referenced += strlen(string_pool + map.entries[i].content) + 1;
+    }
+    if (referenced > h->strings_size) {
+        fprintf(stderr, "Error: %s is not a valid zone map (string offsets overlap).\n", ZONE_MAP_BIN_FILE);
+        reset_zone_map();
+        close_zone_map_file(&map);
+        return 0;
+    }
+    close_zone_map_file(&map);
+
+    if (!index_rebuild(&zone_index, INDEX_ZONE, zone_count) ||
+        !index_rebuild(&domain_index, INDEX_DOMAIN, zone_map_size) ||
+        !index_rebuild(&record_index, INDEX_RECORD, zone_map_size)) {
+        reset_zone_map();
+        return 0;
+    }
+
+    zone_map_dirty = 0;
+    return 1;
+}
+
+// Load zone_map.txt into memory
+static void load_zone_map_text() {
+    FILE *file = fopen(ZONE_MAP_FILE, "r");
+    if (file == NULL) return;
+
+    char line[512];
+    while (fgets(line, sizeof(line), file)) {
+        char *domain = strtok(line, " ");
+        char *zone_id = strtok(NULL, " ");
+        char *record_id = strtok(NULL, " ");
+        char *proxied = strtok(NULL, " ");
+        char *ip_address = strtok(NULL, "\n");
+
+        if (domain && zone_id && record_id && proxied && ip_address) {
+            append_zone_entry(domain, zone_id, record_id, atoi(proxied), ip_address);
+        }
+    }
+    fclose(file);
+}
+
+void load_zone_map() {
+    // In binary mode an existing text map is still read once, then converted on the next save
+    if (!ZONE_MAP_BINARY_MODE || !load_zone_map_binary()) {
+        load_zone_map_text();
+        if (ZONE_MAP_BINARY_MODE && zone_map_size > 0) zone_map_dirty = 1;
+    }
+
+    FILE *journal = fopen(ZONE_MAP_JOURNAL, "r");
+    if (journal != NULL) {
+        char line[512];
+        while (fgets(line, sizeof(line), journal)) {
+            // A torn final line from a crash is ignored
+            if (!strchr(line, '\n')) break;
+            if (apply_zone_line(line)) journal_entries++;
+        }
+        fclose(journal);
+
+        // Without journal mode the replayed changes go into the next snapshot
+        if (journal_entries > 0 && !ZONE_MAP_JOURNAL_MODE) zone_map_dirty = 1;
+    }
+
+    zone_map_loaded = 1;
+}
+
+void load_zone_map_once() {
+    if (!zone_map_loaded) load_zone_map();
+}
+
+// Flush, sync and close a temporary file, then rename it over its target
+static int commit_file(FILE *file, int ok, const char *temp_path, const char *path) {
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp_path, path) != 0) {
+        fprintf(stderr, "Error: Could not write %s.\n", path);
+        remove(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Write zone_map.txt
+static int save_zone_map_text() {
+    FILE *file = fopen(ZONE_MAP_TEMP_FILE, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open zone map file for writing.\n");
+        return 0;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < zone_map_size && ok; i++) {
+        ok = write_zone_entry(file, i) > 0;
+    }
+    return commit_file(file, ok, ZONE_MAP_TEMP_FILE, ZONE_MAP_FILE);
+}
+
+// Write zone_map.bin straight from the in-memory tables
+static int save_zone_map_binary() {
+    if (!compact_string_pool()) return 0;
+    if (domain_index.capacity == 0 && !index_rebuild(&domain_index, INDEX_DOMAIN, 0)) return 0;
+
+    // The domain index uses the file's hash and probing, so it becomes the bucket table
+    uint32_t bucket_count = domain_index.capacity;
+    uint32_t *buckets = malloc(bucket_count * sizeof(uint32_t));
+    if (!buckets) {
+        fprintf(stderr, "Memory allocation error\n");
+        return 0;
+    }
+    for (uint32_t i = 0; i < bucket_count; i++) {
+        buckets[i] = domain_index.slots[i] + 1;
+    }
+
+    // The string table must be non-empty and end in a NUL
+    static const char empty_strings[1] = "";
+    const char *strings = pool_size > 0 ? string_pool : empty_strings;
+    uint64_t strings_size = pool_size > 0 ? pool_size : 1;
+
+    ZoneMapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ZONE_MAP_MAGIC, sizeof(ZONE_MAP_MAGIC));
+    header.byte_order = ZONE_MAP_BYTE_ORDER;
+    header.entry_count = zone_map_size;
+    header.zone_count = zone_count;
+    header.bucket_count = bucket_count;
+    header.zones_offset = sizeof(header);
+    header.entries_offset = header.zones_offset + (uint64_t)zone_count * ZONE_ID_SIZE;
+    header.buckets_offset = header.entries_offset + (uint64_t)zone_map_size * sizeof(ZoneRecord);
+    header.strings_offset = header.buckets_offset + (uint64_t)bucket_count * sizeof(uint32_t);
+    header.strings_size = strings_size;
+
+    FILE *file = fopen(ZONE_MAP_BIN_TEMP_FILE, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open zone map file for writing.\n");
+        free(buckets);
+        return 0;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(zones, ZONE_ID_SIZE, zone_count, file) == (size_t)zone_count &&
+             fwrite(records, sizeof(ZoneRecord), zone_map_size, file) == (size_t)zone_map_size &&
+             fwrite(buckets, sizeof(uint32_t), bucket_count, file) == bucket_count &&
+             fwrite(strings, 1, strings_size, file) == strings_size;
+    free(buckets);
+
+    return commit_file(file, ok, ZONE_MAP_BIN_TEMP_FILE, ZONE_MAP_BIN_FILE);
+}
+
+// The map is written to a temporary file and renamed over the old one,
+// so a crash never leaves a half-written map
+int save_zone_map() {
+    int ok = ZONE_MAP_BINARY_MODE ? save_zone_map_binary() : save_zone_map_text();
+
+    if (ok) zone_map_dirty = 0;
+    return ok;
+}
+
+int compact_zone_map() {
+    if (journal_file) {
+        fclose(journal_file);
+        journal_file = NULL;
+    }
+
+    if (!save_zone_map()) return 0;
+
+    // Replaying the old journal over the new snapshot is harmless, so a crash here is safe
+    if (remove(ZONE_MAP_JOURNAL) != 0 && journal_entries > 0) {
+        fprintf(stderr, "Error: Could not remove %s.\n", ZONE_MAP_JOURNAL);
+        return 0;
+    }
+    journal_entries = 0;
+    return 1;
+}
+
+// Record a change: entry i was written, or (with i < 0) the record
+// zone_id/record_id was removed. In journal mode the change is appended at once;
+// otherwise it is written by the next flush_zone_map().
+static void mark_zone_change_dirty(int i, const char *zone_id, const char *record_id) {
+    zone_map_dirty = 1;
+    if (!ZONE_MAP_JOURNAL_MODE) return;
+
+    if (!journal_file) {
+        journal_file = fopen(ZONE_MAP_JOURNAL, "a");
+        if (!journal_file) {
+            fprintf(stderr, "Error: Could not open %s, changes will be saved on exit.\n", ZONE_MAP_JOURNAL);
+            return;
+        }
+    }
+
+    int written = i >= 0 ? write_zone_entry(journal_file, i)
+                         : fprintf(journal_file, "- %s %s\n", zone_id, record_id);
+    if (written < 0 || fflush(journal_file) != 0) {
+        fprintf(stderr, "Error: Could not append to %s.\n", ZONE_MAP_JOURNAL);
+        return;
+    }
+    journal_entries++;
+
+    // Compact once the journal outgrows the map, keeping total writes linear
+    if (journal_entries > JOURNAL_COMPACT_MIN && journal_entries > zone_map_size) {
+        compact_zone_map();
+    } else {
+        zone_map_dirty = 0;
+    }
+}
+
+static void mark_zone_entry_dirty(int i) {
+    mark_zone_change_dirty(i, NULL, NULL);
+}
+
+int flush_zone_map() {
+    if (journal_file) {
+        fclose(journal_file);
+        journal_file = NULL;
+    }
+    if (!zone_map_dirty) return 1;
+
+    if (ZONE_MAP_JOURNAL_MODE) return compact_zone_map();
+    return save_zone_map();
+}
+
+void update_zone_map(const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address) {
+    int i = find_domain(domain);
+    if (i >= 0) {
+        uint8_t zone[ZONE_ID_SIZE];
+        if (hex_to_id(zone_id, zone) && memcmp(zones[records[i].zone], zone, ZONE_ID_SIZE) != 0) {
+            if (replace_zone_entry(i, zone_id, record_id, proxied, ip_address)) {
+                mark_zone_entry_dirty(i);
+            }
+        }
+        return;
+    }
+
+    // New entry
+    i = append_zone_entry(domain, zone_id, record_id, proxied, ip_address);
+    if (i >= 0) {
+        mark_zone_entry_dirty(i);
+    }
+}
+
+void refresh_zone_map(const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address) {
+    int i = find_domain(domain);
+    if (i >= 0) {
+        if (!replace_zone_entry(i, zone_id, record_id, proxied, ip_address)) return;
+    } else {
+        i = append_zone_entry(domain, zone_id, record_id, proxied, ip_address);
+        if (i < 0) return;
+    }
+    mark_zone_entry_dirty(i);
+}
+
+void remove_zone_map_record(const char *zone_id, const char *record_id) {
+    int i = find_record(zone_id, record_id);
+    if (i < 0) return;
+
+    remove_zone_entry(i);
+    mark_zone_change_dirty(-1, zone_id, record_id);
+}
+
+void remove_zone_map_zone(const char *zone_id) {
+    uint8_t id[ZONE_ID_SIZE];
+    if (!hex_to_id(zone_id, id)) return;
+
+    ZoneKey key = {NULL, 0, id};
+    int zone = index_find(&zone_index, INDEX_ZONE, &key);
+    if (zone < 0) return;
+
+    // Walk backwards so the entry moved into each hole has already been checked
+    for (int i = zone_map_size - 1; i >= 0; i--) {
+        if (records[i].zone != (uint32_t)zone) continue;
+
+        char record_id[33];
+        id_to_hex(records[i].record_id, record_id);
+        remove_zone_entry(i);
+        mark_zone_change_dirty(-1, zone_id, record_id);
+    }
+}
+
+int load_zone_fingerprints(ZoneFingerprint **fingerprints) {
+    *fingerprints = NULL;
+    FILE *file = fopen(ZONE_STATE_FILE, "r");
+    if (file == NULL) return 0;
+
+    int count = 0, capacity = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char *zone_id = strtok(line, " ");
+        char *record_count = strtok(NULL, " ");
+        char *modified_on = strtok(NULL, " \n");
+        char *hash = strtok(NULL, " \n"); // Absent in files written before records were hashed
+        char *zone_modified_on = strtok(NULL, " \n"); // Absent before zones were probed
+        if (!zone_id || !record_count || !modified_on || strlen(zone_id) != ZONE_ID_SIZE * 2) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            ZoneFingerprint *grown = realloc(*fingerprints, capacity * sizeof(ZoneFingerprint));
+            if (!grown) {
+                fprintf(stderr, "Memory allocation error\n");
+                break;
+            }
+            *fingerprints = grown;
+        }
+
+        ZoneFingerprint *fingerprint = &(*fingerprints)[count++];
+        memcpy(fingerprint->zone_id, zone_id, sizeof(fingerprint->zone_id));
+        fingerprint->record_count = atoi(record_count);
+        // "-" stands for a zone without records
+        snprintf(fingerprint->modified_on, sizeof(fingerprint->modified_on), "%s",
+                 strcmp(modified_on, "-") == 0 ? "" : modified_on);
+        fingerprint->hash = hash ? strtoull(hash, NULL, 16) : 0;
+        snprintf(fingerprint->zone_modified_on, sizeof(fingerprint->zone_modified_on), "%s",
+                 !zone_modified_on || strcmp(zone_modified_on, "-") == 0 ? "" : zone_modified_on);
+    }
+    fclose(file);
+    return count;
+}
+
+int save_zone_fingerprints(const ZoneFingerprint *fingerprints, int count) {
+    FILE *file = fopen(ZONE_STATE_TEMP_FILE, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: Could not open %s for writing.\n", ZONE_STATE_TEMP_FILE);
+        return 0;
+    }
+
+    int ok = 1;
+    for (int i = 0; i < count && ok; i++) {
+        ok = fprintf(file, "%s %d %s %016llx %s\n", fingerprints[i].zone_id, fingerprints[i].record_count,
+                     fingerprints[i].modified_on[0] ? fingerprints[i].modified_on : "-",
+                     (unsigned long long)fingerprints[i].hash,
+                     fingerprints[i].zone_modified_on[0] ? fingerprints[i].zone_modified_on : "-") > 0;
+    }
+    return commit_file(file, ok, ZONE_STATE_TEMP_FILE, ZONE_STATE_FILE);
+}
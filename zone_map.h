@@ -0,0 +1,140 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include <stdint.h>
+
+#define ZONE_MAP_FILE "zone_map.txt"               // Zone map file path
+#define ZONE_MAP_TEMP_FILE "zone_map.txt.tmp"      // Written first, then renamed over the map
+#define ZONE_MAP_BIN_FILE "zone_map.bin"           // Binary zone map file path
+#define ZONE_MAP_BIN_TEMP_FILE "zone_map.bin.tmp"  // Written first, then renamed over the binary map
+#define ZONE_MAP_JOURNAL "zone_map.journal"        // Append-only log of changes since the last snapshot
+#define JOURNAL_COMPACT_MIN 1024                   // Journal lines tolerated before compacting
+#define ZONE_STATE_FILE "zone_map.state"           // Per-zone fingerprints of the records the map was built from
+#define ZONE_STATE_TEMP_FILE "zone_map.state.tmp"  // Written first, then renamed over the state file
+
+#define ZONE_ID_SIZE 16 // Cloudflare IDs are 32 hex characters, stored as 16 bytes
+
+// Decoded copy of one zone map entry: domain-to-zone mapping along with record ID,
+// proxied status, and IP address
+typedef struct {
+    char domain[256];
+    char zone_id[33];
+    char record_id[33];
+    int proxied; // 0 or 1 (not proxied or proxied)
+    char ip_address[256];
+} ZoneMap;
+
+// What a zone's records looked like when the map last fetched them. A zone
+// whose fingerprint still matches keeps its cached entries.
+typedef struct {
+    char zone_id[33];
+    int record_count;
+    char modified_on[40]; // Latest modified_on among the zone's records, "" if it has none
+    uint64_t hash;        // Sum of a hash of every record's ID, name, content, proxied and modified_on
+    char zone_modified_on[40]; // The zone's own modified_on from the /zones listing, "" if unknown
+} ZoneFingerprint;
+
+// Binary zone map layout (host byte order). Sections follow the header at the
+// offsets it records; every offset is from the start of the file. The sections
+// are the same tables the map is kept in while loaded.
+#define ZONE_MAP_MAGIC "CFZMAP1"
+#define ZONE_MAP_BYTE_ORDER 0x01020304u
+
+typedef struct {
+    char magic[8];           // ZONE_MAP_MAGIC, NUL padded
+    uint32_t byte_order;     // ZONE_MAP_BYTE_ORDER as written by the host
+    uint32_t entry_count;
+    uint32_t zone_count;
+    uint32_t bucket_count;   // Power of two, at least twice entry_count
+    uint64_t zones_offset;   // zone_count 16-byte zone IDs
+    uint64_t entries_offset; // entry_count ZoneRecord
+    uint64_t buckets_offset; // bucket_count uint32_t: entry + 1 (0 = empty), FNV-1a of the domain
+    uint64_t strings_offset; // NUL-terminated domains and contents
+    uint64_t strings_size;
+} ZoneMapFileHeader;
+
+#define ZONE_ENTRY_PROXIED 0x1
+
+// Compact zone map record (32 bytes). Zone IDs are interned into a zone table
+// and names and contents live in a string pool, both addressed by offset.
+typedef struct {
+    uint8_t record_id[ZONE_ID_SIZE];
+    uint32_t zone;           // Index into the zone table
+    uint32_t domain;         // Offset into the string table
+    uint32_t content;        // Offset into the string table
+    uint32_t flags;          // ZONE_ENTRY_*
+} ZoneRecord;
+
+extern int zone_map_size;
+
+extern int ZONE_MAP_JOURNAL_MODE; // Append changes to a journal instead of rewriting the map
+extern int ZONE_MAP_BINARY_MODE;  // Store the map as zone_map.bin instead of zone_map.txt
+
+// Function to decode the entry at a position. Returns 0 if the position is out of range.
+int get_zone_entry(int i, ZoneMap *entry);
+
+// Functions to read an entry's fields in place, without decoding it. The
+// position must be in range; strings stay valid until the map next changes.
+const char *zone_entry_domain(int i);
+const char *zone_entry_content(int i);
+int zone_entry_proxied(int i);
+int zone_entry_zone(int i); // Position of the entry's zone, as returned by find_zone
+
+// Function to find a zone's position in the zone table; returns it or -1
+int find_zone(const char *zone_id);
+
+// Function to tell whether the map has changed: the value moves on with every
+// added, removed or changed entry, so derived indexes know when to rebuild
+unsigned long zone_map_generation();
+
+// Function to find a domain/subdomain in the zone map; returns its position or -1
+int find_domain(const char *domain);
+
+// Function to find a record by zone and record ID; returns its position or -1
+int find_record(const char *zone_id, const char *record_id);
+
+// Function to empty the zone map and its indexes
+void reset_zone_map();
+
+// Function to load the zone map, then replay any journal written since
+void load_zone_map();
+
+// Function to load the zone map unless it is already in memory
+void load_zone_map_once();
+
+// Function to look a domain up directly in zone_map.bin without loading the map.
+// Returns 1 if found (entry filled in), 0 if not found, -1 if the binary map
+// can't answer (binary mode off, no file, or a pending journal).
+int lookup_zone_map_file(const char *domain, ZoneMap *entry);
+
+// Function to save the zone map atomically. Returns 1 on success, 0 on failure.
+int save_zone_map();
+
+// Function to fold the journal into a fresh snapshot and start a new journal
+int compact_zone_map();
+
+// Function to write out pending zone map changes, if any
+int flush_zone_map();
+
+// Function to update the zone map with a new mapping. IDs must be Cloudflare's
+// 32-character hex IDs; other entries are rejected.
+void update_zone_map(const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address);
+
+// Function to record a record's current state after changing it through the API.
+// Unlike update_zone_map, the domain's entry is replaced whatever zone it was in.
+void refresh_zone_map(const char *domain, const char *zone_id, const char *record_id, int proxied, const char *ip_address);
+
+// Function to drop a deleted record from the zone map, if it is there
+void remove_zone_map_record(const char *zone_id, const char *record_id);
+
+// Function to drop every record of a zone from the zone map
+void remove_zone_map_zone(const char *zone_id);
+
+// Function to read zone_map.state. Returns the number of fingerprints read;
+// *fingerprints is set to an array the caller frees (NULL when there are none).
+int load_zone_fingerprints(ZoneFingerprint **fingerprints);
+
+// Function to write zone_map.state atomically. Returns 1 on success, 0 on failure.
+int save_zone_fingerprints(const ZoneFingerprint *fingerprints, int count);
+
+#endif
@@ -0,0 +1,391 @@
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <arpa/inet.h>
+#include <cjson/cJSON.h>
+
+#include "zone_map.h"
+#include "zone_query.h"
+
+#define QUERY_NAME_MAX 256 // Longest name a query accepts
+
+static const char *const RECORD_KIND_NAMES[RECORD_KINDS] = {"A", "AAAA", "CNAME", "OTHER"};
+
+// Secondary indexes over the zone map, valid while built_generation matches
+static int indexes_built = 0;
+static unsigned long built_generation = 0;
+static int indexed_count = 0;
+
+// Entries with equal content are chained; the hash table holds the first of each chain
+static int *content_slots = NULL; // Chain head position, -1 when empty
+static int content_capacity = 0;  // Power of two
+static int *content_next = NULL;  // Next entry with the same content, -1 at the end
+static int *content_count = NULL; // Chain length, kept at the head position
+
+// Entries of each kind, chained the same way
+static unsigned char *entry_kinds = NULL;
+static int kind_head[RECORD_KINDS];
+static int kind_count[RECORD_KINDS];
+static int *kind_next = NULL;
+
+// Names with their labels reversed ("api.example.com" becomes "com.example.api"),
+// sorted, so every name below a domain sits in one contiguous run
+static char *reversed_pool = NULL;
+static uint32_t *reversed_offsets = NULL; // Per entry
+static int *name_order = NULL;            // Entries in reversed-name order
+
+int guess_record_kind(const char *content) {
+    unsigned char address[sizeof(struct in6_addr)];
+    if (inet_pton(AF_INET, content, address) == 1) return RECORD_KIND_A;
+    if (inet_pton(AF_INET6, content, address) == 1) return RECORD_KIND_AAAA;
+    if (strchr(content, '.') && !strchr(content, ' ')) return RECORD_KIND_CNAME;
+    return RECORD_KIND_OTHER;
+}
+
+const char *record_kind_name(int kind) {
+    return kind >= 0 && kind < RECORD_KINDS ? RECORD_KIND_NAMES[kind] : "OTHER";
+}
+
+// Parse a type name into a kind; -1 if unknown
+static int parse_record_kind(const char *type) {
+    for (int kind = 0; kind < RECORD_KINDS; kind++) {
+        if (strcasecmp(type, RECORD_KIND_NAMES[kind]) == 0) return kind;
+    }
+    return -1;
+}
+
+static uint64_t hash_content(const char *str) {
+    uint64_t hash = 14695981039346656037ULL;
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Write a name with its labels in reverse order, lowercased and without a
+// trailing dot. Returns the length written.
+static size_t reverse_labels(const char *name, char *out, size_t size) {
+    size_t length = strlen(name);
+    while (length > 0 && name[length - 1] == '.') length--;
+    if (length >= size) length = size - 1;
+
+    size_t written = 0;
+    size_t end = length;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        if (written > 0) out[written++] = '.';
+        for (size_t i = start; i < end; i++) out[written++] = (char)tolower((unsigned char)name[i]);
+        end = start > 0 ? start - 1 : 0;
+    }
+    out[written] = '\0';
+    return written;
+}
+
+static void free_indexes() {
+    free(content_slots);
+    free(content_next);
+    free(content_count);
+    free(entry_kinds);
+    free(kind_next);
+    free(reversed_pool);
+    free(reversed_offsets);
+    free(name_order);
+    content_slots = content_next = content_count = kind_next = name_order = NULL;
+    entry_kinds = NULL;
+    reversed_pool = NULL;
+    reversed_offsets = NULL;
+    content_capacity = 0;
+    indexes_built = 0;
+}
+
+static int compare_reversed(const void *a, const void *b) {
+    return strcmp(reversed_pool + reversed_offsets[*(const int *)a], reversed_pool + reversed_offsets[*(const int *)b]);
+}
+
+// Build every secondary index from the map as it is now. Returns 0 on allocation failure.
+static int build_indexes() {
+    free_indexes();
+    int count = zone_map_size;
+
+    content_capacity = 16;
+    while (content_capacity < count * 2) content_capacity *= 2;
+    content_slots = malloc(content_capacity * sizeof(int));
+    content_next = malloc((count + 1) * sizeof(int));
+    content_count = malloc((count + 1) * sizeof(int));
+    entry_kinds = malloc(count + 1);
+    kind_next = malloc((count + 1) * sizeof(int));
+    reversed_offsets = malloc((count + 1) * sizeof(uint32_t));
+    name_order = malloc((count + 1) * sizeof(int));
+
+    size_t pool_size = 1;
+    for (int i = 0; i < count; i++) pool_size += strlen(zone_entry_domain(i)) + 1;
+    reversed_pool = malloc(pool_size);
+
+    if (!content_slots || !content_next || !content_count || !entry_kinds || !kind_next ||
+        !reversed_offsets || !name_order || !reversed_pool || pool_size > UINT32_MAX) {
+        fprintf(stderr, "Memory allocation error\n");
+        free_indexes();
+        return 0;
+    }
+    memset(content_slots, 0xff, content_capacity * sizeof(int));
+    for (int kind = 0; kind < RECORD_KINDS; kind++) {
+        kind_head[kind] = -1;
+        kind_count[kind] = 0;
+    }
+
+    // Walk backwards so every chain comes out in map order
+    uint32_t used = 0;
+    int mask = content_capacity - 1;
+    for (int i = count - 1; i >= 0; i--) {
+        const char *content = zone_entry_content(i);
+
+        int slot = hash_content(content) & mask;
+        while (content_slots[slot] >= 0 && strcmp(zone_entry_content(content_slots[slot]), content) != 0) {
+            slot = (slot + 1) & mask;
+        }
+        int head = content_slots[slot];
+        content_next[i] = head;
+        content_count[i] = head >= 0 ? content_count[head] + 1 : 1;
+        content_slots[slot] = i;
+
+        int kind = guess_record_kind(content);
+        entry_kinds[i] = (unsigned char)kind;
+        kind_next[i] = kind_head[kind];
+        kind_head[kind] = i;
+        kind_count[kind]++;
+
+        reversed_offsets[i] = used;
+        used += reverse_labels(zone_entry_domain(i), reversed_pool + used, pool_size - used) + 1;
+        name_order[i] = i;
+    }
+    qsort(name_order, count, sizeof(int), compare_reversed);
+
+    indexed_count = count;
+    built_generation = zone_map_generation();
+    indexes_built = 1;
+    return 1;
+}
+
+static int ensure_indexes() {
+    if (indexes_built && built_generation == zone_map_generation() && indexed_count == zone_map_size) return 1;
+    return build_indexes();
+}
+
+// Head of the chain of entries whose content is exactly content, or -1
+static int find_content(const char *content) {
+    int mask = content_capacity - 1;
+    for (int slot = hash_content(content) & mask; content_slots[slot] >= 0; slot = (slot + 1) & mask) {
+        if (strcmp(zone_entry_content(content_slots[slot]), content) == 0) return content_slots[slot];
+    }
+    return -1;
+}
+
+// First position in name_order whose reversed name is not below key
+static int lower_bound(const char *key) {
+    int low = 0, high = indexed_count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (strcmp(reversed_pool + reversed_offsets[name_order[mid]], key) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// Range [*first, *last) of name_order holding every name strictly below domain
+static void names_below(const char *domain, int *first, int *last) {
+    char prefix[QUERY_NAME_MAX + 2];
+    size_t length = reverse_labels(domain, prefix, QUERY_NAME_MAX);
+    prefix[length] = '.';
+    prefix[length + 1] = '\0';
+    *first = lower_bound(prefix);
+
+    // '.' + 1 is '/', so this is the first key past every one starting with the prefix
+    prefix[length] = '/';
+    *last = lower_bound(prefix);
+}
+
+// Returns 1 if name is domain or (when strictly is 0) lies below it; 1 only for
+// names below it when strictly is set. Case-insensitive.
+static int name_under(const char *name, const char *domain, int strictly) {
+    size_t name_length = strlen(name), domain_length = strlen(domain);
+    while (domain_length > 0 && domain[domain_length - 1] == '.') domain_length--;
+    while (name_length > 0 && name[name_length - 1] == '.') name_length--;
+
+    if (name_length == domain_length) return !strictly && strncasecmp(name, domain, domain_length) == 0;
+    if (name_length < domain_length + 1) return 0;
+    return name[name_length - domain_length - 1] == '.' &&
+           strncasecmp(name + name_length - domain_length, domain, domain_length) == 0;
+}
+
+// A query resolved against the indexes
+typedef struct {
+    const ZoneQuery *query;
+    const char *below; // Domain whose names (strictly below) match, from "*." names
+    int kind;          // -1 for any
+    int zone;          // -1 for any
+} QueryPlan;
+
+static int entry_matches(const QueryPlan *plan, int i) {
+    const ZoneQuery *query = plan->query;
+    if (plan->kind >= 0 && entry_kinds[i] != plan->kind) return 0;
+    if (plan->zone >= 0 && zone_entry_zone(i) != plan->zone) return 0;
+    if (query->proxied >= 0 && zone_entry_proxied(i) != query->proxied) return 0;
+    if (query->content && strcmp(zone_entry_content(i), query->content) != 0) return 0;
+    if (plan->below && !name_under(zone_entry_domain(i), plan->below, 1)) return 0;
+    if (!plan->below && query->name && strcasecmp(zone_entry_domain(i), query->name) != 0) return 0;
+    if (query->suffix && !name_under(zone_entry_domain(i), query->suffix, 0)) return 0;
+    return 1;
+}
+
+// Report a candidate if it matches. Returns 0 once the limit is reached.
+static int visit(const QueryPlan *plan, int i, int *matches, zone_query_callback callback, void *userdata) {
+    if (!entry_matches(plan, i)) return 1;
+    (*matches)++;
+    if (callback) callback(i, userdata);
+    return plan->query->limit <= 0 || *matches < plan->query->limit;
+}
+
+int run_zone_query(const ZoneQuery *query, zone_query_callback callback, void *userdata) {
+    QueryPlan plan = {query, NULL, -1, -1};
+    if (query->type && (plan.kind = parse_record_kind(query->type)) < 0) {
+        fprintf(stderr, "Error: Unknown record type %s; the zone map only tells A, AAAA, CNAME and OTHER apart.\n", query->type);
+        return -1;
+    }
+    if ((query->name && strlen(query->name) >= QUERY_NAME_MAX) || (query->suffix && strlen(query->suffix) >= QUERY_NAME_MAX)) {
+        fprintf(stderr, "Error: Names are limited to %d characters.\n", QUERY_NAME_MAX - 1);
+        return -1;
+    }
+    if (query->name && strncmp(query->name, "*.", 2) == 0) plan.below = query->name + 2;
+    if (query->zone_id && (plan.zone = find_zone(query->zone_id)) < 0) return 0;
+    if (!ensure_indexes()) return -1;
+
+    // Start from whichever index yields the fewest candidates, then filter
+    int matches = 0;
+    if (query->name && !plan.below) {
+        char lowered[QUERY_NAME_MAX];
+        size_t i = 0;
+        for (; query->name[i] && i + 1 < sizeof(lowered); i++) lowered[i] = (char)tolower((unsigned char)query->name[i]);
+        lowered[i] = '\0';
+        int entry = find_domain(lowered);
+        if (entry < 0) entry = find_domain(query->name);
+        if (entry >= 0) visit(&plan, entry, &matches, callback, userdata);
+        return matches;
+    }
+
+    int best = indexed_count; // Candidates of a full scan
+    enum { FROM_SCAN, FROM_NAMES, FROM_CONTENT, FROM_KIND } source = FROM_SCAN;
+
+    int first = 0, last = 0, self = -1;
+    const char *tree = plan.below ? plan.below : query->suffix;
+    if (tree) {
+        names_below(tree, &first, &last);
+        if (!plan.below) self = find_domain(tree);
+        if (last - first + (self >= 0) < best) {
+            best = last - first + (self >= 0);
+            source = FROM_NAMES;
+        }
+    }
+    int content_head = -1;
+    if (query->content) {
+        content_head = find_content(query->content);
+        if (content_head < 0) return 0;
+        if (content_count[content_head] < best) {
+            best = content_count[content_head];
+            source = FROM_CONTENT;
+        }
+    }
+    if (plan.kind >= 0 && kind_count[plan.kind] < best) {
+        best = kind_count[plan.kind];
+        source = FROM_KIND;
+    }
+
+    switch (source) {
+    case FROM_NAMES:
+        if (self >= 0 && !visit(&plan, self, &matches, callback, userdata)) break;
+        for (int i = first; i < last; i++) {
+            if (!visit(&plan, name_order[i], &matches, callback, userdata)) break;
+        }
+        break;
+    case FROM_CONTENT:
+        for (int i = content_head; i >= 0; i = content_next[i]) {
+            if (!visit(&plan, i, &matches, callback, userdata)) break;
+        }
+        break;
+    case FROM_KIND:
+        for (int i = kind_head[plan.kind]; i >= 0; i = kind_next[i]) {
+            if (!visit(&plan, i, &matches, callback, userdata)) break;
+        }
+        break;
+    default:
+        for (int i = 0; i < indexed_count; i++) {
+            if (!visit(&plan, i, &matches, callback, userdata)) break;
+        }
+    }
+    return matches;
+}
+
+// Print one match as a JSON line
+static void print_match(int entry, void *userdata) {
+    (void)userdata;
+    ZoneMap decoded;
+    if (!get_zone_entry(entry, &decoded)) return;
+
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "name", decoded.domain);
+    cJSON_AddStringToObject(json, "type", record_kind_name(entry_kinds[entry]));
+    cJSON_AddStringToObject(json, "content", decoded.ip_address);
+    cJSON_AddBoolToObject(json, "proxied", decoded.proxied);
+    cJSON_AddStringToObject(json, "zone_id", decoded.zone_id);
+    cJSON_AddStringToObject(json, "record_id", decoded.record_id);
+
+    char *line = cJSON_PrintUnformatted(json);
+    if (line) {
+        printf("%s\n", line);
+        free(line);
+    }
+    cJSON_Delete(json);
+}
+
+int query_zone_map(int argc, char *argv[]) {
+    ZoneQuery query = {NULL, NULL, NULL, NULL, NULL, -1, 0};
+    int count_only = 0;
+    int usage = 0;
+
+    for (int i = 0; i < argc && !usage; i++) {
+        const char *flag = argv[i];
+        if (strcmp(flag, "--count") == 0) {
+            count_only = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage = 1;
+            break;
+        }
+
+        const char *value = argv[++i];
+        if (strcmp(flag, "--name") == 0) query.name = value;
+        else if (strcmp(flag, "--suffix") == 0) query.suffix = value;
+        else if (strcmp(flag, "--content") == 0) query.content = value;
+        else if (strcmp(flag, "--type") == 0) query.type = value;
+        else if (strcmp(flag, "--zone") == 0) query.zone_id = value;
+        else if (strcmp(flag, "--proxied") == 0) query.proxied = atoi(value) ? 1 : 0;
+        else if (strcmp(flag, "--limit") == 0) query.limit = atoi(value);
+        else usage = 1;
+    }
+    if (usage) {
+        printf("Usage: query [--name <fqdn|*.domain>] [--suffix <domain>] [--content <value>] [--type A|AAAA|CNAME|OTHER] "
+               "[--zone <zone_id>] [--proxied 0|1] [--limit <n>] [--count]\n");
+        return 0;
+    }
+
+    load_zone_map_once();
+    int matches = run_zone_query(&query, count_only ? NULL : print_match, NULL);
+    if (matches < 0) return 0;
+    printf("{\"matched\":%d}\n", matches);
+    return 1;
+}
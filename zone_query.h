@@ -0,0 +1,43 @@
+#ifndef ZONE_QUERY_H
+#define ZONE_QUERY_H
+
+// Record types the zone map can tell apart. The map keeps no types, so they
+// are inferred from the shape of each entry's content.
+#define RECORD_KIND_A     0
+#define RECORD_KIND_AAAA  1
+#define RECORD_KIND_CNAME 2
+#define RECORD_KIND_OTHER 3
+#define RECORD_KINDS      4
+
+// A query over the zone map; unset fields match everything
+typedef struct {
+    const char *name;    // Exact FQDN, or "*.example.com" for every name below example.com
+    const char *suffix;  // example.com itself and every name below it
+    const char *content; // Exact content, such as an IP address or a CNAME target
+    const char *type;    // A, AAAA, CNAME or OTHER
+    const char *zone_id;
+    int proxied;         // 0 or 1, -1 for either
+    int limit;           // Most matches to report, 0 for no limit
+} ZoneQuery;
+
+// Called for every match with its zone map position
+typedef void (*zone_query_callback)(int entry, void *userdata);
+
+// Function to guess the kind of record an entry's content belongs to (RECORD_KIND_*)
+int guess_record_kind(const char *content);
+
+// Function to name a record kind: "A", "AAAA", "CNAME" or "OTHER"
+const char *record_kind_name(int kind);
+
+// Function to run a query over the loaded zone map. Indexes by name, content
+// and type are built on first use and kept until the map changes, so repeated
+// queries in one process cost a lookup each.
+// Returns the number of matches, or -1 if the query is invalid.
+int run_zone_query(const ZoneQuery *query, zone_query_callback callback, void *userdata);
+
+// Function to run the query command: load the map, print every match as a
+// JSON line and finish with {"matched":N}. argv holds the flags after "query".
+// Returns 1 on success, 0 on a usage error.
+int query_zone_map(int argc, char *argv[]);
+
+#endif